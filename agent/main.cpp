@@ -0,0 +1,308 @@
+// diskio-agent: the collectors without any Qt, streaming samples to stdout or a file for GUI-less servers.
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "alertrules.hpp"
+#include "cgroupstats.hpp"
+#include "cpustats.hpp"
+#include "metricsexporter.hpp"
+#include "netlinkstats.hpp"
+#include "overhead.hpp"
+#include "procdiskstats.hpp"
+#include "replay.hpp"
+#include "streamwriter.hpp"
+#include "systemstats.hpp"
+
+static std::atomic<bool> stopRequested{false};
+
+struct AgentOptions {
+    OutputFormat format = OutputFormat::Csv;
+    double rateHz = 1;
+    std::string output; // stdout when empty
+    long long count = 0; // samples to take, 0 runs until SIGINT/SIGTERM
+    int flushMs = 1000;
+    bool disk = true;
+    bool net = true;
+    bool cpu = true;
+    bool mem = true;
+    bool cgroup = false; // every cgroup is read, only on request
+    std::string listen; // metrics endpoint address, off when empty
+    std::string record; // raw counter recording, off when empty
+    std::string alertRules; // rule file, see parseAlertRules()
+};
+
+void printUsage(const char* argv0) {
+    std::cerr << "usage: " << argv0 << " [options]\n"
+              << "  --format csv|jsonl|binary  output format (default csv)\n"
+              << "  --rate <hz>                samples per second (default 1, up to 1000)\n"
+              << "  --output <file>            append to a file instead of stdout\n"
+              << "  --count <n>                stop after n samples\n"
+              << "  --flush-ms <ms>            longest time samples stay buffered (default 1000)\n"
+              << "  --families <list>          any of disk,net,cpu,mem,cgroup (default disk,net,cpu,mem)\n"
+              << "  --listen <[host:]port>     serve the latest sample on http://host:port/metrics (host 127.0.0.1)\n"
+              << "  --record <file>            also record the raw counters, for diskio --replay\n"
+              << "  --alert-rules <file>       evaluate alert rules every sample, transitions go to stderr\n";
+}
+
+bool parseOptions(int argc, char** argv, AgentOptions& o) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) throw std::runtime_error(arg + " needs a value");
+            return argv[++i];
+        };
+        if (arg == "--format") {
+            std::string f = value();
+            if (f == "csv") o.format = OutputFormat::Csv;
+            else if (f == "jsonl") o.format = OutputFormat::JsonLines;
+            else if (f == "binary") o.format = OutputFormat::Binary;
+            else throw std::runtime_error("unknown format " + f);
+        } else if (arg == "--rate") {
+            o.rateHz = std::stod(value());
+            if (o.rateHz <= 0 || o.rateHz > 1000) throw std::runtime_error("rate has to be in (0, 1000]");
+        } else if (arg == "--output") {
+            o.output = value();
+        } else if (arg == "--count") {
+            o.count = std::stoll(value());
+        } else if (arg == "--flush-ms") {
+            o.flushMs = std::stoi(value());
+        } else if (arg == "--families") {
+            std::string list = "," + value() + ",";
+            o.disk = list.find(",disk,") != std::string::npos;
+            o.net = list.find(",net,") != std::string::npos;
+            o.cpu = list.find(",cpu,") != std::string::npos;
+            o.mem = list.find(",mem,") != std::string::npos;
+            o.cgroup = list.find(",cgroup,") != std::string::npos;
+        } else if (arg == "--listen") {
+            o.listen = value();
+        } else if (arg == "--record") {
+            o.record = value();
+        } else if (arg == "--alert-rules") {
+            o.alertRules = value();
+        } else if (arg == "--help" || arg == "-h") {
+            return false;
+        } else {
+            throw std::runtime_error("unknown option " + arg);
+        }
+    }
+    return true;
+}
+
+int64_t wallClockMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+int main(int argc, char** argv) {
+    AgentOptions options;
+    try {
+        if (!parseOptions(argc, argv, options)) {
+            printUsage(argv[0]);
+            return 0;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        printUsage(argv[0]);
+        return 2;
+    }
+    raiseOpenFileLimit(); // the cgroup collector keeps files open per cgroup
+
+    std::vector<AlertRule> rules;
+    if (!options.alertRules.empty()) {
+        std::ifstream in(options.alertRules);
+        if (!in) {
+            std::cerr << "cannot open " << options.alertRules << std::endl;
+            return 1;
+        }
+        try {
+            rules = parseAlertRules(in);
+        } catch (const std::exception& e) {
+            std::cerr << options.alertRules << ": " << e.what() << std::endl;
+            return 1;
+        }
+    }
+    AlertEngine alerts(std::move(rules));
+
+    int fd = STDOUT_FILENO;
+    if (!options.output.empty()) {
+        fd = open(options.output.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            std::cerr << "cannot open " << options.output << ": " << strerror(errno) << std::endl;
+            return 1;
+        }
+    }
+    signal(SIGPIPE, SIG_IGN); // a closed pipe shows up as a failed write
+    signal(SIGINT, [](int) { stopRequested = true; });
+    signal(SIGTERM, [](int) { stopRequested = true; });
+
+    const RecordSchema diskSchema{
+        1,
+        "disk",
+        {"read_mbps", "write_mbps", "read_iops", "write_iops", "read_request_kb", "write_request_kb", "read_await_ms",
+         "write_await_ms", "in_flight", "avg_queue_depth", "util_percent"}
+    };
+    const RecordSchema netSchema{2, "net", {"rx_mbps", "tx_mbps"}};
+    RecordSchema cpuSchema{3, "cpu", {"busy_percent"}};
+    for (int s = 0; s < CpuStateCount; s++) cpuSchema.fields.push_back(cpuStateName(s));
+    const RecordSchema memSchema{4, "mem", {"used_percent"}};
+    const RecordSchema cgroupSchema{
+        5, "cgroup", {"read_mbps", "write_mbps", "read_iops", "write_iops", "cpu_percent", "memory_mb"}
+    };
+
+    std::vector<RecordSchema> schemas;
+    if (options.disk) schemas.push_back(diskSchema);
+    if (options.net) schemas.push_back(netSchema);
+    if (options.cpu) schemas.push_back(cpuSchema);
+    if (options.mem) schemas.push_back(memSchema);
+    if (options.cgroup) schemas.push_back(cgroupSchema);
+
+    SampleWriter writer(fd, options.format);
+    writer.writeHeader(schemas);
+
+    MetricsExporter exporter;
+    ExpositionSection& diskSection = exporter.addSection();
+    ExpositionSection& netSection = exporter.addSection();
+    ExpositionSection& systemSection = exporter.addSection();
+    bool exporting = !options.listen.empty();
+    if (exporting && !exporter.start(options.listen)) {
+        std::cerr << exporter.getError() << std::endl;
+        return 1;
+    }
+
+    RecordingWriter recorder;
+    bool recording = !options.record.empty();
+    if (recording && !recorder.open(options.record)) {
+        std::cerr << "cannot open " << options.record << ": " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    ProcDiskStats disk;
+    NetlinkNetworkStats net;
+    SystemStats system;
+    std::unique_ptr<CgroupStats> cgroups;
+    if (options.cgroup) cgroups = std::make_unique<CgroupStats>();
+    std::vector<std::string> cpuNames; // "cpu", "cpu0", ... built once per core count
+    double values[16];
+
+    auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(1.0 / options.rateHz)
+    );
+    auto flushInterval = std::chrono::milliseconds(options.flushMs);
+    auto start = std::chrono::steady_clock::now();
+    auto next = start;
+    auto lastFlush = start;
+    double cpuStart = processCpuSeconds();
+    long long samples = 0;
+
+    while (!stopRequested && writer.ok() && (options.count == 0 || samples < options.count)) {
+        int64_t now = wallClockMs();
+        if (options.disk) {
+            const auto& frame = disk.getFrame();
+            frame.forEachPresent([&](uint32_t id) {
+                const DiskMetrics& m = frame.metrics[id];
+                double v[] = {m.readMBps, m.writeMBps, m.readIops, m.writeIops, m.readRequestKB, m.writeRequestKB,
+                              m.readAwaitMs, m.writeAwaitMs, m.inFlight, m.avgQueueDepth, m.utilPercent};
+                writer.write(diskSchema, frame.names[id], now, v);
+            });
+            if (exporting) {
+                std::string& out = diskSection.begin();
+                renderFrame(out, diskRateFamilies, frame);
+                renderDiskCounters(out, disk);
+                diskSection.publish();
+            }
+            alerts.feed(AlertFamily::Disk, frame, now);
+        }
+        if (options.net) {
+            const auto& frame = net.getFrame();
+            frame.forEachPresent([&](uint32_t id) {
+                values[0] = frame.read[id];
+                values[1] = frame.write[id];
+                writer.write(netSchema, frame.names[id], now, values);
+            });
+            if (exporting) {
+                std::string& out = netSection.begin();
+                renderFrame(out, networkRateFamilies, frame);
+                renderNetworkCounters(out, net);
+                netSection.publish();
+            }
+            alerts.feed(AlertFamily::Network, frame, now);
+        }
+        for (const AlertEvent& e : alerts.takeEvents()) std::cerr << e.timeMs << " " << describeAlert(e) << "\n";
+        if (options.cpu) system.getCpuUsage();
+        if (options.cpu && samples > 0) {
+            const CpuUsage& usage = system.getCpuCoreUsage();
+            while (cpuNames.size() < usage.slots) {
+                cpuNames.push_back(cpuNames.empty() ? "cpu" : "cpu" + std::to_string(cpuNames.size() - 1));
+            }
+            for (size_t slot = 0; slot < usage.slots; slot++) {
+                values[0] = usage.busy[slot];
+                for (int s = 0; s < CpuStateCount; s++) values[1 + s] = usage.getState(s, slot);
+                writer.write(cpuSchema, cpuNames[slot], now, values);
+            }
+        }
+        if (cgroups) {
+            const auto& frame = cgroups->getFrame();
+            frame.forEachPresent([&](uint32_t id) {
+                const CgroupMetrics& m = frame.metrics[id];
+                double v[] = {frame.read[id], frame.write[id], m.readIops, m.writeIops, m.cpuPercent, m.memoryMB};
+                writer.write(cgroupSchema, frame.names[id], now, v);
+            });
+        }
+        int memory = -1;
+        if (options.mem) {
+            memory = system.getMemoryUsage();
+            values[0] = memory;
+            writer.write(memSchema, "mem", now, values);
+        }
+        if (exporting && (options.cpu || options.mem)) {
+            static const CpuUsage noCores;
+            renderSystemExposition(
+                systemSection.begin(), options.cpu && samples > 0 ? system.getCpuCoreUsage() : noCores, memory
+            );
+            systemSection.publish();
+        }
+        if (recording && !recordCounters(
+                             recorder, now, options.disk ? &disk : nullptr, options.net ? &net : nullptr,
+                             options.cpu || options.mem ? &system : nullptr
+                         )) {
+            std::cerr << "recording stopped: " << strerror(errno) << std::endl;
+            recording = false;
+        }
+        samples++;
+        if (options.count > 0 && samples >= options.count) break;
+
+        auto after = std::chrono::steady_clock::now();
+        if (after - lastFlush >= flushInterval) {
+            writer.flush();
+            lastFlush = after;
+        }
+        next += interval;
+        if (next < after) next = after + interval - (after - next) % interval; // skip missed ticks
+        std::this_thread::sleep_until(next);
+    }
+    writer.flush();
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double cpu = processCpuSeconds() - cpuStart;
+    std::cerr << "diskio-agent: " << samples << " samples in " << elapsed << " s, " << cpu << " s cpu ("
+              << (elapsed > 0 ? cpu / elapsed * 100 : 0) << "% of one core)" << std::endl;
+    if (!alerts.empty()) {
+        const AlertEngineStats& a = alerts.getStats();
+        const LatencyHistogram& cost = alerts.getStage().latency;
+        std::cerr << "alerts: " << a.rules << " rules, " << a.instructions << " instructions, "
+                  << a.totalEvaluated << " evaluated, " << cost.getMean() / 1000.0 << " µs mean and "
+                  << cost.getPercentile(0.99) / 1000.0 << " µs p99 per frame, " << a.firing << " firing" << std::endl;
+    }
+    return writer.ok() ? 0 : 1;
+}
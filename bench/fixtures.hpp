@@ -0,0 +1,137 @@
+#pragma once
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+// Synthetic /proc and /sys trees in a temporary directory, pass getRoot() to the collectors.
+// The counters are fixed, the benchmarks measure reading and parsing, not the rates.
+class FixtureTree {
+private:
+    std::filesystem::path root;
+
+    void write(const std::string& path, const std::string& content) {
+        std::filesystem::path p = root / path;
+        std::filesystem::create_directories(p.parent_path());
+        std::ofstream(p) << content;
+    }
+
+    static std::string diskCounters(int i) {
+        // 17 fields like a 5.x kernel: reads, merges, sectors, ms, writes, ..., in flight, io ms, weighted ms,
+        // discards ..., flushes ...
+        std::string s;
+        long long base = 1000LL * (i + 1);
+        for (int f = 0; f < 17; f++) s += " " + std::to_string(f == 8 ? 0 : base * (f + 1));
+        return s;
+    }
+
+public:
+    FixtureTree() {
+        std::string tmpl = (std::filesystem::temp_directory_path() / "diskio-bench-XXXXXX").string();
+        if (!mkdtemp(tmpl.data())) throw std::runtime_error("cannot create fixture directory");
+        root = tmpl;
+    }
+    FixtureTree(const FixtureTree&) = delete;
+    FixtureTree& operator=(const FixtureTree&) = delete;
+    ~FixtureTree() {
+        std::error_code ec;
+        std::filesystem::remove_all(root, ec);
+    }
+
+    std::string getRoot() const { return root.string(); }
+
+    // N NVMe namespaces in /sys/block and /proc/diskstats, plus a loop device the collectors have to skip.
+    void addDisks(int count) {
+        std::string diskstats = "   7       0 loop0" + diskCounters(0) + "\n";
+        write("sys/block/loop0/dev", "7:0\n");
+        write("sys/block/loop0/stat", diskCounters(0) + "\n");
+        for (int i = 0; i < count; i++) {
+            std::string name = "nvme" + std::to_string(i) + "n1";
+            std::string dir = "sys/block/" + name + "/";
+            write(dir + "dev", "259:" + std::to_string(i) + "\n");
+            write(dir + "stat", diskCounters(i) + "\n");
+            write(dir + "queue/hw_sector_size", "512\n");
+            write(dir + "queue/rotational", "0\n");
+            write(dir + "device/model", "Bench NVMe " + std::to_string(i) + "\n");
+            diskstats += " 259 " + std::to_string(i) + " " + name + diskCounters(i) + "\n";
+        }
+        write("proc/diskstats", diskstats);
+    }
+
+    // N interfaces in /proc/net/dev, plus lo.
+    void addInterfaces(int count) {
+        std::string dev = "Inter-|   Receive                                                |  Transmit\n"
+                          " face |bytes    packets errs drop fifo frame compressed multicast|bytes    packets errs "
+                          "drop fifo colls carrier compressed\n"
+                          "    lo: 123456 789 0 0 0 0 0 0 123456 789 0 0 0 0 0 0\n";
+        for (int i = 0; i < count; i++) {
+            long long b = 1000000LL * (i + 1);
+            dev += "  eth" + std::to_string(i) + ": " + std::to_string(b) + " 1000 0 0 0 0 0 0 " + std::to_string(b * 2) +
+                   " 2000 0 0 0 0 0 0\n";
+        }
+        write("proc/net/dev", dev);
+    }
+
+    // N processes with /proc/[pid]/io and /proc/[pid]/comm, pids start at 1000.
+    void addProcesses(int count) {
+        for (int i = 0; i < count; i++) {
+            std::string dir = "proc/" + std::to_string(1000 + i) + "/";
+            long long b = 4096LL * (i + 1);
+            write(
+                dir + "io", "rchar: " + std::to_string(b * 4) + "\nwchar: " + std::to_string(b * 2) + "\nsyscr: " +
+                                std::to_string(i * 10) + "\nsyscw: " + std::to_string(i * 5) + "\nread_bytes: " +
+                                std::to_string(b) + "\nwrite_bytes: " + std::to_string(b / 2) +
+                                "\ncancelled_write_bytes: 0\n"
+            );
+            write(dir + "comm", "worker-" + std::to_string(i) + "\n");
+        }
+    }
+
+    // A cgroup v2 tree of N containers in slices of 100, with io.stat lines for the first `disks` NVMe
+    // namespaces of addDisks() plus a dm volume, cpu.stat and memory.current.
+    void addCgroups(int count, int disks) {
+        auto files = [&](const std::string& dir, long long base) {
+            std::string io;
+            for (int d = 0; d < disks; d++) {
+                io += "259:" + std::to_string(d) + " rbytes=" + std::to_string(base * (d + 1)) +
+                      " wbytes=" + std::to_string(base * 2) + " rios=" + std::to_string(base / 4096) +
+                      " wios=" + std::to_string(base / 2048) + " dbytes=0 dios=0\n";
+            }
+            io += "253:0 rbytes=" + std::to_string(base) + " wbytes=0 rios=1 wios=0 dbytes=0 dios=0\n";
+            write(dir + "io.stat", io);
+            write(dir + "cpu.stat", "usage_usec " + std::to_string(base) + "\nuser_usec 1\nsystem_usec 1\n");
+            write(dir + "memory.current", std::to_string(base * 16) + "\n");
+        };
+        write("sys/block/dm-0/dev", "253:0\n");
+        write("sys/block/dm-0/dm/name", "vg-root\n");
+        write("sys/fs/cgroup/cgroup.controllers", "cpuset cpu io memory pids\n");
+        for (int i = 0; i < count; i++) {
+            std::string slice = "sys/fs/cgroup/bench-" + std::to_string(i / 100) + ".slice/";
+            if (i % 100 == 0) files(slice, 1000000LL * (i + 1));
+            files(slice + "container-" + std::to_string(i) + ".scope/", 4096LL * (i + 1));
+        }
+    }
+
+    // /proc/stat with M cores and the usual trailing lines, and a /proc/meminfo.
+    void addCpus(int cores) {
+        auto line = [](const std::string& name, long long base) {
+            std::string s = name;
+            for (int f = 0; f < 10; f++) s += " " + std::to_string(base * (f + 1));
+            return s + "\n";
+        };
+        std::string stat = line("cpu ", 100000LL * cores);
+        for (int i = 0; i < cores; i++) stat += line("cpu" + std::to_string(i), 100000);
+        stat += "intr 123456789";
+        for (int i = 0; i < 512; i++) stat += " 0";
+        stat += "\nctxt 123456789\nbtime 1700000000\nprocesses 123456\nprocs_running 1\nprocs_blocked 0\n";
+        stat += "softirq 1 2 3 4 5 6 7 8 9 10 11\n";
+        write("proc/stat", stat);
+        write(
+            "proc/meminfo",
+            "MemTotal:       32768000 kB\nMemFree:         8192000 kB\nMemAvailable:   16384000 kB\n"
+            "Buffers:          512000 kB\nCached:          4096000 kB\nSwapCached:            0 kB\n"
+            "Active:          8192000 kB\nInactive:        4096000 kB\n"
+        );
+    }
+};
@@ -0,0 +1,384 @@
+// diskio-bench: micro-benchmarks of the collectors, the rate math and the chart updates against synthetic
+// /proc and /sys trees, so they run on any Linux box without root or real hardware.
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef DISKIO_BENCH_GUI
+#include <QApplication>
+#include <QtWidgets>
+#include <estd/ptr.hpp>
+using namespace estd::shortnames;
+#include "AspectRatioWidget.hpp"
+#include "renderbench.hpp"
+#endif
+
+#include "alertrules.hpp"
+#include "cgroupstats.hpp"
+#include "cpustats.hpp"
+#include "diskstats.hpp"
+#include "fileutil.hpp"
+#include "historytiers.hpp"
+#include "networkstats.hpp"
+#include "procdiskstats.hpp"
+#include "processstats.hpp"
+#include "replay.hpp"
+#include "streamstats.hpp"
+#include "systemstats.hpp"
+
+#include "fixtures.hpp"
+
+// Every allocation of the process goes through here so the benchmarks can report allocations per op.
+static std::atomic<uint64_t> allocations{0};
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+// gcc sees malloc through the inlined operator new and warns about the free, the pair is matched
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+#pragma GCC diagnostic pop
+
+struct BenchOptions {
+    std::string filter; // only run benchmarks whose name contains it
+    std::chrono::milliseconds minTime{200};
+};
+
+static BenchOptions options;
+
+bool selected(const std::string& name) {
+    return options.filter.empty() || name.find(options.filter) != std::string::npos;
+}
+
+// Runs op until minTime passed (after a short warmup) and prints ns/op and allocations/op.
+void bench(const std::string& name, const std::function<void()>& op) {
+    if (!selected(name)) return;
+    for (int i = 0; i < 3; i++) op();
+
+    uint64_t iterations = 0;
+    uint64_t allocsBefore = allocations.load(std::memory_order_relaxed);
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::steady_clock::duration::zero();
+    uint64_t batch = 1;
+    while (elapsed < options.minTime) {
+        for (uint64_t i = 0; i < batch; i++) op();
+        iterations += batch;
+        batch *= 2;
+        elapsed = std::chrono::steady_clock::now() - start;
+    }
+    uint64_t allocs = allocations.load(std::memory_order_relaxed) - allocsBefore;
+
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+    std::cout << std::left << std::setw(44) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(14) << ns << " ns/op" << std::setw(10) << std::setprecision(2)
+              << double(allocs) / iterations << " allocs/op" << std::setw(12) << iterations << " ops" << std::endl;
+}
+
+void benchFiles(FixtureTree& tree) {
+    std::string stat = tree.getRoot() + "/proc/stat";
+    bench("readfile /proc/stat", [&]() { readfile(stat); });
+    ReusedFileReader reader(stat);
+    bench("ReusedFileReader /proc/stat", [&]() { reader.read(); });
+}
+
+void benchDisks(int count) {
+    FixtureTree tree;
+    tree.addDisks(count);
+    std::string n = std::to_string(count);
+
+    DiskStats sysfs(tree.getRoot());
+    bench("DiskStats::getRate " + n + " disks", [&]() { sysfs.getRate(); });
+
+    ProcSnapshot snapshot;
+    ProcDiskStats procfs(snapshot, tree.getRoot());
+    bench("ProcDiskStats::getRate " + n + " disks", [&]() { procfs.getRate(); });
+
+    // What AsyncStats hands to the widget each tick: the frame, copied into a recycled one.
+    DeviceFrame<DiskMetrics> copy;
+    bench("ProcDiskStats::getFrame + copy " + n + " disks", [&]() { copy = procfs.getFrame(); });
+
+    DiskCounters cur, last;
+    parseDiskCounters(" 2000 0 4000 100 3000 0 6000 200 4 300 500 10 0 20 5 7 8", cur);
+    parseDiskCounters(" 1000 0 2000 50 1500 0 3000 100 2 150 250 5 0 10 2 3 4", last);
+    if (count == 1) bench("computeDiskMetrics", [&]() { computeDiskMetrics(cur, last, 0.25); });
+}
+
+void benchNetwork(int count) {
+    FixtureTree tree;
+    tree.addInterfaces(count);
+    NetworkStats net(tree.getRoot());
+    bench("NetworkStats::getRate " + std::to_string(count) + " interfaces", [&]() { net.getRate(); });
+}
+
+void benchProcesses(int count) {
+    FixtureTree tree;
+    tree.addProcesses(count);
+    std::string n = std::to_string(count);
+    for (size_t threads : {0, 3}) {
+        ProcessStats processes(tree.getRoot(), threads);
+        bench(
+            "ProcessStats::getTop " + n + " procs, " + std::to_string(threads + 1) + " thr",
+            [&]() { processes.getTop(25); }
+        );
+    }
+}
+
+void benchCgroups(int count) {
+    FixtureTree tree;
+    tree.addDisks(4);
+    tree.addCgroups(count, 4);
+    std::string n = std::to_string(count);
+    for (size_t threads : {0, 3}) {
+        CgroupStats cgroups(tree.getRoot(), CgroupView::Cgroups, DiskScope::WholeDisks, threads);
+        cgroups.activeOnly = false;
+        bench("CgroupStats::getFrame " + n + " cgroups, " + std::to_string(threads + 1) + " thr", [&]() {
+            cgroups.getFrame();
+        });
+    }
+    CgroupStats devices(tree.getRoot(), CgroupView::CgroupDevices);
+    devices.activeOnly = false;
+    bench("CgroupStats::getFrame " + n + " cgroups by device", [&]() { devices.getFrame(); });
+}
+
+void benchCpus(int cores) {
+    FixtureTree tree;
+    tree.addCpus(cores);
+    std::string n = std::to_string(cores);
+    ProcSnapshot snapshot;
+    SystemStats system(snapshot, tree.getRoot());
+    bench("SystemStats::getCpuUsage " + n + " cores", [&]() { system.getCpuUsage(); });
+    bench("SystemStats::getMemoryUsage", [&]() { system.getMemoryUsage(); });
+}
+
+// Counters of count disks at 4 Hz where every tenth one is busy, recorded and decoded again. Also prints what a
+// day of such a recording takes on disk.
+void benchRecording(int count) {
+    FixtureTree tree;
+    std::string path = tree.getRoot() + "/recording";
+    std::string n = std::to_string(count);
+    std::vector<std::string> names;
+    for (int d = 0; d < count; d++) names.push_back("sd" + std::to_string(d));
+    std::vector<DiskCounters> disks(count);
+    int64_t time = 1700000000000;
+    uint64_t v[recordedDiskFields];
+    auto frame = [&](RecordingWriter& writer) {
+        time += 250;
+        writer.beginFrame(time);
+        for (int d = 0; d < count; d++) {
+            DiskCounters& c = disks[d];
+            if (d % 10 == 0) {
+                c.readIos += 40 + time % 7;
+                c.readSectors += 2048 + time % 13;
+                c.readTicks += 30 + time % 5;
+                c.writeIos += 80 + time % 11;
+                c.writeSectors += 4096 + time % 17;
+                c.writeTicks += 90 + time % 3;
+                c.ioTicks += 200;
+                c.timeInQueue += 120 + time % 19;
+            }
+            diskCountersToFields(c, v);
+            writer.add(CounterFamily::Disk, names[d], v, recordedDiskFields);
+        }
+        writer.endFrame();
+    };
+
+    RecordingWriter writer;
+    writer.open(path);
+    bench("RecordingWriter frame " + n + " disks", [&]() { frame(writer); });
+
+    // a clean recording of one hour for the size, the benchmark above wrote as many frames as it had time for
+    RecordingWriter hour;
+    hour.open(path);
+    for (int i = 0; i < 4 * 3600; i++) frame(hour);
+    double perFrame = double(hour.getBytesWritten()) / hour.getFrameCount();
+    if (selected("RecordingWriter size")) {
+        std::cout << "  RecordingWriter " << n << " disks at 4 Hz: " << std::fixed << std::setprecision(1) << perFrame
+                  << " bytes/frame, " << perFrame * 4 * 86400 / 1048576 << " MB/day" << std::endl;
+    }
+
+    Recording recording;
+    recording.open(path);
+    RecordingCursor cursor(recording);
+    bench("RecordingCursor::next " + n + " disks", [&]() {
+        if (!cursor.next()) cursor.seek(recording.getFirstTime());
+    });
+}
+
+// A day of a bursty (read, write) MB/s trace at 1 Hz, idle most of the time with busy stretches of noisy rates
+// like the per-second history tier sees it. Prints the compressed size and times the window decodes of a chart.
+void benchHistory() {
+    uint64_t state = 42;
+    auto random = [&]() { // xorshift, deterministic and without the allocations of <random>
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return double(state % 1000000) / 1000000.0;
+    };
+    CompressedSeries day(86400, 2, historyMantissaBits);
+    TieredHistory tiered(2);
+    int64_t time = 1700000000000;
+    double level = 0;
+    for (int i = 0; i < 4 * 86400; i++) {
+        time += 250;
+        if (i % 1200 == 0) level = random() < 0.3 ? random() * 400 : 0; // a new 5 minute stretch
+        double v[] = {level * (0.8 + random() * 0.4), level > 0 ? random() * 50 : 0};
+        tiered.append(time, v);
+        if (i % 4 == 0) day.append(time, v);
+    }
+    if (selected("CompressedSeries size")) {
+        std::cout << "  CompressedSeries 1 day at 1 Hz, 2 columns: " << std::fixed << std::setprecision(2)
+                  << double(day.getMemoryBytes()) / (day.size() * 2) << " bytes/sample, TieredHistory 2 columns: "
+                  << tiered.getMemoryBytes() / 1024 << " kB" << std::endl;
+    }
+
+    double sink = 0;
+    bench("TieredHistory::append 2 columns", [&]() {
+        time += 250;
+        double v[] = {random() * 100, 0};
+        tiered.append(time, v);
+    });
+    for (auto [name, spanMs] : {std::pair<const char*, int64_t>{"10 min", 600000}, {"1 day", 86400000}}) {
+        size_t tier = tiered.selectTier(spanMs, 600);
+        bench(std::string("TieredHistory::forEach ") + name + " window", [&]() {
+            tiered.forEach(tier, 0, time - spanMs, [&](int64_t, double, double, double max) { sink += max; });
+        });
+    }
+    bench("CompressedSeries::forEach 1 day at 1 Hz", [&]() {
+        day.forEach(0, 1, 0, [&](int64_t, const double* v) { sink += v[0]; });
+    });
+    if (sink < 0) std::cout << sink; // keeps the loops
+}
+
+// The per tick cost of the statistics table and the cost of one row, after a full day of 4 Hz samples.
+void benchStreamStats() {
+    MetricSummary summary;
+    int64_t time = 1700000000000;
+    double v = 0;
+    for (int i = 0; i < 4 * 86400; i++) {
+        time += 250;
+        v = i % 1200 < 400 ? (i * 7919 % 1000) / 10.0 : 0; // busy a third of the time
+        summary.add(time, v);
+    }
+    bench("MetricSummary::add", [&]() {
+        time += 250;
+        v = v > 90 ? 0 : v + 1.5;
+        summary.add(time, v);
+    });
+    for (size_t w = 0; w < 3; w++) {
+        bench(std::string("MetricSummary::summarize ") + MetricSummary::windowNames[w], [&]() {
+            summary.summarize(w, time);
+        });
+    }
+}
+
+// 10 rules per disk plus a few globs over all of them, a tenth or all of the disks changing per tick.
+void benchAlerts(int disks) {
+    const auto& metrics = alertMetricNames(AlertFamily::Disk);
+    std::ostringstream text;
+    for (int d = 0; d < disks; d++) {
+        for (size_t m = 0; m < 10; m++) {
+            text << "r" << d << "_" << m << ": disk sd" << d << " " << metrics[m] << " > " << 50 + m * 10 << " for 30s\n";
+        }
+    }
+    text << "busy: disk sd* util >= 90 for 1m\nqueue: disk * queue rising\nslow: disk sd1* write_await > 20\n";
+    std::istringstream in(text.str());
+    AlertEngine engine(parseAlertRules(in));
+
+    DeviceFrame<DiskMetrics> frame;
+    for (int d = 0; d < disks; d++) frame.names.push_back("sd" + std::to_string(d));
+    frame.read.assign(disks, 0);
+    frame.write.assign(disks, 0);
+    frame.present.assign(disks, 1);
+    frame.metrics.resize(disks);
+    int64_t time = 1700000000000;
+    uint64_t tick = 0;
+    engine.feed(AlertFamily::Disk, frame, time);
+    std::string label = std::to_string(engine.getStats().rules) + " rules, " + std::to_string(disks) + " disks";
+    for (int changing : {disks / 10, disks}) {
+        bench("AlertEngine::feed " + label + ", " + std::to_string(changing) + " changing", [&]() {
+            time += 250;
+            tick++;
+            for (int i = 0; i < changing; i++) {
+                int d = (tick * 7 + i) % disks;
+                double v = (tick * 31 + d) % 120;
+                frame.read[d] = v;
+                frame.write[d] = v / 2;
+                frame.metrics[d].utilPercent = v;
+                frame.metrics[d].avgQueueDepth = v / 10;
+            }
+            engine.feed(AlertFamily::Disk, frame, time);
+            engine.takeEvents();
+        });
+    }
+    if (selected("AlertEngine size")) {
+        std::cout << "  AlertEngine size " << label << ": " << engine.getStats().instructions << " instructions, "
+                  << engine.getStats().firing << " firing" << std::endl;
+    }
+}
+
+#ifdef DISKIO_BENCH_GUI
+void benchCharts() {
+    for (int series : {1, 2}) {
+        std::vector<double> values(series, 1.0);
+        ValueUsageWidget widget([&]() { return values; }, "bench", {Qt::red, Qt::blue});
+        widget.resize(400, 300);
+        // a full window of history, the steady state of a chart
+        for (int i = 0; i < widget.m_maxDataPoints; i++) widget.updateData();
+        bench("ValueUsageWidget::updateData " + std::to_string(series) + " series", [&]() {
+            values[0] += 0.5;
+            widget.updateData();
+        });
+    }
+    if (options.filter.empty() || std::string("render").find(options.filter) != std::string::npos) {
+        runRenderBench(std::cout, {10, 100, 500}, 20);
+    }
+}
+#endif
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc) {
+            options.filter = argv[++i];
+        } else if (arg == "--min-time-ms" && i + 1 < argc) {
+            options.minTime = std::chrono::milliseconds(std::stoi(argv[++i]));
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--filter <substring>] [--min-time-ms <ms>]" << std::endl;
+            return 2;
+        }
+    }
+    raiseOpenFileLimit(); // as the GUI and the agent do, the process and cgroup collectors size their fd caches by it
+
+    {
+        FixtureTree tree;
+        tree.addCpus(64);
+        benchFiles(tree);
+    }
+    for (int n : {1, 10, 100, 1000}) benchDisks(n);
+    for (int n : {1, 10, 100, 1000}) benchNetwork(n);
+    for (int n : {8, 64, 256}) benchCpus(n);
+    for (int n : {100, 1000, 20000}) benchProcesses(n);
+    for (int n : {100, 1000, 5000}) benchCgroups(n);
+    for (int n : {10, 200}) benchRecording(n);
+    benchHistory();
+    benchStreamStats();
+    benchAlerts(200);
+
+#ifdef DISKIO_BENCH_GUI
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) qputenv("QT_QPA_PLATFORM", "offscreen");
+    QApplication app(argc, argv);
+    benchCharts();
+#endif
+    return 0;
+}
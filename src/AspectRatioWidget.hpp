@@ -50,6 +50,12 @@ public:
     }
 };
 
+// False on a tab that is not selected and in a minimized window. Charts keep collecting then but skip their
+// series updates, and catch up in one go from showEvent() or the next tick once they are back.
+bool isOnScreen(const QWidget* w) {
+    return w->isVisible() && !w->window()->isMinimized();
+}
+
 class ContainerWidget : public QWidget {
 private:
     estd::raw_ptr<QWidget> centralWidget;
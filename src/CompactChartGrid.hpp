@@ -0,0 +1,261 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QPaintEvent>
+#include <QPainter>
+#include <QPixmap>
+#include <QWidget>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "./SystemOverviewWidgets.hpp"
+#include "./seriesbuffer.hpp"
+
+// Paint times of the last frames, in milliseconds.
+struct FrameStats {
+    uint64_t frames = 0;
+    double lastMs = 0;
+    double meanMs = 0; // over the last window
+    double maxMs = 0;  // over the last window
+};
+
+// Draws a whole grid of small line charts in one widget and one paintEvent. Frames, titles and axis labels
+// live in a cached pixmap that is only redrawn for cells whose layout or scale changed, each frame just blits
+// it and draws the polylines. Adding a cell never recreates widgets, it only moves cells in the pixmap.
+class CompactChartGrid : public QWidget {
+private:
+    struct Cell {
+        QString name;
+        SeriesBuffer buffer;
+        double yMax = 1.0;
+        bool staticDirty = true;
+        bool highlighted = false; // title drawn in red
+    };
+
+    std::vector<Cell> cells;
+    std::map<std::string, size_t> cellIndex;
+    QList<QColor> colors;
+    size_t columns;
+
+    QPixmap staticLayer;
+    bool layoutDirty = true;
+    QVector<QPointF> points; // reused for every polyline
+
+    QColor bgColor;
+    QColor plotColor;
+    QColor fgColor;
+    QColor gridColor;
+
+    std::vector<double> frameMs;
+    size_t frameSlot = 0;
+    FrameStats frameStats;
+
+    // Same arrangement as the QGridLayout of DiskUsageWidget: filled column by column.
+    int rowsPerColumn() const {
+        int n = cells.size();
+        int itemsInRow = 4;
+        if (4 < n) itemsInRow = (n + 1) / 2;
+        if (10 < n) itemsInRow = (n + 2) / 3;
+        return std::max(1, itemsInRow);
+    }
+
+    QRect cellRect(size_t i) const {
+        int rows = rowsPerColumn();
+        int cols = (cells.size() + rows - 1) / rows;
+        int w = width() / std::max(1, cols);
+        int h = height() / rows;
+        return QRect((i / rows) * w, (i % rows) * h, w, h);
+    }
+
+    QRect plotRect(const QRect& cell) const {
+        int titleHeight = fontMetrics().height() + 4;
+        int labelWidth = fontMetrics().horizontalAdvance("0000.00") + 4;
+        return cell.adjusted(labelWidth, titleHeight, -4, -4);
+    }
+
+    void drawStatic(QPainter& painter, size_t i) {
+        const Cell& cell = cells[i];
+        QRect rect = cellRect(i);
+        QRect plot = plotRect(rect);
+        painter.fillRect(rect, bgColor);
+        if (plot.width() <= 0 || plot.height() <= 0) return;
+        painter.fillRect(plot, plotColor);
+
+        painter.setPen(gridColor);
+        for (int g = 1; g < 4; g++) {
+            int y = plot.top() + plot.height() * g / 4;
+            painter.drawLine(plot.left(), y, plot.right(), y);
+        }
+        painter.drawRect(plot);
+
+        painter.setPen(cell.highlighted ? QColor(255, 70, 70) : fgColor);
+        QFont font = painter.font();
+        font.setBold(true);
+        painter.setFont(font);
+        painter.drawText(QRect(rect.left(), rect.top(), rect.width(), plot.top() - rect.top()), Qt::AlignCenter, cell.name);
+        font.setBold(false);
+        painter.setFont(font);
+        painter.setPen(fgColor);
+        QRect labels(rect.left(), plot.top(), plot.left() - rect.left() - 2, plot.height());
+        painter.drawText(labels, Qt::AlignRight | Qt::AlignTop, QString::number(cell.yMax, 'f', 2));
+        painter.drawText(labels, Qt::AlignRight | Qt::AlignBottom, "0");
+    }
+
+    void updateStaticLayer() {
+        if (layoutDirty || staticLayer.size() != size() * devicePixelRatioF()) {
+            staticLayer = QPixmap(size() * devicePixelRatioF());
+            staticLayer.setDevicePixelRatio(devicePixelRatioF());
+            staticLayer.fill(bgColor);
+            for (auto& cell : cells) cell.staticDirty = true;
+            layoutDirty = false;
+        }
+        QPainter painter(&staticLayer);
+        for (size_t i = 0; i < cells.size(); i++) {
+            if (!cells[i].staticDirty) continue;
+            drawStatic(painter, i);
+            cells[i].staticDirty = false;
+        }
+    }
+
+    void drawSeries(QPainter& painter, size_t i, int64_t now) {
+        const Cell& cell = cells[i];
+        QRect plot = plotRect(cellRect(i));
+        if (plot.width() <= 0 || plot.height() <= 0 || cell.buffer.size() < 2) return;
+        double xScale = double(plot.width()) / m_xAxisRangeMs;
+        double yScale = plot.height() / cell.yMax;
+        int64_t start = now - m_xAxisRangeMs;
+        size_t first = cell.buffer.lowerBound(start);
+        for (size_t c = 0; c < cell.buffer.getColumns(); c++) {
+            points.resize(0);
+            cell.buffer.forEach(c, [&](int64_t time, double value) {
+                points.append(QPointF(plot.left() + (time - start) * xScale, plot.bottom() - value * yScale));
+            }, first);
+            QPen pen(colors.isEmpty() ? fgColor : colors[c % colors.size()]);
+            pen.setWidthF(1.5);
+            painter.setPen(pen);
+            painter.drawPolyline(points.constData(), points.size());
+        }
+    }
+
+    void recordFrame(double ms) {
+        if (frameMs.empty()) frameMs.assign(60, 0.0);
+        frameMs[frameSlot] = ms;
+        frameSlot = (frameSlot + 1) % frameMs.size();
+        frameStats.frames++;
+        frameStats.lastMs = ms;
+        size_t n = std::min<size_t>(frameStats.frames, frameMs.size());
+        double sum = 0, max = 0;
+        for (size_t f = 0; f < n; f++) {
+            sum += frameMs[f];
+            max = std::max(max, frameMs[f]);
+        }
+        frameStats.meanMs = sum / n;
+        frameStats.maxMs = max;
+    }
+
+protected:
+    void paintEvent(QPaintEvent* event) override {
+        QElapsedTimer timer;
+        timer.start();
+        updateStaticLayer();
+
+        QPainter painter(this);
+        painter.drawPixmap(0, 0, staticLayer);
+        painter.setRenderHint(QPainter::Antialiasing, m_antialiasing);
+        int64_t now = 0;
+        for (auto& cell : cells) {
+            if (cell.buffer.size() > 0) now = std::max(now, cell.buffer.time(cell.buffer.size() - 1));
+        }
+        for (size_t i = 0; i < cells.size(); i++) {
+            QRect rect = cellRect(i);
+            if (!event->rect().intersects(rect)) continue;
+            painter.setClipRect(plotRect(rect));
+            drawSeries(painter, i, now);
+        }
+        recordFrame(timer.nsecsElapsed() / 1e6);
+    }
+
+    void resizeEvent(QResizeEvent*) override { layoutDirty = true; }
+
+public:
+    int m_maxDataPoints = 600;
+    qint64 m_xAxisRangeMs = 60000; // 1 minute
+    bool m_antialiasing = true;
+
+    // columns is the number of series per cell, they take colors in that order.
+    CompactChartGrid(size_t columns, QList<QColor> colors, QWidget* parent = nullptr) :
+        QWidget(parent), colors(colors), columns(columns) {
+        bgColor = palette().color(QPalette::Background);
+        plotColor = palette().color(QPalette::Base);
+        fgColor = palette().color(QPalette::Foreground);
+        gridColor = palette().color(QPalette::Disabled, QPalette::Foreground);
+        setAttribute(Qt::WA_OpaquePaintEvent);
+        setMinimumSize(120, 120);
+    }
+
+    // Adds a sample of one value per series to a cell, creating it on first use. Call update() once all cells
+    // got their sample.
+    void append(const std::string& name, int64_t time, const double* values) {
+        auto it = cellIndex.find(name);
+        if (it == cellIndex.end()) {
+            it = cellIndex.emplace(name, cells.size()).first;
+            cells.push_back({QString::fromStdString(name), SeriesBuffer(m_maxDataPoints, columns), 1.0, true});
+            layoutDirty = true; // cell sizes change, existing cells keep their buffers
+        }
+        Cell& cell = cells[it->second];
+        cell.buffer.append(time, values);
+        double yMax = autoscaleMax(cell.yMax, std::max(0.0, cell.buffer.max()));
+        if (yMax != cell.yMax) {
+            cell.yMax = yMax;
+            cell.staticDirty = true;
+        }
+    }
+
+    // Drops all cells, e.g. when the number of series per cell changes.
+    void reset(size_t newColumns) {
+        columns = newColumns;
+        cells.clear();
+        cellIndex.clear();
+        layoutDirty = true;
+        update();
+    }
+
+    // Drops the cells gone(name) is true for, e.g. of removed containers. The other cells keep their buffers.
+    template <class F>
+    void removeIf(F gone) {
+        std::vector<size_t> newIndex(cells.size(), size_t(-1));
+        for (auto it = cellIndex.begin(); it != cellIndex.end();) {
+            if (gone(it->first)) {
+                it = cellIndex.erase(it);
+            } else {
+                newIndex[it->second] = 0;
+                ++it;
+            }
+        }
+        size_t kept = 0;
+        for (size_t i = 0; i < cells.size(); i++) {
+            if (newIndex[i] == size_t(-1)) continue;
+            newIndex[i] = kept;
+            if (kept != i) cells[kept] = std::move(cells[i]);
+            kept++;
+        }
+        if (kept == cells.size()) return;
+        cells.erase(cells.begin() + kept, cells.end());
+        for (auto& [name, i] : cellIndex) i = newIndex[i];
+        layoutDirty = true;
+        update();
+    }
+
+    // Marks the title of a cell, e.g. while an alert rule fires for its device.
+    void setHighlighted(const std::string& name, bool highlighted) {
+        auto it = cellIndex.find(name);
+        if (it == cellIndex.end() || cells[it->second].highlighted == highlighted) return;
+        cells[it->second].highlighted = highlighted;
+        cells[it->second].staticDirty = true;
+    }
+
+    size_t getCellCount() const { return cells.size(); }
+    bool hasCell(const std::string& name) const { return cellIndex.count(name) > 0; }
+    const FrameStats& getFrameStats() const { return frameStats; }
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <QHeaderView>
+#include <QSet>
+#include <QTreeWidget>
+#include <vector>
+
+#include "./AspectRatioWidget.hpp"
+#include "./QLambdaTimer.hpp"
+#include "./procdiskstats.hpp"
+
+// Disks with their partitions, LVM/dm-crypt volumes and md arrays as a collapsible tree. A disk row shows what
+// the disk did, the rows below it how much of that came from each device stacked on it.
+class DiskTopologyWidget : public QTreeWidget {
+private:
+    ProcDiskStats stats{sharedProcSnapshot(), "", DiskScope::AllLayers};
+    uint64_t builtGeneration = 0;
+    std::vector<QTreeWidgetItem*> items; // [topology row]
+    QSet<QString> collapsed;             // row keys, survive rebuilds on hotplug
+
+    static QString kindText(const BlockDevice& dev) {
+        switch (dev.kind) {
+        case BlockDeviceKind::Disk: return dev.model.empty() ? "disk" : "disk, " + QString::fromStdString(dev.model);
+        case BlockDeviceKind::Partition: return "partition";
+        case BlockDeviceKind::DeviceMapper: return "dm " + QString::fromStdString(dev.label);
+        case BlockDeviceKind::MdRaid: return "md " + QString::fromStdString(dev.label);
+        }
+        return "";
+    }
+
+    void rebuild() {
+        const BlockTopology& topology = stats.getTopology();
+        clear();
+        items.clear();
+        for (auto& row : topology.getRows()) {
+            const BlockDevice& dev = topology.getDevices()[row.device];
+            QTreeWidgetItem* item = row.parent < 0 ? new QTreeWidgetItem(this) : new QTreeWidgetItem(items[row.parent]);
+            QString key = QString::fromStdString(row.key);
+            item->setData(0, Qt::UserRole, key);
+            item->setText(0, QString::fromStdString(dev.name));
+            item->setText(1, kindText(dev));
+            item->setTextAlignment(2, Qt::AlignRight | Qt::AlignVCenter);
+            item->setTextAlignment(3, Qt::AlignRight | Qt::AlignVCenter);
+            items.push_back(item);
+        }
+        for (auto* item : items) item->setExpanded(!collapsed.contains(item->data(0, Qt::UserRole).toString()));
+        builtGeneration = topology.getGeneration();
+    }
+
+    // Only runs while the tab is on screen, the tree has no history to keep and the first sample after a pause
+    // reports the average over it.
+    void updateData() {
+        if (!isOnScreen(this)) return;
+        static OverheadStage& stage = monitorOverhead().stage("collect: ProcDiskStats all layers");
+        bool sampled;
+        {
+            OverheadScope scope(stage);
+            sampled = stats.sample();
+        }
+        if (!sampled && builtGeneration != 0) return;
+        const BlockTopology& topology = stats.getTopology();
+        if (topology.getGeneration() != builtGeneration) rebuild();
+        for (size_t r = 0; r < items.size(); r++) {
+            items[r]->setText(2, QString::number(topology.getRead(r), 'f', 2));
+            items[r]->setText(3, QString::number(topology.getWrite(r), 'f', 2));
+        }
+    }
+
+protected:
+    void showEvent(QShowEvent* event) override {
+        QTreeWidget::showEvent(event);
+        updateData();
+    }
+
+public:
+    DiskTopologyWidget(QWidget* parent = nullptr) : QTreeWidget(parent) {
+        setColumnCount(4);
+        setHeaderLabels({"Device", "Type", "Read MB/s", "Write MB/s"});
+        headerItem()->setToolTip(
+            2, "Below a disk: the part of that disk's traffic caused by the device. Volumes on several disks are "
+               "split between them."
+        );
+        headerItem()->setToolTip(3, headerItem()->toolTip(2));
+        header()->setSectionResizeMode(0, QHeaderView::ResizeToContents);
+        header()->setSectionResizeMode(1, QHeaderView::Stretch);
+        setUniformRowHeights(true);
+        QObject::connect(this, &QTreeWidget::itemCollapsed, [this](QTreeWidgetItem* item) {
+            collapsed.insert(item->data(0, Qt::UserRole).toString());
+        });
+        QObject::connect(this, &QTreeWidget::itemExpanded, [this](QTreeWidgetItem* item) {
+            collapsed.remove(item->data(0, Qt::UserRole).toString());
+        });
+    }
+
+    void attachTo(QLambdaTimer& t) {
+        t.addLambda([&]() { updateData(); }, "DiskTopologyWidget");
+    }
+};
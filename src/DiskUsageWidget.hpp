@@ -5,72 +5,214 @@
 #include "./SystemThemedChart.hpp"
 #include "./QLambdaTimer.hpp"
 #include "./SystemOverviewWidgets.hpp"
+#include "./CompactChartGrid.hpp"
+#include "./StatsTableWidget.hpp"
+#include "./alertrules.hpp"
+#include "./mmapstore.hpp"
+#include "./sampleframe.hpp"
 
-double getMaxY(QLineSeries* ser) {
-    double maxY = 0;
-    for (auto& p : ser->points()) {
-        if (p.y() > maxY) maxY = p.y();
-    }
-    return maxY;
-}
+// Collectors that also report min/mean/max envelopes per display tick (HighFrequencySampler) get band charts.
+template <class T, class = void>
+struct hasEnvelopes : std::false_type {};
+template <class T>
+struct hasEnvelopes<T, std::void_t<decltype(std::declval<T&>().getEnvelopes())>> : std::true_type {};
 
+// A per device chart of DiskMetrics, labels are listed in series order and take the chart colors in that order.
+struct DiskMetricView {
+    QString name;
+    QStringList labels;
+    std::function<void(const DiskMetrics&, double*)> values; // writes one value per label
+};
 
-void keepLastSeries(QLineSeries* ser, int numKeep = 200) {
-    while (ser->count() > numKeep) { ser->remove(0); }
+std::vector<DiskMetricView> diskMetricViews() {
+    auto pair = [](double DiskMetrics::*first, double DiskMetrics::*second) {
+        return [=](const DiskMetrics& m, double* v) {
+            v[0] = m.*first;
+            v[1] = m.*second;
+        };
+    };
+    return {
+        {"Throughput (MB/s)", {"WRITE", "READ"}, pair(&DiskMetrics::writeMBps, &DiskMetrics::readMBps)},
+        {"IOPS", {"WRITE", "READ"}, pair(&DiskMetrics::writeIops, &DiskMetrics::readIops)},
+        {"Request size (KB)", {"WRITE", "READ"}, pair(&DiskMetrics::writeRequestKB, &DiskMetrics::readRequestKB)},
+        {"Await (ms)", {"WRITE", "READ"}, pair(&DiskMetrics::writeAwaitMs, &DiskMetrics::readAwaitMs)},
+        {"Queue depth", {"IN FLIGHT", "AVG QUEUE"}, pair(&DiskMetrics::inFlight, &DiskMetrics::avgQueueDepth)},
+        {"Utilization (%)", {"BUSY"}, [](const DiskMetrics& m, double* v) { v[0] = m.utilPercent; }},
+        {"Discard / flush (IOPS)", {"DISCARD", "FLUSH"}, pair(&DiskMetrics::discardIops, &DiskMetrics::flushIops)},
+    };
 }
 
 template<class STAT_TYPE = DiskStats>
 class DiskUsageWidget : public ContainerWidget {
 private:
+    static_assert(
+        isCollector<STAT_TYPE>,
+        "STAT_TYPE needs getFrame() returning const DeviceFrame<M>&, or getRate() returning "
+        "std::map<std::string, std::pair<double, double>>"
+    );
+    using ChartWidget = std::conditional_t<hasEnvelopes<STAT_TYPE>::value, EnvelopeUsageWidget, ValueUsageWidget>;
+    using Frame = typename FrameOf<STAT_TYPE>::type;
+    static constexpr bool hasMetrics = std::is_same_v<typename Frame::Metrics, DiskMetrics>;
+
     STAT_TYPE dstats;
+    FrameReader<STAT_TYPE> reader;
+    Frame frame; // the current tick, copy assigned so its storage is reused
 
-    std::map<std::string, rptr<ValueUsageWidget>> chart;
+    struct DeviceChart {
+        rptr<ChartWidget> view;
+        uint32_t id; // the frame slot it reads
+    };
+    std::map<std::string, DeviceChart> chart;
+    uint64_t idVersion = 0; // of the frame the charts were checked against
     rptr<EQLayoutWidget<QGridLayout>> w = new EQLayoutWidget<QGridLayout>();
+    QLabel* costLabel = nullptr;
+    QLabel* legend = nullptr;
+    CompactChartGrid* grid = nullptr; // replaces the per device charts when set
+    StatsTableWidget* statsTable = nullptr;
+    AlertEngine* alerts = nullptr; // fed every tick when set, firing devices get a marked chart
+    AlertFamily alertFamily = AlertFamily::Disk;
+
+    std::map<std::string, std::vector<MetricRecord>> history; // (read, write) records from the previous runs
+
+    std::vector<DiskMetricView> metricViews = diskMetricViews();
+    size_t metricView = 0; // 0 is throughput, drawn from the frame rates so it works for every collector
+
+    std::vector<double> valueRow; // scratch of valuesFor()
+
+    size_t seriesCount() const { return metricViews[metricView].labels.size(); }
+
+    // Values of the current metric view in series order, the compact grid only draws envelope means. Points into
+    // valueRow, the next call overwrites them.
+    const double* valuesFor(uint32_t id) {
+        valueRow.resize(std::max<size_t>(2, seriesCount()));
+        double* v = valueRow.data();
+        if constexpr (hasEnvelopes<STAT_TYPE>::value) {
+            auto& e = envelopes[frame.names[id]];
+            v[0] = e.second.mean;
+            v[1] = e.first.mean;
+            return v;
+        }
+        if constexpr (hasMetrics) {
+            if (metricView != 0) {
+                metricViews[metricView].values(frame.metrics[id], v);
+                return v;
+            }
+        }
+        v[0] = frame.write[id];
+        v[1] = frame.read[id];
+        return v;
+    }
 
-    rptr<ValueUsageWidget> createChart(std::string name) {
-        rptr<ValueUsageWidget> cw = new ValueUsageWidget([=](){
-            // std::cout << name << " " << mbps[name].first << std::endl;
-            return std::vector<double>{mbps[name].second, mbps[name].first};
-        }, name.c_str(), {red, blue});
-        return cw;
+    // An id stays with its device until the collector releases it, see dropReleased(), so the chart keeps reading
+    // the same slot of each frame.
+    rptr<ChartWidget> createChart(uint32_t id) {
+        const std::string& name = frame.names[id];
+        if constexpr (hasEnvelopes<STAT_TYPE>::value) {
+            return new EnvelopeUsageWidget([=](){
+                auto& e = envelopes[name];
+                return std::vector<Envelope>{e.second, e.first};
+            }, name.c_str(), {red, blue});
+        } else {
+            return new ValueUsageWidget([=](){
+                const double* v = valuesFor(id);
+                return std::vector<double>(v, v + seriesCount());
+            }, name.c_str(), {red, blue});
+        }
+    }
+
+    // Starts a new throughput chart with the recorded history of its device.
+    void backfill(const std::string& dev) {
+        auto it = history.find(dev);
+        if (it == history.end() || metricView != 0) return;
+        for (auto& r : it->second) {
+            double values[] = {r.values[1], r.values[0]};
+            if (grid) grid->append(dev, r.timeMs, values);
+            else if constexpr (!hasEnvelopes<STAT_TYPE>::value)
+                chart[dev].view->backfill(r.timeMs, std::vector<double>(values, values + 2));
+        }
     }
 
+    void updateCostLabel() {
+        const SamplerCost& cost = dstats.getCost();
+        costLabel->setText(
+            QString("sampling every %1 ms: %2% CPU, %3 µs/sample, %4 late")
+                .arg(std::chrono::duration<double, std::milli>(cost.interval).count())
+                .arg(cost.cpuFraction * 100, 0, 'f', 2)
+                .arg(cost.nsPerSample / 1000.0, 0, 'f', 1)
+                .arg(cost.late)
+        );
+    }
+
+    QString legendText(const QStringList& labels) {
+        QList<QColor> colors{red, blue};
+        QString text;
+        for (int i = labels.size() - 1; i >= 0; i--) {
+            text += "<b><font color='" + colors[i % colors.size()].name(QColor::HexRgb) + "' font_size=6>• " + labels[i];
+            if (i != 0) text += "&nbsp;&nbsp;&nbsp;";
+        }
+        return text;
+    }
+
+    // Charts are rebuilt because the number of series depends on the metric.
+    void setMetricView(size_t view) {
+        metricView = view;
+        for (auto& [dev, c] : chart) {
+            w->layout->removeWidget(c.view.get());
+            c.view->deleteLater();
+        }
+        chart.clear();
+        if (grid) grid->reset(metricViews[metricView].labels.size());
+        legend->setText(legendText(metricViews[metricView].labels));
+    }
+
+    // Only charts whose grid position changed are moved, a new device does not re-add every chart.
     void updateStrech() {
-        for (auto& [dev, _] : chart) { w->layout->removeWidget(chart[dev].get()); }
         int itemNum = 0;
         int itemsInRow = 4;
         if (4 < chart.size()) itemsInRow = (chart.size() + 1) / 2;
         if (10 < chart.size()) itemsInRow = (chart.size() + 2) / 3;
-        for (auto& [dev, _] : chart) {
-            w->layout->addWidget(chart[dev].get(), itemNum % itemsInRow, itemNum / itemsInRow);
+        for (auto& [dev, c] : chart) {
+            int row = itemNum % itemsInRow;
+            int column = itemNum / itemsInRow;
+            int index = w->layout->indexOf(c.view.get());
+            int r = -1, cl = -1, rowSpan, columnSpan;
+            if (index >= 0) w->layout->getItemPosition(index, &r, &cl, &rowSpan, &columnSpan);
+            if (r != row || cl != column) {
+                if (index >= 0) w->layout->removeWidget(c.view.get());
+                w->layout->addWidget(c.view.get(), row, column);
+            }
             itemNum++;
         }
         w->setMinimumSize(120, 120);
     }
 
-    std::map<std::string, std::pair<double, double>> mbps;
-
-    void updateData(){
-        mbps = dstats.getRate();
-        for (auto& [dev, _] : mbps) {
-            // std::cout << dev << std::endl;
-            if (!chart.count(dev)) {
-                chart[dev] = createChart(dev);
-                updateStrech();
+    // Drops the charts and grid cells of devices whose id the collector released (removed containers), or gave
+    // to another device since.
+    void dropReleased() {
+        bool removed = false;
+        for (auto it = chart.begin(); it != chart.end();) {
+            if (it->second.id < frame.size() && frame.names[it->second.id] == it->first) {
+                ++it;
+                continue;
             }
+            w->layout->removeWidget(it->second.view.get());
+            it->second.view->deleteLater();
+            it = chart.erase(it);
+            removed = true;
         }
-        // std::cout <<"----------"<< std::endl;
-        for(auto& chrt: chart){
-            chrt.second->updateData();
+        if (removed) updateStrech();
+        if (grid) {
+            std::set<std::string_view> live(frame.names.begin(), frame.names.end());
+            grid->removeIf([&](const std::string& name) { return live.count(name) == 0; });
         }
     }
 
+    std::map<std::string, std::pair<Envelope, Envelope>> envelopes;
+
     QColor red;
     QColor blue;
 
-public:
-    DiskUsageWidget(QWidget* parent = nullptr) : ContainerWidget(parent) {
-        
+    void init() {
         w->setSizePolicy(QSizePolicy(QSizePolicy::MinimumExpanding, QSizePolicy::MinimumExpanding));
 
         rptr<EQLayoutWidget<QVBoxLayout>> wLegend = new EQLayoutWidget<QVBoxLayout>();
@@ -85,20 +227,114 @@ public:
 
         wLegend->setAutoFillBackground(true);
 
+        if constexpr (hasMetrics) {
+            QComboBox* metricSelector = new QComboBox();
+            for (auto& view : metricViews) metricSelector->addItem(view.name);
+            QObject::connect(metricSelector, QOverload<int>::of(&QComboBox::currentIndexChanged), [this](int i) {
+                setMetricView(i);
+            });
+            wLegend->addWidget(metricSelector);
+        }
+
         wLegend->addWidget(w.get());
-        QLabel* legend = new QLabel(
-            "<b><font color='" + blue.name(QColor::HexRgb) + "' font_size=6>• READ&nbsp;&nbsp;&nbsp;<b><font color='" +
-            red.name(QColor::HexRgb) + "' font_size=6>• WRITE"
-        );
+        legend = new QLabel(legendText(metricViews[0].labels));
         wLegend->addWidget(legend);
         legend->setAlignment(Qt::AlignCenter);
         legend->setContentsMargins(QMargins(0, 0, 0, 5));
         w->layout->setVerticalSpacing(0);
 
+        if constexpr (hasEnvelopes<STAT_TYPE>::value) {
+            costLabel = new QLabel();
+            costLabel->setAlignment(Qt::AlignCenter);
+            wLegend->addWidget(costLabel);
+        }
+
+        // throughput statistics of every device, hidden until asked for
+        QCheckBox* showStats = new QCheckBox("Statistics (MB/s)");
+        statsTable = new StatsTableWidget("MB/s");
+        statsTable->hide();
+        QObject::connect(showStats, &QCheckBox::toggled, statsTable, &QWidget::setVisible);
+        wLegend->addWidget(showStats);
+        wLegend->addWidget(statsTable);
+
         ContainerWidget::setWidget(wLegend.get());
     }
 
+public:
+    DiskUsageWidget(QWidget* parent = nullptr) : ContainerWidget(parent) { init(); }
+
+    // Forwards the remaining arguments to the STAT_TYPE constructor, e.g. the sampling interval.
+    template <class... StatArgs>
+    DiskUsageWidget(QWidget* parent, StatArgs&&... args) :
+        ContainerWidget(parent), dstats(std::forward<StatArgs>(args)...) {
+        init();
+    }
+
+    void updateData(){
+        frame = reader.read(dstats);
+        if (frame.idVersion != idVersion) {
+            idVersion = frame.idVersion;
+            dropReleased();
+        }
+        qint64 now = QDateTime::currentDateTime().toMSecsSinceEpoch();
+        statsTable->add(now, frame);
+        if (alerts) alerts->feed(alertFamily, frame, now);
+        if constexpr (hasEnvelopes<STAT_TYPE>::value) {
+            envelopes = dstats.getEnvelopes();
+            if (isOnScreen(this)) updateCostLabel();
+        }
+        if (grid) {
+            frame.forEachPresent([&](uint32_t id) {
+                const std::string& dev = frame.names[id];
+                if (!grid->hasCell(dev)) backfill(dev);
+                grid->append(dev, now, valuesFor(id));
+                if (alerts) grid->setHighlighted(dev, alerts->isFiring(alertFamily, id));
+            });
+            grid->update();
+            return;
+        }
+        frame.forEachPresent([&](uint32_t id) {
+            const std::string& dev = frame.names[id];
+            if (!chart.count(dev)) {
+                chart[dev] = {createChart(id), id};
+                backfill(dev);
+                updateStrech();
+            }
+            if (alerts) chart[dev].view->setHighlighted(alerts->isFiring(alertFamily, id));
+        });
+        for(auto& chrt: chart){
+            chrt.second.view->updateData();
+        }
+    }
+
+    // Draws all devices in one CompactChartGrid instead of a QtCharts view per device, for hosts with many disks.
+    void setCompact(bool compact) {
+        if (compact == (grid != nullptr)) return;
+        setMetricView(metricView);
+        if (compact) {
+            grid = new CompactChartGrid(metricViews[metricView].labels.size(), {red, blue});
+            grid->setSizePolicy(QSizePolicy(QSizePolicy::MinimumExpanding, QSizePolicy::MinimumExpanding));
+            w->layout->addWidget(grid, 0, 0);
+        } else {
+            w->layout->removeWidget(grid);
+            grid->deleteLater();
+            grid = nullptr;
+        }
+    }
+
+    // Evaluates the rules of family against every frame, the engine has to outlive the widget.
+    void setAlerts(AlertEngine* engine, AlertFamily family) {
+        alerts = engine;
+        alertFamily = family;
+    }
+
+    // History to show in the throughput charts of devices as they appear, see groupByName().
+    void setHistory(std::map<std::string, std::vector<MetricRecord>> records) { history = std::move(records); }
+
+    STAT_TYPE& getStats() { return dstats; }
+    CompactChartGrid* getCompactGrid() { return grid; }
+
     void attachTo(QLambdaTimer& t){
-        t.addLambda([&](){updateData();});
+        t.addLambda([&](){updateData();}, "DiskUsageWidget<" + typeName<STAT_TYPE>() + ">");
     }
 };
\ No newline at end of file
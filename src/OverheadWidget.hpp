@@ -0,0 +1,142 @@
+#pragma once
+
+#include <QApplication>
+#include <QFileDialog>
+#include <QHeaderView>
+#include <QLabel>
+#include <QPushButton>
+#include <QTableWidget>
+#include <QTimer>
+#include <QVBoxLayout>
+#include <fstream>
+#include <unordered_map>
+
+#include "./AspectRatioWidget.hpp"
+#include "./overhead.hpp"
+
+// QApplication that times every paint event, one stage per widget class. The chart views paint outside of the
+// tick callbacks, this is the only place that sees them.
+class InstrumentedApplication : public QApplication {
+private:
+    std::unordered_map<const QMetaObject*, OverheadStage*> paintStages; // GUI thread only
+
+    OverheadStage& paintStage(const QMetaObject* meta) {
+        auto it = paintStages.find(meta);
+        if (it != paintStages.end()) return *it->second;
+        OverheadStage& stage = monitorOverhead().stage(std::string("paint: ") + meta->className());
+        paintStages.emplace(meta, &stage);
+        return stage;
+    }
+
+public:
+    InstrumentedApplication(int& argc, char** argv) : QApplication(argc, argv) {}
+
+    bool notify(QObject* receiver, QEvent* event) override {
+        if (event->type() != QEvent::Paint) return QApplication::notify(receiver, event);
+        OverheadScope scope(paintStage(receiver->metaObject()));
+        return QApplication::notify(receiver, event);
+    }
+};
+
+// What the monitor costs: CPU, memory, tick jitter and a latency row per stage, refreshed once a second.
+class OverheadWidget : public QWidget {
+private:
+    QLabel* usageLabel;
+    QLabel* jitterLabel;
+    QTableWidget* table;
+    QTimer* refreshTimer;
+
+    double lastCpu = processCpuSeconds();
+    std::chrono::steady_clock::time_point lastRefresh = std::chrono::steady_clock::now();
+
+    static QString us(double ns) { return QString::number(ns / 1000.0, 'f', 1); }
+
+    void refresh() {
+        if (!isOnScreen(this)) return;
+        MonitorOverhead& overhead = monitorOverhead();
+        ProcessUsage usage = overhead.getUsage();
+        auto now = std::chrono::steady_clock::now();
+        double wall = std::chrono::duration<double>(now - lastRefresh).count();
+        double recent = wall > 0 ? (usage.cpuSeconds - lastCpu) / wall : 0.0;
+        lastCpu = usage.cpuSeconds;
+        lastRefresh = now;
+        usageLabel->setText(QString("CPU %1% now, %2% since start (of one core)    RSS %3 MB")
+                                .arg(recent * 100, 0, 'f', 2)
+                                .arg(overhead.getCpuFraction() * 100, 0, 'f', 2)
+                                .arg(usage.rssBytes / 1048576.0, 0, 'f', 1));
+
+        const LatencyHistogram& jitter = overhead.getTickJitter();
+        jitterLabel->setText(QString("Display tick %1 ms, jitter p50 %2 ms, p99 %3 ms, max %4 ms")
+                                 .arg(overhead.getTickTarget().count() / 1e6, 0, 'f', 0)
+                                 .arg(jitter.getPercentile(0.5) / 1e6, 0, 'f', 2)
+                                 .arg(jitter.getPercentile(0.99) / 1e6, 0, 'f', 2)
+                                 .arg(jitter.getMax() / 1e6, 0, 'f', 2));
+
+        // stages are only ever added, existing rows keep their place
+        auto stages = overhead.getStages();
+        table->setRowCount(stages.size());
+        for (size_t r = 0; r < stages.size(); r++) {
+            const LatencyHistogram& h = stages[r]->latency;
+            QString cells[] = {
+                QString::fromStdString(stages[r]->name), QString::number(h.getCount()), us(h.getMean()),
+                us(h.getPercentile(0.5)), us(h.getPercentile(0.99)), us(h.getPercentile(0.999)), us(h.getMax())
+            };
+            for (int c = 0; c < 7; c++) {
+                QTableWidgetItem* item = table->item(r, c);
+                if (!item) {
+                    item = new QTableWidgetItem();
+                    if (c > 0) item->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+                    table->setItem(r, c, item);
+                }
+                item->setText(cells[c]);
+            }
+        }
+    }
+
+    void saveReport() {
+        QString path = QFileDialog::getSaveFileName(this, "Save overhead report", "diskio-overhead.txt");
+        if (path.isEmpty()) return;
+        std::ofstream out(path.toStdString());
+        if (out) monitorOverhead().writeReport(out);
+    }
+
+protected:
+    void showEvent(QShowEvent* event) override {
+        QWidget::showEvent(event);
+        refresh();
+    }
+
+public:
+    OverheadWidget(QWidget* parent = nullptr) : QWidget(parent) {
+        usageLabel = new QLabel(this);
+        jitterLabel = new QLabel(this);
+        table = new QTableWidget(0, 7, this);
+        table->setHorizontalHeaderLabels({"Stage", "Count", "Mean µs", "p50 µs", "p99 µs", "p99.9 µs", "Max µs"});
+        table->horizontalHeader()->setSectionResizeMode(0, QHeaderView::Stretch);
+        table->verticalHeader()->setVisible(false);
+        table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+
+        QPushButton* save = new QPushButton("Save report…", this);
+        QPushButton* reset = new QPushButton("Reset", this);
+        QObject::connect(save, &QPushButton::clicked, [this]() { saveReport(); });
+        QObject::connect(reset, &QPushButton::clicked, [this]() {
+            monitorOverhead().reset();
+            refresh();
+        });
+        QHBoxLayout* buttons = new QHBoxLayout();
+        buttons->addStretch();
+        buttons->addWidget(reset);
+        buttons->addWidget(save);
+
+        QVBoxLayout* layout = new QVBoxLayout(this);
+        layout->addWidget(usageLabel);
+        layout->addWidget(jitterLabel);
+        layout->addWidget(table);
+        layout->addLayout(buttons);
+
+        refreshTimer = new QTimer(this);
+        QObject::connect(refreshTimer, &QTimer::timeout, [this]() { refresh(); });
+        refreshTimer->start(1000);
+        refresh();
+    }
+};
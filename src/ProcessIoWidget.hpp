@@ -0,0 +1,147 @@
+#pragma once
+
+#include <QPaintEvent>
+#include <QPainter>
+#include <QWidget>
+#include <map>
+#include <vector>
+
+#include "./QLambdaTimer.hpp"
+#include "./SystemOverviewWidgets.hpp"
+#include "./processstats.hpp"
+#include "./seriesbuffer.hpp"
+
+// The processes with the most storage I/O, one row each with their rates and a sparkline of the last minute.
+// Painted in one widget like CompactChartGrid, the rows change order every scan and item views would churn.
+class ProcessIoWidget : public QWidget {
+private:
+    AsyncProcessStats stats;
+    std::map<int, SeriesBuffer> history; // per pid (read, write) MB/s, only for pids that made the top list
+    int64_t now = 0;
+
+    QColor red;
+    QColor blue;
+    QColor fgColor;
+    QColor gridColor;
+    QVector<QPointF> points; // reused for every sparkline
+
+    void updateData() {
+        if (!stats.poll()) return;
+        now = QDateTime::currentDateTime().toMSecsSinceEpoch();
+        for (auto& p : stats.getSample().top) {
+            auto it = history.find(p.pid);
+            if (it == history.end()) it = history.emplace(p.pid, SeriesBuffer(m_historySamples, 2)).first;
+            double v[] = {p.readMBps, p.writeMBps};
+            it->second.append(now, v);
+        }
+        // pids that dropped out of the list keep their history for a while in case they come back
+        for (auto it = history.begin(); it != history.end();) {
+            const SeriesBuffer& b = it->second;
+            if (b.size() == 0 || now - b.time(b.size() - 1) > m_historyMs) it = history.erase(it);
+            else
+                ++it;
+        }
+        update();
+    }
+
+    void drawSparkline(QPainter& painter, const QRect& rect, const SeriesBuffer& buffer) {
+        if (buffer.size() < 2 || rect.width() <= 0) return;
+        double yMax = std::max(buffer.max(), 0.01);
+        double xScale = double(rect.width()) / m_historyMs;
+        int64_t start = now - m_historyMs;
+        size_t first = buffer.lowerBound(start);
+        for (size_t c = 0; c < 2; c++) {
+            points.resize(0);
+            buffer.forEach(c, [&](int64_t time, double value) {
+                points.append(QPointF(rect.left() + (time - start) * xScale, rect.bottom() - value / yMax * rect.height()));
+            }, first);
+            painter.setPen(QPen(c == 0 ? blue : red, 1.2));
+            painter.drawPolyline(points.constData(), points.size());
+        }
+    }
+
+protected:
+    void paintEvent(QPaintEvent*) override {
+        QPainter painter(this);
+        painter.fillRect(rect(), palette().color(QPalette::Base));
+        const ProcessSample& sample = stats.getSample();
+        QFontMetrics fm = fontMetrics();
+        int rowHeight = fm.height() + 6;
+        int numberWidth = fm.horizontalAdvance("00000.00") + 12;
+        int pidWidth = fm.horizontalAdvance("0000000") + 12;
+        int commWidth = fm.horizontalAdvance("MMMMMMMMMMMMMMM") / 2 + 12;
+        int sparkLeft = pidWidth + commWidth + 4 * numberWidth;
+
+        auto drawRow = [&](int y, const QStringList& cells) {
+            int x = 0;
+            for (int i = 0; i < cells.size(); i++) {
+                int w = i == 0 ? pidWidth : i == 1 ? commWidth : numberWidth;
+                int align = i == 1 ? Qt::AlignLeft : Qt::AlignRight;
+                painter.drawText(QRect(x + 4, y, w - 8, rowHeight), align | Qt::AlignVCenter, cells[i]);
+                x += w;
+            }
+        };
+
+        QFont font = painter.font();
+        font.setBold(true);
+        painter.setFont(font);
+        painter.setPen(fgColor);
+        drawRow(0, {"PID", "COMMAND", "READ MB/s", "WRITE MB/s", "READS/s", "WRITES/s"});
+        painter.setPen(blue);
+        painter.drawText(QRect(sparkLeft + 4, 0, width(), rowHeight), Qt::AlignLeft | Qt::AlignVCenter, "• READ");
+        painter.setPen(red);
+        painter.drawText(
+            QRect(sparkLeft + 4 + fm.horizontalAdvance("• READ   "), 0, width(), rowHeight), Qt::AlignLeft | Qt::AlignVCenter,
+            "• WRITE"
+        );
+        font.setBold(false);
+        painter.setFont(font);
+
+        int y = rowHeight;
+        for (auto& p : sample.top) {
+            if (y + rowHeight > height() - rowHeight) break;
+            painter.setPen(gridColor);
+            painter.drawLine(0, y, width(), y);
+            painter.setPen(fgColor);
+            drawRow(y, {
+                QString::number(p.pid), QString::fromStdString(p.comm), QString::number(p.readMBps, 'f', 2),
+                QString::number(p.writeMBps, 'f', 2), QString::number(p.readOps, 'f', 0), QString::number(p.writeOps, 'f', 0)
+            });
+            auto it = history.find(p.pid);
+            if (it != history.end()) {
+                painter.setRenderHint(QPainter::Antialiasing, true);
+                drawSparkline(painter, QRect(sparkLeft + 4, y + 3, width() - sparkLeft - 8, rowHeight - 6), it->second);
+                painter.setRenderHint(QPainter::Antialiasing, false);
+            }
+            y += rowHeight;
+        }
+
+        QString status = QString("%1 processes, scan %2 ms").arg(sample.processes).arg(sample.scanMs, 0, 'f', 1);
+        if (sample.unreadable > 0) {
+            status += QString(", %1 not readable (run as root to see every process)").arg(sample.unreadable);
+        }
+        painter.setPen(fgColor);
+        painter.drawText(QRect(4, height() - rowHeight, width() - 8, rowHeight), Qt::AlignLeft | Qt::AlignVCenter, status);
+    }
+
+public:
+    qint64 m_historyMs = 60000; // 1 minute
+    size_t m_historySamples = 120;
+
+    ProcessIoWidget(size_t topCount = 25, QWidget* parent = nullptr) : QWidget(parent), stats(topCount) {
+        fgColor = palette().color(QPalette::Text);
+        gridColor = palette().color(QPalette::Disabled, QPalette::Text);
+        blue = QColor{0, 0, 255, 255};
+        red = QColor{255, 0, 0, 255};
+        if (palette().color(QPalette::Base).toHsv().value() < 155) {
+            blue = QColor{0, 200, 255, 255};
+            red = QColor{255, 70, 70, 255};
+        }
+        setAttribute(Qt::WA_OpaquePaintEvent);
+        setMinimumSize(400, 200);
+    }
+
+    void attachTo(QLambdaTimer& t) {
+        t.addLambda([&]() { updateData(); }, "ProcessIoWidget");
+    }
+};
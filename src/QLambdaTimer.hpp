@@ -1,9 +1,13 @@
 #pragma once
 
 #include <QTimer>
+#include <chrono>
 #include <functional>
+#include <string>
 #include <vector>
 
+#include "./overhead.hpp"
+
 class QLambdaTimer : public QObject {
 public:
     QLambdaTimer(int intervalMs) : m_timer(new QTimer()) {
@@ -15,13 +19,33 @@ public:
 
     void stop() { m_timer->stop(); }
 
-    void addLambda(const std::function<void()>& lambda) { m_lambdas.push_back(lambda); }
+    // name is the stage the callback is measured under in MonitorOverhead.
+    void addLambda(const std::function<void()>& lambda, const std::string& name = "") {
+        std::string stage = name.empty() ? "tick callback " + std::to_string(m_lambdas.size()) : name;
+        m_lambdas.push_back({lambda, &monitorOverhead().stage("tick: " + stage)});
+    }
 
 private:
+    struct Callback {
+        std::function<void()> lambda;
+        OverheadStage* stage;
+    };
+
     QTimer* m_timer;
-    std::vector<std::function<void()>> m_lambdas;
+    std::vector<Callback> m_lambdas;
+    OverheadStage& m_tickStage = monitorOverhead().stage("tick: all callbacks");
+    std::chrono::steady_clock::time_point m_lastTick;
 
     void executeLambdas() {
-        for (const auto& lambda : m_lambdas) { lambda(); }
+        auto now = std::chrono::steady_clock::now();
+        if (m_lastTick.time_since_epoch().count() != 0) {
+            monitorOverhead().recordTick(now - m_lastTick, std::chrono::milliseconds(m_timer->interval()));
+        }
+        m_lastTick = now;
+        OverheadScope tick(m_tickStage);
+        for (const auto& callback : m_lambdas) {
+            OverheadScope scope(*callback.stage);
+            callback.lambda();
+        }
     }
-};
\ No newline at end of file
+};
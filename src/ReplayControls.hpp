@@ -0,0 +1,61 @@
+#pragma once
+
+#include <QComboBox>
+#include <QDateTime>
+#include <QHBoxLayout>
+#include <QLabel>
+#include <QSlider>
+#include <QWidget>
+
+#include "./QLambdaTimer.hpp"
+#include "./replay.hpp"
+
+// Position and speed of a replay: a slider over the whole recording that seeks when released and a speed
+// selector. The replay collectors follow the clock on their own, this only moves it.
+class ReplayControls : public QWidget {
+private:
+    ReplayClock& clock;
+    int64_t first;
+    int64_t last;
+    QSlider* slider;
+    QComboBox* speed;
+    QLabel* timeLabel;
+
+    void updatePosition() {
+        int64_t now = std::clamp(clock.now(), first, last);
+        if (!slider->isSliderDown()) slider->setValue(int((now - first) / 1000));
+        QString text = QDateTime::fromMSecsSinceEpoch(now).toString("yyyy-MM-dd hh:mm:ss");
+        if (clock.now() > last) text += " (end)";
+        timeLabel->setText(text);
+    }
+
+public:
+    ReplayControls(const Recording& recording, ReplayClock& clock, QWidget* parent = nullptr) :
+        QWidget(parent), clock(clock), first(recording.getFirstTime()), last(recording.getLastTime()) {
+        slider = new QSlider(Qt::Horizontal, this);
+        slider->setRange(0, int((last - first) / 1000)); // seconds, an int holds 68 years of them
+        speed = new QComboBox(this);
+        for (int x : {1, 10, 100, 1000}) speed->addItem(QString("%1x").arg(x), x);
+        int current = speed->findData(int(clock.getSpeed()));
+        if (current >= 0) speed->setCurrentIndex(current);
+        timeLabel = new QLabel(this);
+
+        QObject::connect(slider, &QSlider::sliderReleased, [this]() {
+            this->clock.seek(first + int64_t(slider->value()) * 1000);
+            updatePosition();
+        });
+        QObject::connect(speed, QOverload<int>::of(&QComboBox::currentIndexChanged), [this](int index) {
+            this->clock.setSpeed(speed->itemData(index).toInt());
+        });
+
+        QHBoxLayout* layout = new QHBoxLayout(this);
+        layout->addWidget(timeLabel);
+        layout->addWidget(slider, 1);
+        layout->addWidget(speed);
+        updatePosition();
+    }
+
+    void attachTo(QLambdaTimer& t) {
+        t.addLambda([&]() { updatePosition(); }, "ReplayControls");
+    }
+};
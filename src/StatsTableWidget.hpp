@@ -0,0 +1,102 @@
+#pragma once
+
+#include <QHeaderView>
+#include <QTableWidget>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "./AspectRatioWidget.hpp"
+#include "./streamstats.hpp"
+
+// Streaming statistics of the read and write rates of every device: the EWMA and p50, p99 and peak over the
+// last 5 minutes, hour and day, one row per device and direction. Summaries are updated every tick, the table
+// is only rebuilt from them once a second while it is on screen.
+class StatsTableWidget : public QTableWidget {
+private:
+    struct Device {
+        std::string name; // empty for ids that never were present
+        MetricSummary read;
+        MetricSummary write;
+    };
+
+    std::vector<Device> devices; // [frame id]
+    uint64_t idVersion = 0;      // of the frame the names were checked against
+    int64_t lastRefresh = 0;
+    int64_t lastSample = 0;
+
+    static QString number(double v) { return std::isnan(v) ? QString("–") : QString::number(v, 'f', 2); }
+
+    void setCell(int row, int column, const QString& text) {
+        QTableWidgetItem* item = this->item(row, column);
+        if (!item) {
+            item = new QTableWidgetItem();
+            if (column > 1) item->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+            setItem(row, column, item);
+        }
+        item->setText(text);
+    }
+
+    void refresh() {
+        lastRefresh = lastSample;
+        int rows = 0;
+        for (auto& d : devices) rows += d.name.empty() ? 0 : 2;
+        setRowCount(rows);
+        int row = 0;
+        for (auto& d : devices) {
+            if (d.name.empty()) continue;
+            for (int direction = 0; direction < 2; direction++, row++) {
+                MetricSummary& m = direction == 0 ? d.read : d.write;
+                setCell(row, 0, QString::fromStdString(d.name));
+                setCell(row, 1, direction == 0 ? "READ" : "WRITE");
+                setCell(row, 2, number(m.getEwma()));
+                for (size_t w = 0; w < 3; w++) {
+                    WindowSummary s = m.summarize(w, lastSample);
+                    setCell(row, 3 + w * 3, number(s.p50));
+                    setCell(row, 4 + w * 3, number(s.p99));
+                    setCell(row, 5 + w * 3, number(s.max));
+                }
+            }
+        }
+    }
+
+protected:
+    void showEvent(QShowEvent* event) override {
+        QTableWidget::showEvent(event);
+        refresh();
+    }
+
+public:
+    StatsTableWidget(const QString& unit, QWidget* parent = nullptr) : QTableWidget(0, 12, parent) {
+        QStringList headers{"Device", "", "EWMA 1 min"};
+        for (const char* window : MetricSummary::windowNames) {
+            headers << QString("p50 %1").arg(window) << QString("p99 %1").arg(window) << QString("peak %1").arg(window);
+        }
+        setHorizontalHeaderLabels(headers);
+        setToolTip("Rates in " + unit + ". The windows move in slices of a tenth to a twenty-fourth of their length.");
+        horizontalHeader()->setSectionResizeMode(QHeaderView::ResizeToContents);
+        verticalHeader()->setVisible(false);
+        setEditTriggers(QAbstractItemView::NoEditTriggers);
+    }
+
+    // Adds the read and write rates of every present device. An id the collector released or gave to another
+    // device starts over.
+    template <class Frame>
+    void add(int64_t now, const Frame& frame) {
+        if (devices.size() < frame.names.size()) devices.resize(frame.names.size());
+        if (idVersion != frame.idVersion) {
+            idVersion = frame.idVersion;
+            for (size_t id = 0; id < frame.names.size(); id++) {
+                if (!devices[id].name.empty() && devices[id].name != frame.names[id]) devices[id] = Device();
+            }
+        }
+        frame.forEachPresent([&](uint32_t id) {
+            Device& d = devices[id];
+            if (d.name.empty()) d.name = frame.names[id];
+            d.read.add(now, frame.read[id]);
+            d.write.add(now, frame.write[id]);
+        });
+        lastSample = now;
+        if (isOnScreen(this) && now - lastRefresh >= 1000) refresh();
+    }
+};
@@ -1,7 +1,12 @@
 #pragma once
 
+#include "./hfsampler.hpp"
+#include "./historytiers.hpp"
+#include "./overhead.hpp"
+#include "./seriesbuffer.hpp"
 #include "./systemstats.hpp"
 
+#include <QtCharts/QAreaSeries>
 #include <QtCharts/QChartView>
 #include <QtCharts/QDateTimeAxis>
 #include <QtCharts/QLineSeries>
@@ -9,20 +14,91 @@
 
 using namespace QtCharts;
 
+// Pushes one column of a SeriesBuffer into a series with a single replace() instead of append + remove(0).
+void replaceSeries(QXYSeries* series, const SeriesBuffer& buffer, size_t column) {
+    QVector<QPointF> points;
+    points.reserve(buffer.size());
+    buffer.forEach(column, [&](int64_t time, double value) { points.append(QPointF(time, value)); });
+    series->replace(points);
+}
+
+// Pushes the part of one column of a tier that falls into the window starting at from. Buckets of the rolled
+// up tiers become two points, their min and max, so spikes survive any zoom level. Returns the largest value.
+double replaceSeries(QXYSeries* series, const TieredHistory& history, size_t tier, size_t column, int64_t from) {
+    QVector<QPointF> points;
+    double maxValue = 0;
+    history.forEach(tier, column, from, [&](int64_t time, double min, double, double max) {
+        if (tier == 0) {
+            points.append(QPointF(time, max));
+        } else {
+            int64_t half = history.getTier(tier).bucketMs / 2;
+            points.append(QPointF(time, min));
+            points.append(QPointF(time + half, max));
+        }
+        maxValue = std::max(maxValue, max);
+    });
+    series->replace(points);
+    return maxValue;
+}
+
+// Right click menu on a chart to pick how much history it shows.
+void addTimeSpanActions(QWidget* view, std::function<void(qint64)> setSpan) {
+    const std::pair<const char*, qint64> spans[] = {
+        {"Last minute", 60 * 1000},
+        {"Last 10 minutes", 10 * 60 * 1000},
+        {"Last hour", 60 * 60 * 1000},
+        {"Last day", 24 * 60 * 60 * 1000},
+        {"Last 30 days", 30LL * 24 * 60 * 60 * 1000},
+    };
+    view->setContextMenuPolicy(Qt::ActionsContextMenu);
+    for (auto& [name, ms] : spans) {
+        QAction* action = new QAction(name, view);
+        QObject::connect(action, &QAction::triggered, [setSpan, ms = ms]() { setSpan(ms); });
+        view->addAction(action);
+    }
+}
+
+// Keeps the Y axis at the data maximum, shrinks it only once the data fell well below it.
+double autoscaleMax(double axisMax, double maxDataPoint) {
+    double minThreshold = axisMax * 0.70;
+    double maxThreshold = axisMax;
+    if (maxDataPoint > maxThreshold) return maxDataPoint;
+    if (maxDataPoint < 1.0) return 1.0;
+    if (maxDataPoint < minThreshold) return maxDataPoint * 1.25;
+    return axisMax;
+}
+
+void autoscaleYAxis(QValueAxis* yAxis, double maxDataPoint) {
+    double newMax = autoscaleMax(yAxis->max(), maxDataPoint);
+    if (newMax != yAxis->max()) yAxis->setRange(0, newMax);
+}
+
+// Marks a chart title in red, e.g. while an alert rule fires for its device.
+void highlightTitle(QChart* chart, const QString& title, bool highlighted) {
+    chart->setTitle(highlighted ? "⚠ " + title : title);
+    chart->setTitleBrush(highlighted ? QBrush(QColor(255, 70, 70)) : QBrush(chart->palette().color(QPalette::Foreground)));
+}
+
 class ValueUsageWidget : public ContainerWidget {
 private:
     std::function<std::vector<double>()> getDataFunction;
     std::vector<QLineSeries*> m_series;
+    TieredHistory m_history{0}; // one column per series, sized in createChart
     QDateTimeAxis* m_xAxis;
     QString title;
     QValueAxis* m_yAxis;
+    QChart* m_chart;
+    bool m_stale = false; // history has samples the series do not show yet
+    bool m_highlighted = false;
 
     QWidget* createChart(QList<QColor> colors = QList<QColor>{}) {
         // Create the line series for the data
         for (size_t i = 0; i < getDataFunction().size(); i++) { m_series.push_back(new QLineSeries()); }
+        m_history = TieredHistory(m_series.size());
 
         // Create the chart and add the line series to it
         SystemThemedChart* chart = new SystemThemedChart();
+        m_chart = chart;
         chart->legend()->hide();
         chart->setTitle(title);
         if(colors.size() != 0)
@@ -50,11 +126,12 @@ private:
         // Create the chart view and add it to the layout
         QChartView* chartView = new QChartView(chart);
         chartView->setRenderHint(QPainter::Antialiasing);
+        addTimeSpanActions(chartView, [this](qint64 ms) { setTimeSpan(ms); });
         return chartView;
     }
 
 public:
-    int m_maxDataPoints = 600;
+    int m_maxDataPoints = 600; // per series and window, the history tier is picked to stay below it
     qint64 m_xAxisRangeMs = 60000; // 1 minute
 
     ValueUsageWidget(std::function<std::vector<double>()> dataFunction, QString title, QList<QColor> colors, QWidget* parent = nullptr) :
@@ -66,41 +143,172 @@ public:
         ValueUsageWidget(dataFunction, title, QList<QColor>{}, parent) {}
 
     void attachTo(QLambdaTimer& t) {
-        t.addLambda([&]() { updateData(); });
+        t.addLambda([&]() { updateData(); }, "ValueUsageWidget " + title.toStdString());
     }
 
     void updateData() {
+        static OverheadStage& stage = monitorOverhead().stage("chart: ValueUsageWidget::updateData");
+        OverheadScope scope(stage);
         // Update chart
         std::vector<double> usages = getDataFunction();
+        usages.resize(m_series.size());
+        qint64 now = QDateTime::currentDateTime().toMSecsSinceEpoch();
 
-        double minThreshold = m_yAxis->max() * 0.70;
-        double maxThreshold = m_yAxis->max();
-        double maxDataPoint = 0;
+        m_history.append(now, usages);
+        m_stale = true;
+        if (isOnScreen(this)) render(now);
+    }
 
-        for (size_t i = 0; i < usages.size(); i++) {
-            m_series[i]->append(QDateTime::currentDateTime().toMSecsSinceEpoch(), usages[i]);
+    // One replace() per series covers everything appended since the last render.
+    void render(qint64 now) {
+        m_stale = false;
+        size_t tier = m_history.selectTier(m_xAxisRangeMs, m_maxDataPoints);
+        double maxDataPoint = 0;
+        for (size_t i = 0; i < m_series.size(); i++) {
+            maxDataPoint = std::max(maxDataPoint, replaceSeries(m_series[i], m_history, tier, i, now - m_xAxisRangeMs));
         }
+        autoscaleYAxis(m_yAxis, maxDataPoint);
 
-        for (size_t i = 0; i < m_series.size(); i++) {
-            // Remove data points that exceed the maximum
-            if (m_series[i]->count() > m_maxDataPoints) m_series[i]->remove(0);
-            for (const QPointF& point : m_series[i]->points()) {
-                maxDataPoint = std::max(maxDataPoint, point.y());
+        // Adjust X-axis range
+        m_xAxis->setRange(QDateTime::fromMSecsSinceEpoch(now - m_xAxisRangeMs), QDateTime::fromMSecsSinceEpoch(now));
+    }
+
+    void setTimeSpan(qint64 ms) {
+        m_xAxisRangeMs = ms;
+        m_xAxis->setFormat(ms > 24 * 60 * 60 * 1000 ? "dd.MM hh:mm" : "hh:mm:ss");
+    }
+
+    void setHighlighted(bool highlighted) {
+        if (highlighted == m_highlighted) return;
+        m_highlighted = highlighted;
+        highlightTitle(m_chart, title, highlighted);
+    }
+
+    // Adds older samples, e.g. from the on-disk history, before the first updateData().
+    void backfill(qint64 time, const std::vector<double>& values) {
+        std::vector<double> row = values;
+        row.resize(m_series.size());
+        m_history.append(time, row);
+    }
+
+protected:
+    void showEvent(QShowEvent* event) override {
+        ContainerWidget::showEvent(event);
+        if (m_stale) render(QDateTime::currentDateTime().toMSecsSinceEpoch());
+    }
+};
+
+// Like ValueUsageWidget but draws every value as a min/max band with the mean as a line.
+class EnvelopeUsageWidget : public ContainerWidget {
+private:
+    struct EnvelopeSeries {
+        QLineSeries* min;
+        QLineSeries* mean;
+        QLineSeries* max;
+    };
+
+    std::function<std::vector<Envelope>()> getDataFunction;
+    std::vector<EnvelopeSeries> m_series;
+    SeriesBuffer m_buffer{1, 0}; // min, mean, max columns per envelope
+    QDateTimeAxis* m_xAxis;
+    QValueAxis* m_yAxis;
+    QChart* m_chart;
+    QString title;
+    bool m_stale = false;
+    bool m_highlighted = false;
+
+    QWidget* createChart(QList<QColor> colors) {
+        SystemThemedChart* chart = new SystemThemedChart();
+        m_chart = chart;
+        chart->legend()->hide();
+        chart->setTitle(title);
+        if (colors.size() != 0) chart->sequentialColors = colors;
+
+        m_xAxis = new QDateTimeAxis();
+        m_xAxis->setTickCount(10);
+        m_xAxis->setFormat("hh:mm:ss");
+        m_xAxis->setLabelsVisible(false);
+        chart->addAxis(m_xAxis, Qt::AlignBottom);
+
+        m_yAxis = new QValueAxis();
+        m_yAxis->setLabelFormat("%.2f");
+        m_yAxis->setRange(0, 100);
+        chart->addAxis(m_yAxis, Qt::AlignLeft);
+
+        for (size_t i = 0; i < getDataFunction().size(); i++) {
+            QColor color = chart->sequentialColors[i % chart->sequentialColors.size()];
+            EnvelopeSeries es{new QLineSeries(), new QLineSeries(), new QLineSeries()};
+            QAreaSeries* band = chart->addBandSeries(es.max, es.min, color);
+            chart->addLineSeries(es.mean, color);
+            for (QAbstractSeries* series : {(QAbstractSeries*)band, (QAbstractSeries*)es.mean}) {
+                series->attachAxis(m_xAxis);
+                series->attachAxis(m_yAxis);
             }
+            m_series.push_back(es);
         }
+        m_buffer = SeriesBuffer(m_maxDataPoints, m_series.size() * 3);
 
-        if(maxDataPoint > maxThreshold){
-            m_yAxis->setRange(0, maxDataPoint);
-        }else if(maxDataPoint < 1.0){
-            m_yAxis->setRange(0, 1.0);
-        }else if(maxDataPoint < minThreshold){
-            m_yAxis->setRange(0, maxDataPoint * 1.25);
+        QChartView* chartView = new QChartView(chart);
+        chartView->setRenderHint(QPainter::Antialiasing);
+        return chartView;
+    }
+
+public:
+    int m_maxDataPoints = 600;
+    qint64 m_xAxisRangeMs = 60000; // 1 minute
+
+    EnvelopeUsageWidget(
+        std::function<std::vector<Envelope>()> dataFunction,
+        QString title,
+        QList<QColor> colors,
+        QWidget* parent = nullptr
+    ) :
+        ContainerWidget(parent), getDataFunction(std::move(dataFunction)), title(title) {
+        setWidget(createChart(colors));
+    }
+
+    void attachTo(QLambdaTimer& t) {
+        t.addLambda([&]() { updateData(); }, "EnvelopeUsageWidget " + title.toStdString());
+    }
+
+    void updateData() {
+        static OverheadStage& stage = monitorOverhead().stage("chart: EnvelopeUsageWidget::updateData");
+        OverheadScope scope(stage);
+        std::vector<Envelope> envelopes = getDataFunction();
+        envelopes.resize(m_series.size());
+        qint64 now = QDateTime::currentDateTime().toMSecsSinceEpoch();
+
+        std::vector<double> row;
+        for (auto& e : envelopes) row.insert(row.end(), {e.min, e.mean, e.max});
+        m_buffer.append(now, row);
+        m_stale = true;
+        if (isOnScreen(this)) render(now);
+    }
+
+    void render(qint64 now) {
+        m_stale = false;
+        double maxDataPoint = 0;
+        for (size_t i = 0; i < m_series.size(); i++) {
+            replaceSeries(m_series[i].min, m_buffer, i * 3);
+            replaceSeries(m_series[i].mean, m_buffer, i * 3 + 1);
+            replaceSeries(m_series[i].max, m_buffer, i * 3 + 2);
+            maxDataPoint = std::max(maxDataPoint, m_buffer.max(i * 3 + 2));
         }
+        autoscaleYAxis(m_yAxis, maxDataPoint);
 
-        // Adjust X-axis range
-        qint64 maxX = QDateTime::currentDateTime().toMSecsSinceEpoch();
-        qint64 minX = maxX - m_xAxisRangeMs;
-        m_xAxis->setRange(QDateTime::fromMSecsSinceEpoch(minX), QDateTime::fromMSecsSinceEpoch(maxX));
+        m_xAxis->setRange(QDateTime::fromMSecsSinceEpoch(now - m_xAxisRangeMs), QDateTime::fromMSecsSinceEpoch(now));
+    }
+
+    void setHighlighted(bool highlighted) {
+        if (highlighted == m_highlighted) return;
+        m_highlighted = highlighted;
+        highlightTitle(m_chart, title, highlighted);
+    }
+
+protected:
+    void showEvent(QShowEvent* event) override {
+        ContainerWidget::showEvent(event);
+        if (m_stale) render(QDateTime::currentDateTime().toMSecsSinceEpoch());
     }
 };
 
@@ -109,7 +317,9 @@ private:
     std::function<int()> getDataFunction;
     QString title;
     QLineSeries* m_series;
+    TieredHistory m_history{1};
     QDateTimeAxis* m_xAxis;
+    bool m_stale = false;
 
     QWidget* createChart() {
         // Create the line series for the usage data
@@ -139,72 +349,178 @@ private:
         // Create the chart view and add it to the layout
         QChartView* chartView = new QChartView(chart);
         chartView->setRenderHint(QPainter::Antialiasing);
+        addTimeSpanActions(chartView, [this](qint64 ms) { setTimeSpan(ms); });
         return chartView;
     }
 
     void updateData() {
+        static OverheadStage& stage = monitorOverhead().stage("chart: PercentUsageWidget::updateData");
+        OverheadScope scope(stage);
         // Update chart
-        int usage = getDataFunction();
-        m_series->append(QDateTime::currentDateTime().toMSecsSinceEpoch(), usage);
-        if (m_series->count() > m_maxDataPoints) m_series->remove(0);
-        qint64 maxX = QDateTime::currentDateTime().toMSecsSinceEpoch();
+        double usage = getDataFunction();
+        qint64 now = QDateTime::currentDateTime().toMSecsSinceEpoch();
+        m_history.append(now, &usage);
+        m_stale = true;
+        if (isOnScreen(this)) render(now);
+    }
+
+    void render(qint64 maxX) {
+        m_stale = false;
         qint64 minX = maxX - m_xAxisRangeMs;
+        replaceSeries(m_series, m_history, m_history.selectTier(m_xAxisRangeMs, m_maxDataPoints), 0, minX);
         m_xAxis->setRange(QDateTime::fromMSecsSinceEpoch(minX), QDateTime::fromMSecsSinceEpoch(maxX));
     }
 
 public:
-    int m_maxDataPoints = 600;
+    int m_maxDataPoints = 600; // per window, the history tier is picked to stay below it
     qint64 m_xAxisRangeMs = 60000; // 1 minute
+
+    void setTimeSpan(qint64 ms) {
+        m_xAxisRangeMs = ms;
+        m_xAxis->setFormat(ms > 24 * 60 * 60 * 1000 ? "dd.MM hh:mm" : "hh:mm:ss");
+    }
+
     PercentUsageWidget(std::function<int()> getDataFunction, QString title, QWidget* parent = nullptr) :
         ContainerWidget(parent), getDataFunction(getDataFunction), title(title) {
         setWidget(createChart());
     }
     void attachTo(QLambdaTimer& t) {
-        t.addLambda([&]() { updateData(); });
+        t.addLambda([&]() { updateData(); }, "PercentUsageWidget " + title.toStdString());
+    }
+
+protected:
+    void showEvent(QShowEvent* event) override {
+        ContainerWidget::showEvent(event);
+        if (m_stale) render(QDateTime::currentDateTime().toMSecsSinceEpoch());
     }
 };
 
-class CpuUsageWidget : public PercentUsageWidget {
+// One row per core and one column per tick, colored by how busy the core was. Each tick only writes
+// one image column, so the cost stays flat with hundreds of cores. Hover a row for the per state breakdown.
+class CpuHeatStripWidget : public QWidget {
 private:
-    SystemStats sysstats;
+    std::function<const CpuUsage&()> getDataFunction;
+    QImage heat;
+    int column = 0; // next column to write, the image is used as a ring
+    CpuUsage lastUsage;
+    QColor idleColor;
+    QColor busyColor{255, 0, 0};
+
+    QRgb colorFor(float busy) const {
+        float t = std::clamp(busy / 100.0f, 0.0f, 1.0f);
+        return qRgb(
+            idleColor.red() + (busyColor.red() - idleColor.red()) * t,
+            idleColor.green() + (busyColor.green() - idleColor.green()) * t,
+            idleColor.blue() + (busyColor.blue() - idleColor.blue()) * t
+        );
+    }
+
+    void updateData() {
+        static OverheadStage& stage = monitorOverhead().stage("chart: CpuHeatStripWidget::updateData");
+        OverheadScope scope(stage);
+        const CpuUsage& usage = getDataFunction();
+        int cores = usage.getCoreCount();
+        if (cores == 0) return;
+        if (heat.height() != cores || heat.width() != m_historyColumns) {
+            heat = QImage(m_historyColumns, cores, QImage::Format_RGB32);
+            heat.fill(idleColor);
+            column = 0;
+        }
+        for (int c = 0; c < cores; c++) {
+            QRgb* line = (QRgb*)heat.scanLine(c);
+            line[column] = colorFor(usage.busy[c + 1]);
+        }
+        column = (column + 1) % heat.width();
+        lastUsage = usage;
+        update();
+    }
+
+protected:
+    void paintEvent(QPaintEvent*) override {
+        QPainter painter(this);
+        if (heat.isNull()) return;
+        // oldest columns on the left, newest on the right
+        double colWidth = double(width()) / heat.width();
+        int older = heat.width() - column;
+        painter.drawImage(QRectF(0, 0, older * colWidth, height()), heat, QRectF(column, 0, older, heat.height()));
+        painter.drawImage(
+            QRectF(older * colWidth, 0, column * colWidth, height()), heat, QRectF(0, 0, column, heat.height())
+        );
+    }
+
+    bool event(QEvent* e) override {
+        if (e->type() == QEvent::ToolTip && lastUsage.getCoreCount() > 0) {
+            QHelpEvent* help = static_cast<QHelpEvent*>(e);
+            size_t cores = lastUsage.getCoreCount();
+            size_t core = std::min<size_t>(help->pos().y() * cores / std::max(1, height()), cores - 1);
+            QString text = QString("cpu%1: %2% busy").arg(core).arg(lastUsage.busy[core + 1], 0, 'f', 1);
+            for (int s = 0; s < CpuStateCount; s++) {
+                if (s == CpuIdle) continue;
+                text += QString("\n%1: %2%").arg(cpuStateName(s)).arg(lastUsage.getState(s, core + 1), 0, 'f', 1);
+            }
+            QToolTip::showText(help->globalPos(), text, this);
+            return true;
+        }
+        return QWidget::event(e);
+    }
 
 public:
-    CpuUsageWidget(QWidget* parent = nullptr) :
+    int m_historyColumns = 240; // 1 minute at 250 ms
+
+    CpuHeatStripWidget(std::function<const CpuUsage&()> dataFunction, QWidget* parent = nullptr) :
+        QWidget(parent), getDataFunction(std::move(dataFunction)) {
+        idleColor = palette().color(QPalette::Base);
+        if (idleColor.toHsv().value() < 155) busyColor = QColor{255, 70, 70};
+        setMinimumHeight(40);
+    }
+
+    void attachTo(QLambdaTimer& t) {
+        t.addLambda([&]() { updateData(); }, "CpuHeatStripWidget");
+    }
+};
+
+class CpuUsageWidget : public PercentUsageWidget {
+public:
+    CpuUsageWidget(AsyncSystemStats& sysstats, QWidget* parent = nullptr) :
         PercentUsageWidget([&]() { return sysstats.getCpuUsage(); }, "CPU Usage", parent) {}
 };
 
 class MemoryUsageWidget : public PercentUsageWidget {
-private:
-    SystemStats sysstats;
-
 public:
-    MemoryUsageWidget(QWidget* parent = nullptr) :
+    MemoryUsageWidget(AsyncSystemStats& sysstats, QWidget* parent = nullptr) :
         PercentUsageWidget([&]() { return sysstats.getMemoryUsage(); }, "Memory Usage", parent) {}
 };
 
 class MemoryValueWidget : public ValueUsageWidget {
-private:
-    SystemStats sysstats;
-
 public:
-    MemoryValueWidget(QWidget* parent = nullptr) :
+    MemoryValueWidget(AsyncSystemStats& sysstats, QWidget* parent = nullptr) :
         ValueUsageWidget([&]() { return std::vector<double>{(double)sysstats.getMemoryUsage()}; }, "Memory Usage", parent) {}
 };
 
 class OverviewWidget : public EQLayoutWidget<QVBoxLayout> {
 private:
-    MemoryValueWidget* mem = new MemoryValueWidget();
-    CpuUsageWidget* cpu = new CpuUsageWidget();
+    AsyncSystemStats sysstats;
+    MemoryValueWidget* mem = new MemoryValueWidget(sysstats);
+    CpuUsageWidget* cpu = new CpuUsageWidget(sysstats);
+    CpuHeatStripWidget* cores =
+        new CpuHeatStripWidget([&]() -> const CpuUsage& { return sysstats.getCpuCoreUsage(); });
 
 public:
-    OverviewWidget(QWidget* parent = nullptr) : EQLayoutWidget(parent) {
+    // source replaces the live SystemStats, see AsyncSystemStats.
+    OverviewWidget(std::function<SystemSample()> source = {}, QWidget* parent = nullptr) :
+        EQLayoutWidget(parent), sysstats(std::move(source)) {
         setAutoFillBackground(true);
         layout->setSpacing(0);
         layout->addWidget(cpu);
+        layout->addWidget(cores);
         layout->addWidget(mem);
     }
     void attachTo(QLambdaTimer& t) {
+        t.addLambda([&]() { sysstats.poll(); }, "AsyncSystemStats::poll");
         cpu->attachTo(t);
+        cores->attachTo(t);
         mem->attachTo(t);
     }
+
+    AsyncSystemStats& getStats() { return sysstats; }
 };
\ No newline at end of file
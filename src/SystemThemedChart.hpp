@@ -125,4 +125,24 @@ public:
         createDefaultAxes();
         for (auto ax : axes(Qt::Horizontal | Qt::Vertical, areaSeries)) { ax->hide(); }
     }
+
+    // Shades the area between two series, used for min/max envelopes. The caller attaches the returned series to its axes.
+    QtCharts::QAreaSeries* addBandSeries(QtCharts::QLineSeries* upper, QtCharts::QLineSeries* lower, QColor color) {
+        QColor shadedColor = color;
+        shadedColor.setAlpha(63);
+
+        QtCharts::QAreaSeries* areaSeries = new QtCharts::QAreaSeries(upper, lower);
+        areaSeries->setBorderColor(Qt::transparent);
+        areaSeries->setBrush(QBrush(shadedColor));
+        QChart::addSeries(areaSeries);
+        return areaSeries;
+    }
+
+    void addLineSeries(QtCharts::QLineSeries* series, QColor color) {
+        QPen linePen = series->pen();
+        linePen.setColor(color);
+        linePen.setWidth(2);
+        series->setPen(linePen);
+        QChart::addSeries(series);
+    }
 };
\ No newline at end of file
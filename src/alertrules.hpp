@@ -0,0 +1,420 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fnmatch.h>
+#include <istream>
+#include <limits>
+#include <queue>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "./diskmetrics.hpp"
+#include "./netlinkstats.hpp"
+#include "./overhead.hpp"
+#include "./sampleframe.hpp"
+
+enum class AlertFamily : uint8_t { Disk = 0, Network = 1 };
+
+// The metrics rules can name per family, in the order alertMetricValues() writes them.
+const std::vector<std::string>& alertMetricNames(AlertFamily family) {
+    static const std::vector<std::string> disk{
+        "read", "write", "read_iops", "write_iops", "read_kb", "write_kb", "read_await", "write_await", "util",
+        "queue", "in_flight"
+    };
+    static const std::vector<std::string> network{
+        "rx", "tx", "rx_packets", "tx_packets", "rx_drops", "tx_drops", "rx_errors", "tx_errors"
+    };
+    return family == AlertFamily::Disk ? disk : network;
+}
+
+// Rates in MB/s, IOPS, KB, ms, % and packets/s, drops and errors are the cumulative counters. Metrics the frame
+// does not have are NaN and never match.
+template <class METRICS>
+void alertMetricValues(AlertFamily family, const DeviceFrame<METRICS>& frame, uint32_t id, double* out) {
+    std::fill(out, out + alertMetricNames(family).size(), std::numeric_limits<double>::quiet_NaN());
+    out[0] = frame.read[id];
+    out[1] = frame.write[id];
+    if constexpr (std::is_same_v<METRICS, DiskMetrics>) {
+        if (family != AlertFamily::Disk) return;
+        const DiskMetrics& m = frame.metrics[id];
+        const double values[] = {
+            m.readIops, m.writeIops, m.readRequestKB, m.writeRequestKB, m.readAwaitMs, m.writeAwaitMs, m.utilPercent,
+            m.avgQueueDepth, m.inFlight
+        };
+        std::copy(std::begin(values), std::end(values), out + 2);
+    } else if constexpr (std::is_same_v<METRICS, LinkMetrics>) {
+        if (family != AlertFamily::Network) return;
+        const LinkMetrics& m = frame.metrics[id];
+        const double values[] = {m.rxPackets, m.txPackets, m.rxDrops, m.txDrops, m.rxErrors, m.txErrors};
+        std::copy(std::begin(values), std::end(values), out + 2);
+    }
+}
+
+enum class AlertOp : uint8_t { Greater, GreaterEqual, Less, LessEqual, Rising };
+
+struct AlertRule {
+    std::string name;
+    AlertFamily family;
+    std::string device; // fnmatch pattern
+    size_t metric;      // index into alertMetricNames()
+    AlertOp op;
+    double threshold = 0;
+    int64_t forMs = 0; // how long the condition has to hold before the rule fires
+};
+
+// One rule per line, # starts a comment:
+//   <name>: <disk|net> <device pattern> <metric> <op> <threshold> [for <duration>]
+//   <name>: <disk|net> <device pattern> <metric> rising [for <duration>]
+// op is one of > >= < <=, rising means higher than at the previous sample, durations take ms, s, m or h.
+// e.g. "hot-sda: disk sda write > 400 for 30s" or "drops: net * rx_drops rising". Throws std::runtime_error
+// naming the line.
+std::vector<AlertRule> parseAlertRules(std::istream& in) {
+    std::vector<AlertRule> rules;
+    std::string line;
+    for (size_t number = 1; std::getline(in, line); number++) {
+        auto fail = [&](const std::string& what) {
+            throw std::runtime_error("alert rules line " + std::to_string(number) + ": " + what);
+        };
+        line = line.substr(0, line.find('#'));
+        if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+        size_t colon = line.find(':');
+        if (colon == std::string::npos) fail("expected <name>: <rule>");
+        AlertRule rule;
+        std::istringstream name(line.substr(0, colon));
+        name >> rule.name;
+        if (rule.name.empty()) fail("missing rule name");
+
+        std::istringstream tokens(line.substr(colon + 1));
+        std::string family, metric, op;
+        tokens >> family >> rule.device >> metric >> op;
+        if (family == "disk") rule.family = AlertFamily::Disk;
+        else if (family == "net")
+            rule.family = AlertFamily::Network;
+        else
+            fail("family has to be disk or net, not '" + family + "'");
+        const auto& names = alertMetricNames(rule.family);
+        rule.metric = std::find(names.begin(), names.end(), metric) - names.begin();
+        if (rule.metric == names.size()) fail("unknown " + family + " metric '" + metric + "'");
+
+        if (op == "rising") rule.op = AlertOp::Rising;
+        else if (op == ">")
+            rule.op = AlertOp::Greater;
+        else if (op == ">=")
+            rule.op = AlertOp::GreaterEqual;
+        else if (op == "<")
+            rule.op = AlertOp::Less;
+        else if (op == "<=")
+            rule.op = AlertOp::LessEqual;
+        else
+            fail("expected > >= < <= or rising, not '" + op + "'");
+        if (rule.op != AlertOp::Rising && !(tokens >> rule.threshold)) fail("missing threshold");
+
+        std::string word;
+        if (tokens >> word) {
+            if (word != "for") fail("expected 'for <duration>', not '" + word + "'");
+            double amount;
+            std::string unit;
+            if (!(tokens >> amount)) fail("missing duration");
+            tokens.clear();
+            tokens >> unit;
+            double scale = 0;
+            if (unit == "ms") scale = 1;
+            else if (unit == "s" || unit.empty())
+                scale = 1000;
+            else if (unit == "m")
+                scale = 60 * 1000;
+            else if (unit == "h")
+                scale = 60 * 60 * 1000;
+            else
+                fail("unknown duration unit '" + unit + "'");
+            rule.forMs = int64_t(amount * scale);
+            if (tokens >> word) fail("unexpected '" + word + "'");
+        }
+        rules.push_back(std::move(rule));
+    }
+    return rules;
+}
+
+struct AlertEvent {
+    int64_t timeMs;
+    const AlertRule* rule;
+    std::string device;
+    double value;
+    bool firing; // false when the condition cleared
+    bool gone = false; // cleared because the device is no longer in the frame
+};
+
+struct AlertEngineStats {
+    size_t rules = 0;
+    size_t instructions = 0;       // rules instantiated per matching device and metric
+    uint64_t lastEvaluated = 0;    // instructions evaluated by the last feed()
+    uint64_t totalEvaluated = 0;
+    size_t firing = 0;
+};
+
+// Evaluates rules over the per tick frames of the collectors. Rules are compiled once per device when the
+// device first shows up: every matching rule becomes an instruction in one flat array, grouped by the input
+// slot (device, metric) it reads. A tick only runs the instructions of slots whose value changed; the state
+// of a rule is how long its condition has held, so nothing looks at history. Conditions that hold without
+// the value changing are timed from a deadline heap.
+class AlertEngine {
+private:
+    struct Instruction {
+        uint32_t rule;
+        uint32_t device;
+        int64_t since = -1; // time the condition started to hold, -1 while it does not
+        bool firing = false;
+        bool pending = false; // has a deadline in the timer heap
+    };
+
+    struct Device {
+        AlertFamily family;
+        std::string name;
+        uint32_t firstSlot;
+        uint32_t firing = 0;  // instructions currently firing
+        bool present = false; // in the last frame of its family
+    };
+
+    std::vector<AlertRule> rules;
+    std::vector<Device> devices;
+    std::vector<uint32_t> deviceOf[2]; // [family][frame id] device index, none before the first sample
+    uint64_t idVersion[2] = {};        // [family] DeviceFrame::idVersion the names were checked against
+    size_t retired = 0;                // devices whose frame id went to another device, still in the program
+    std::vector<double> values;        // [slot] last value
+    std::vector<uint32_t> slotStart;   // [slot] first instruction, [slot + 1] one past its last
+    std::vector<uint32_t> risingActive; // [slot] rising instructions whose condition holds
+    std::vector<Instruction> program;
+    // (deadline, instruction) of conditions waiting for their for duration, soonest first. Entries whose
+    // condition cleared in the meantime are dropped when they come up.
+    std::priority_queue<std::pair<int64_t, uint32_t>, std::vector<std::pair<int64_t, uint32_t>>, std::greater<>>
+        timers;
+    std::vector<AlertEvent> events;
+    std::vector<double> scratch;
+    AlertEngineStats stats;
+    OverheadStage& stage = monitorOverhead().stage("alerts: evaluate");
+
+    static constexpr uint32_t none = uint32_t(-1);
+
+    // Appends the device's slots and the instructions of every rule that matches it, the program stays sorted
+    // by slot because new slots always come last.
+    uint32_t addDevice(AlertFamily family, const std::string& name) {
+        uint32_t index = devices.size();
+        uint32_t first = values.size();
+        devices.push_back({family, name, first});
+        size_t metrics = alertMetricNames(family).size();
+        for (size_t m = 0; m < metrics; m++) {
+            values.push_back(std::numeric_limits<double>::quiet_NaN());
+            risingActive.push_back(0);
+            for (uint32_t r = 0; r < rules.size(); r++) {
+                const AlertRule& rule = rules[r];
+                if (rule.family != family || rule.metric != m) continue;
+                if (fnmatch(rule.device.c_str(), name.c_str(), 0) != 0) continue;
+                program.push_back({r, index});
+            }
+            slotStart.push_back(program.size());
+        }
+        stats.instructions = program.size();
+        return index;
+    }
+
+    void transition(Instruction& in, int64_t now, double value, bool firing, bool gone = false) {
+        in.firing = firing;
+        Device& device = devices[in.device];
+        device.firing += firing ? 1 : -1;
+        stats.firing += firing ? 1 : -1;
+        events.push_back({now, &rules[in.rule], device.name, value, firing, gone});
+    }
+
+    // A device that left the frame: its firing rules clear, pending durations and rising state start over when
+    // it comes back.
+    void removeDevice(uint32_t index, int64_t now) {
+        Device& device = devices[index];
+        device.present = false;
+        uint32_t first = device.firstSlot;
+        uint32_t last = first + alertMetricNames(device.family).size();
+        for (uint32_t i = slotStart[first]; i < slotStart[last]; i++) {
+            Instruction& in = program[i];
+            in.since = -1; // drops its timer when it comes up
+            if (in.firing) transition(in, now, values[first + rules[in.rule].metric], false, true);
+        }
+        for (uint32_t slot = first; slot < last; slot++) {
+            values[slot] = std::numeric_limits<double>::quiet_NaN();
+            risingActive[slot] = 0;
+        }
+    }
+
+    void evaluate(uint32_t slot, double value, double previous, int64_t now) {
+        for (uint32_t i = slotStart[slot]; i < slotStart[slot + 1]; i++) {
+            Instruction& in = program[i];
+            const AlertRule& rule = rules[in.rule];
+            bool holds = false;
+            switch (rule.op) {
+            case AlertOp::Greater: holds = value > rule.threshold; break;
+            case AlertOp::GreaterEqual: holds = value >= rule.threshold; break;
+            case AlertOp::Less: holds = value < rule.threshold; break;
+            case AlertOp::LessEqual: holds = value <= rule.threshold; break;
+            case AlertOp::Rising: holds = value > previous; break;
+            }
+            if (rule.op == AlertOp::Rising && holds != (in.since >= 0)) risingActive[slot] += holds ? 1 : -1;
+            if (!holds) {
+                in.since = -1;
+                if (in.firing) transition(in, now, value, false);
+                continue;
+            }
+            if (in.since < 0) in.since = now;
+            if (in.firing) continue;
+            if (now - in.since >= rule.forMs) transition(in, now, value, true);
+            else if (!in.pending) {
+                in.pending = true;
+                timers.push({in.since + rule.forMs, i});
+            }
+        }
+        stats.lastEvaluated += slotStart[slot + 1] - slotStart[slot];
+    }
+
+    // Frame ids a collector released and gave to another device (removed cgroups) lose their old device.
+    template <class METRICS>
+    void retireRenamed(std::vector<uint32_t>& ids, const DeviceFrame<METRICS>& frame, int64_t now) {
+        for (uint32_t id = 0; id < ids.size(); id++) {
+            if (ids[id] == none || devices[ids[id]].name == frame.names[id]) continue;
+            if (devices[ids[id]].present) removeDevice(ids[id], now);
+            ids[id] = none;
+            retired++;
+        }
+        if (retired > 64 && retired > devices.size() / 2) compact();
+    }
+
+    // Rebuilds the program from the devices that still have a frame id, keeping their state. Their rules match
+    // as before, so the new instructions line up one to one with the old ones.
+    void compact() {
+        std::vector<Device> oldDevices;
+        std::vector<double> oldValues;
+        std::vector<uint32_t> oldStart, oldRising;
+        std::vector<Instruction> oldProgram;
+        oldDevices.swap(devices);
+        oldValues.swap(values);
+        oldStart.swap(slotStart);
+        oldRising.swap(risingActive);
+        oldProgram.swap(program);
+        slotStart.push_back(0);
+        timers = {};
+        for (auto& family : deviceOf) {
+            for (uint32_t& index : family) {
+                if (index == none) continue;
+                const Device& old = oldDevices[index];
+                index = addDevice(old.family, old.name);
+                Device& device = devices[index];
+                device.firing = old.firing;
+                device.present = old.present;
+                uint32_t first = device.firstSlot;
+                uint32_t count = alertMetricNames(old.family).size();
+                std::copy_n(&oldValues[old.firstSlot], count, &values[first]);
+                std::copy_n(&oldRising[old.firstSlot], count, &risingActive[first]);
+                uint32_t from = oldStart[old.firstSlot];
+                for (uint32_t i = slotStart[first]; i < slotStart[first + count]; i++, from++) {
+                    Instruction& in = program[i];
+                    in.since = oldProgram[from].since;
+                    in.firing = oldProgram[from].firing;
+                    in.pending = in.since >= 0 && !in.firing;
+                    if (in.pending) timers.push({in.since + rules[in.rule].forMs, i});
+                }
+            }
+        }
+        retired = 0;
+    }
+
+    // Fires the instructions whose condition held long enough without their input changing.
+    void checkTimers(int64_t now) {
+        while (!timers.empty() && timers.top().first <= now) {
+            uint32_t i = timers.top().second;
+            timers.pop();
+            Instruction& in = program[i];
+            in.pending = false;
+            if (in.since < 0 || in.firing) continue;
+            const AlertRule& rule = rules[in.rule];
+            if (now - in.since < rule.forMs) {
+                // the condition cleared and started to hold again after this deadline was set
+                in.pending = true;
+                timers.push({in.since + rule.forMs, i});
+                continue;
+            }
+            transition(in, now, values[devices[in.device].firstSlot + rule.metric], true);
+        }
+    }
+
+public:
+    AlertEngine(std::vector<AlertRule> rules = {}) : rules(std::move(rules)) {
+        slotStart.push_back(0);
+        stats.rules = this->rules.size();
+    }
+    AlertEngine(const AlertEngine&) = delete;
+    AlertEngine& operator=(const AlertEngine&) = delete;
+
+    // Feeds one tick of a collector. Frame ids are per family as DeviceIds makes them, an id that changes its name
+    // starts over as a new device.
+    template <class METRICS>
+    void feed(AlertFamily family, const DeviceFrame<METRICS>& frame, int64_t now) {
+        OverheadScope scope(stage);
+        stats.lastEvaluated = 0;
+        if (rules.empty()) return;
+        std::vector<uint32_t>& ids = deviceOf[size_t(family)];
+        if (ids.size() < frame.size()) ids.resize(frame.size(), none);
+        if (idVersion[size_t(family)] != frame.idVersion) {
+            idVersion[size_t(family)] = frame.idVersion;
+            retireRenamed(ids, frame, now);
+        }
+        scratch.resize(alertMetricNames(family).size());
+        frame.forEachPresent([&](uint32_t id) {
+            if (ids[id] == none) ids[id] = addDevice(family, frame.names[id]);
+            devices[ids[id]].present = true;
+            uint32_t first = devices[ids[id]].firstSlot;
+            if (slotStart[first] == slotStart[first + scratch.size()]) return; // no rule reads this device
+            alertMetricValues(family, frame, id, scratch.data());
+            for (uint32_t m = 0; m < scratch.size(); m++) {
+                uint32_t slot = first + m;
+                if (slotStart[slot] == slotStart[slot + 1]) continue;
+                double previous = values[slot];
+                bool same = scratch[m] == previous || (std::isnan(scratch[m]) && std::isnan(previous));
+                if (same && !risingActive[slot]) continue;
+                values[slot] = scratch[m];
+                evaluate(slot, scratch[m], previous, now);
+            }
+        });
+        for (uint32_t id = 0; id < ids.size(); id++) {
+            if (ids[id] == none || !devices[ids[id]].present) continue;
+            if (id >= frame.size() || !frame.present[id]) removeDevice(ids[id], now);
+        }
+        checkTimers(now);
+        stats.totalEvaluated += stats.lastEvaluated;
+    }
+
+    // Transitions since the last call, oldest first.
+    std::vector<AlertEvent> takeEvents() {
+        std::vector<AlertEvent> out;
+        out.swap(events);
+        return out;
+    }
+
+    // Whether any rule is firing for the device with this frame id.
+    bool isFiring(AlertFamily family, uint32_t frameId) const {
+        const std::vector<uint32_t>& ids = deviceOf[size_t(family)];
+        return frameId < ids.size() && ids[frameId] != none && devices[ids[frameId]].firing > 0;
+    }
+
+    const AlertEngineStats& getStats() const { return stats; }
+    const OverheadStage& getStage() const { return stage; }
+    bool empty() const { return rules.empty(); }
+};
+
+// "FIRING hot-sda sda write = 412.5" or "cleared ...", for logs and notifications.
+std::string describeAlert(const AlertEvent& e) {
+    std::ostringstream out;
+    out << (e.firing ? "FIRING " : "cleared ") << e.rule->name << " " << e.device << " "
+        << alertMetricNames(e.rule->family)[e.rule->metric] << " = " << e.value;
+    if (e.gone) out << " (device gone)";
+    return out.str();
+}
@@ -0,0 +1,246 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <linux/netlink.h>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include "./fileutil.hpp"
+
+enum class BlockDeviceKind { Disk, Partition, DeviceMapper, MdRaid };
+
+// Which devices a collector reports: the whole devices of the Disk tab, or every layer of the storage stack.
+enum class DiskScope { WholeDisks, AllLayers };
+
+struct BlockDevice {
+    std::string name;
+    std::string dir; // under /sys/block, "sda" or "sda/sda1" for a partition
+    uint64_t sectorSize = 512; // hw_sector_size, the stat counters count 512 byte sectors regardless
+    bool rotational = false;
+    std::string model;
+    unsigned major = 0;
+    unsigned minor = 0;
+    uint64_t diskseq = 0; // of the disk, increases every time a disk is attached (5.15+), 0 before
+    BlockDeviceKind kind = BlockDeviceKind::Disk;
+    std::string parent;              // the disk of a partition
+    std::vector<std::string> slaves; // the devices a dm or md volume is built on
+    std::string label;               // dm name (e.g. "vg-root" for an LV) or md level
+
+    // Disks and md arrays, what the Disk tab lists. dm volumes (LVM, dm-crypt) and partitions are only shown
+    // in the topology, their I/O is already counted on the devices below them.
+    bool isWholeDisk() const { return kind == BlockDeviceKind::Disk || kind == BlockDeviceKind::MdRaid; }
+};
+
+// Listens for kernel kobject uevents, only used to find out that the block device list changed.
+class UeventMonitor {
+private:
+    int fd = -1;
+    char buffer[8192];
+
+public:
+    UeventMonitor() {
+        fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+        if (fd < 0) return;
+
+        sockaddr_nl addr{};
+        addr.nl_family = AF_NETLINK;
+        addr.nl_pid = 0;
+        addr.nl_groups = 1; // kernel events, udev rebroadcasts use group 2
+        if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    UeventMonitor(const UeventMonitor&) = delete;
+    UeventMonitor& operator=(const UeventMonitor&) = delete;
+    ~UeventMonitor() {
+        if (fd >= 0) close(fd);
+    }
+
+    bool valid() const { return fd >= 0; }
+
+    // Drains every pending message without blocking, returns true if any of them was about a block device.
+    bool poll() {
+        if (fd < 0) return false;
+        bool blockEvent = false;
+        while (true) {
+            ssize_t len = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (len <= 0) break;
+            // "action@devpath\0KEY=VALUE\0KEY=VALUE\0..."
+            std::string_view msg(buffer, len);
+            size_t pos = 0;
+            while (pos < msg.size()) {
+                size_t end = msg.find('\0', pos);
+                if (end == std::string_view::npos) end = msg.size();
+                if (msg.substr(pos, end - pos) == "SUBSYSTEM=block") blockEvent = true;
+                pos = end + 1;
+            }
+        }
+        return blockEvent;
+    }
+};
+
+// Discovers block devices once and caches their static attributes,
+// the list is only rebuilt on hotplug uevents or by a slow fallback rescan.
+class BlockDeviceRegistry {
+private:
+    std::string sysBlock = "/sys/block/";
+    std::vector<BlockDevice> devices;
+    UeventMonitor monitor;
+    std::chrono::steady_clock::time_point lastScan;
+    uint64_t generation = 0;
+    bool scanned = false;
+
+    static std::string trim(std::string s) {
+        while (!s.empty() && (s.back() == '\n' || s.back() == ' ')) s.pop_back();
+        return s;
+    }
+
+    // Matched by prefix only, a substring match on "dm" also hid real disks such as sdm. dm volumes are told
+    // apart by their sysfs attributes instead, see readDevice().
+    static bool isIgnored(const std::string& name) { return name.rfind("loop", 0) == 0 || name.rfind("zram", 0) == 0; }
+
+    std::vector<std::string> readSlaves(const std::string& base) {
+        std::vector<std::string> slaves;
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(base + "/slaves", ec)) {
+            slaves.push_back(entry.path().filename());
+        }
+        std::sort(slaves.begin(), slaves.end());
+        return slaves;
+    }
+
+    // The name plus what tells the device apart from an earlier one of the same name: major:minor and the
+    // diskseq of its disk. A disk pulled and replaced between two scans usually keeps its name.
+    BlockDevice readIdentity(const std::string& name, const std::string& parent) {
+        BlockDevice dev;
+        dev.name = name;
+        dev.parent = parent;
+        dev.dir = parent.empty() ? name : parent + "/" + name;
+        std::string devnum = trim(readfile(sysBlock + dev.dir + "/dev"));
+        if (sscanf(devnum.c_str(), "%u:%u", &dev.major, &dev.minor) != 2) {
+            dev.major = 0;
+            dev.minor = 0;
+        }
+        std::string diskseq = trim(readfile(sysBlock + (parent.empty() ? name : parent) + "/diskseq"));
+        if (!parseNumber(diskseq, dev.diskseq)) dev.diskseq = 0;
+        return dev;
+    }
+
+    static bool sameDevice(const BlockDevice& a, const BlockDevice& b) {
+        return a.name == b.name && a.parent == b.parent && a.major == b.major && a.minor == b.minor &&
+               a.diskseq == b.diskseq;
+    }
+
+    BlockDevice readDevice(BlockDevice dev) {
+        const std::string& name = dev.name;
+        const std::string& parent = dev.parent;
+        std::string base = sysBlock + dev.dir;
+        std::string disk = sysBlock + (parent.empty() ? name : parent); // partitions have no queue/ of their own
+
+        std::string sectorSize = trim(readfile(disk + "/queue/hw_sector_size"));
+        if (!sectorSize.empty()) dev.sectorSize = stoll(sectorSize);
+        dev.rotational = trim(readfile(disk + "/queue/rotational")) == "1";
+        dev.model = trim(readfile(disk + "/device/model"));
+
+        std::error_code ec;
+        if (!parent.empty()) {
+            dev.kind = BlockDeviceKind::Partition;
+        } else if (std::filesystem::exists(base + "/dm", ec)) {
+            dev.kind = BlockDeviceKind::DeviceMapper;
+            dev.label = trim(readfile(base + "/dm/name"));
+        } else if (std::filesystem::exists(base + "/md", ec)) {
+            dev.kind = BlockDeviceKind::MdRaid;
+            dev.label = trim(readfile(base + "/md/level"));
+        }
+        if (parent.empty()) dev.slaves = readSlaves(base);
+        return dev;
+    }
+
+    // Only lists the directories and reads the identity of each device, the other attributes are read for devices
+    // that were not known before. The slaves of dm and md volumes are reread every time since a volume can be
+    // extended onto another device in place.
+    bool rescan() {
+        std::vector<std::pair<std::string, std::string>> names; // name, parent
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(sysBlock, ec)) {
+            std::string name = entry.path().filename();
+            if (isIgnored(name)) continue;
+            names.push_back({name, ""});
+            std::error_code pec;
+            for (const auto& sub : std::filesystem::directory_iterator(entry.path(), pec)) {
+                std::error_code fec;
+                if (std::filesystem::exists(sub.path() / "partition", fec)) names.push_back({sub.path().filename(), name});
+            }
+        }
+        std::sort(names.begin(), names.end());
+        std::vector<BlockDevice> found;
+        found.reserve(names.size());
+        for (auto& [name, parent] : names) found.push_back(readIdentity(name, parent));
+        lastScan = std::chrono::steady_clock::now();
+        scanned = true;
+
+        bool same = found.size() == devices.size();
+        for (size_t i = 0; same && i < found.size(); i++) same = sameDevice(found[i], devices[i]);
+        if (same) {
+            bool changed = false;
+            for (auto& dev : devices) {
+                if (dev.kind != BlockDeviceKind::DeviceMapper && dev.kind != BlockDeviceKind::MdRaid) continue;
+                auto slaves = readSlaves(sysBlock + dev.dir);
+                if (slaves != dev.slaves) {
+                    dev.slaves = std::move(slaves);
+                    changed = true;
+                }
+            }
+            if (changed) generation++;
+            return changed;
+        }
+
+        std::vector<BlockDevice> result;
+        result.reserve(found.size());
+        for (auto& dev : found) {
+            auto known =
+                std::find_if(devices.begin(), devices.end(), [&](const BlockDevice& d) { return d.name == dev.name; });
+            if (known != devices.end() && sameDevice(*known, dev)) result.push_back(std::move(*known));
+            else
+                result.push_back(readDevice(std::move(dev)));
+        }
+        devices = std::move(result);
+        generation++;
+        return true;
+    }
+
+public:
+    // Fallback in case a uevent was missed (socket buffer overrun) or the socket is not available.
+    std::chrono::milliseconds rescanInterval{30000};
+    std::chrono::milliseconds rescanIntervalNoUevents{2000};
+
+    BlockDeviceRegistry() {}
+    BlockDeviceRegistry(std::string sysBlockPath) : sysBlock(sysBlockPath) {}
+
+    // Returns true if the device list or the stacking changed.
+    bool refresh() {
+        if (!scanned) return rescan();
+        if (monitor.poll()) return rescan();
+        auto interval = monitor.valid() ? rescanInterval : rescanIntervalNoUevents;
+        if (std::chrono::steady_clock::now() - lastScan >= interval) return rescan();
+        return false;
+    }
+
+    // Every device sorted by name, partitions included, see BlockDevice::isWholeDisk() for the Disk tab subset.
+    const std::vector<BlockDevice>& getDevices() {
+        refresh();
+        return devices;
+    }
+
+    // Incremented whenever the device list changes, lets users cache anything derived from it.
+    uint64_t getGeneration() const { return generation; }
+
+    const std::string& getSysBlockPath() const { return sysBlock; }
+};
@@ -0,0 +1,116 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "./blockdevices.hpp"
+
+// How block devices are stacked, as a forest rooted at the physical disks: partitions below their disk, dm and md
+// volumes below every device they are built on, so a volume spanning two disks shows up under both.
+//
+// Every row also gets a roll-up, the part of its root disk's traffic that comes from that row's device. For an
+// edge (upper, lower) the upper device is credited min(upper, lower) on the lower one, scaled down when the
+// uppers of a device add up to more than it did. That is exact for single volumes, partitions, mirrors and
+// stripes, and an estimate when several volumes share several devices.
+class BlockTopology {
+public:
+    struct Row {
+        size_t device; // index into getDevices()
+        int parent;    // row index, -1 for a disk
+        int depth;
+        size_t edge;     // edge to the parent row, unused for a disk
+        std::string key; // device names from the disk down, "sda/sda2/dm-0", stable across rebuilds
+    };
+
+private:
+    struct Edge {
+        size_t upper;
+        size_t lower;
+    };
+
+    static constexpr int maxDepth = 16; // sysfs does not allow cycles, this only bounds a corrupt tree
+
+    std::vector<BlockDevice> devices;
+    std::vector<Edge> edges;
+    std::vector<std::vector<size_t>> edgesOnto; // [lower device] edges of the devices stacked on it
+    std::vector<Row> rows;                      // depth first, parents before their children
+    std::vector<double> share[2];               // [edge] read, write MB/s of upper credited on lower
+    std::vector<double> rollup[2];              // [row] read, write MB/s on the root disk
+    uint64_t generation = 0;
+
+    void addRows(size_t device, int parent, size_t edge, int depth, const std::string& key) {
+        int row = rows.size();
+        rows.push_back({device, parent, depth, edge, key});
+        if (depth >= maxDepth) return;
+        for (size_t e : edgesOnto[device]) {
+            addRows(edges[e].upper, row, e, depth + 1, key + "/" + devices[edges[e].upper].name);
+        }
+    }
+
+public:
+    // devices in the order of the rate arrays passed to update().
+    void build(const std::vector<BlockDevice>& devs) {
+        devices = devs;
+        std::map<std::string, size_t> index;
+        for (size_t i = 0; i < devices.size(); i++) index[devices[i].name] = i;
+
+        edges.clear();
+        std::vector<bool> stacked(devices.size(), false);
+        for (size_t i = 0; i < devices.size(); i++) {
+            auto addEdge = [&](const std::string& lower) {
+                auto it = index.find(lower);
+                if (it == index.end()) return; // e.g. a dm volume on a loop device, which is not listed
+                edges.push_back({i, it->second});
+                stacked[i] = true;
+            };
+            if (!devices[i].parent.empty()) addEdge(devices[i].parent);
+            for (auto& slave : devices[i].slaves) addEdge(slave);
+        }
+        edgesOnto.assign(devices.size(), {});
+        for (size_t e = 0; e < edges.size(); e++) edgesOnto[edges[e].lower].push_back(e);
+
+        rows.clear();
+        for (size_t i = 0; i < devices.size(); i++) {
+            if (!stacked[i]) addRows(i, -1, 0, 0, devices[i].name);
+        }
+        for (int k = 0; k < 2; k++) {
+            share[k].assign(edges.size(), 0.0);
+            rollup[k].assign(rows.size(), 0.0);
+        }
+        generation++;
+    }
+
+    // read and write hold the measured MB/s of every device. Linear in devices, edges and rows.
+    void update(const double* read, const double* write) {
+        const double* rates[2] = {read, write};
+        for (int k = 0; k < 2; k++) {
+            const double* m = rates[k];
+            for (size_t lower = 0; lower < edgesOnto.size(); lower++) {
+                double sum = 0;
+                for (size_t e : edgesOnto[lower]) sum += std::min(m[edges[e].upper], m[lower]);
+                double scale = sum > m[lower] && sum > 0 ? m[lower] / sum : 1.0;
+                for (size_t e : edgesOnto[lower]) share[k][e] = std::min(m[edges[e].upper], m[lower]) * scale;
+            }
+            for (size_t r = 0; r < rows.size(); r++) {
+                const Row& row = rows[r];
+                if (row.parent < 0) {
+                    rollup[k][r] = m[row.device];
+                    continue;
+                }
+                // the part of the lower device's traffic that lands on the root disk carries over to the upper one
+                double lower = m[rows[row.parent].device];
+                rollup[k][r] = lower > 0 ? share[k][row.edge] * rollup[k][row.parent] / lower : 0.0;
+            }
+        }
+    }
+
+    const std::vector<BlockDevice>& getDevices() const { return devices; }
+    const std::vector<Row>& getRows() const { return rows; }
+    double getRead(size_t row) const { return rollup[0][row]; }
+    double getWrite(size_t row) const { return rollup[1][row]; }
+
+    // Incremented by every build(), the rows of one generation never change.
+    uint64_t getGeneration() const { return generation; }
+};
@@ -0,0 +1,587 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "./blockdevices.hpp"
+#include "./fileutil.hpp"
+#include "./processstats.hpp"
+#include "./sampleframe.hpp"
+
+// What a cgroup used in a tick besides the read and write MB/s of the frame. CPU and memory are those of the
+// whole cgroup, also in the per device entries of CgroupView::CgroupDevices.
+struct CgroupMetrics {
+    double readIops = 0;
+    double writeIops = 0;
+    double cpuPercent = 0; // 100 is one core
+    double memoryMB = 0;   // memory.current in MiB
+};
+
+// One frame entry per cgroup ("system.slice/docker-1234.scope"), or per cgroup and device
+// ("system.slice/docker-1234.scope@sda") to see which workload drives a disk.
+enum class CgroupView { Cgroups, CgroupDevices };
+
+// The cgroup v2 hierarchy below root (prepended to /sys), empty without one. Hybrid hierarchies mount it below
+// the v1 controllers.
+std::string cgroupRoot(const std::string& root = "") {
+    for (std::string dir : {root + "/sys/fs/cgroup", root + "/sys/fs/cgroup/unified"}) {
+        if (access((dir + "/cgroup.controllers").c_str(), F_OK) == 0) return dir;
+    }
+    return "";
+}
+
+// Per cgroup I/O, CPU and memory from the cgroup v2 tree: io.stat, cpu.stat and memory.current. The tree is
+// walked once, after that inotify reports the cgroups that were created or removed and only their directories
+// are listed; a slow rescan catches what inotify could not watch. Every cgroup keeps its directory and stat
+// files open within the open file budget, a tick is one pread per file, split across a few threads. Past the
+// budget the files are opened with openat() from the root. io.stat names devices by major:minor, they are
+// joined to the BlockDeviceRegistry names of the Disk tab. The totals only count whole disks, the I/O of dm
+// volumes and partitions is charged to the disks below them as well. The root cgroup, which is the whole
+// machine, is not reported.
+class CgroupStats {
+private:
+    static constexpr int fileCount = 3;
+    static constexpr const char* fileNames[fileCount] = {"io.stat", "cpu.stat", "memory.current"};
+
+    struct DeviceIo {
+        uint64_t devnum = 0;
+        int device = -1;       // index into known, -1 for devices the registry does not list (loop, zram)
+        bool seen = false;     // had a line in the last read
+        bool hasLast = false;
+        bool active = false;   // did I/O since it was found
+        uint64_t counters[4] = {}; // rbytes, wbytes, rios, wios
+        double rates[4] = {};      // MB/s and IOPS
+        uint32_t id = DeviceIds::none; // frame id in the CgroupDevices view
+    };
+
+    struct Node {
+        std::string path; // relative to the cgroup root, empty for the root itself
+        int dirFd = -1;   // -1 past the budget, the files are then opened by path from rootFd
+        int files[fileCount] = {-1, -1, -1};
+        uint8_t missing = 0; // bit per file the controller does not provide here, retried on rescans
+        int watch = -1;
+        bool used = false;    // slot holds a cgroup
+        bool visited = false; // during a rescan
+        bool gone = false;    // reads fail since the cgroup was removed, inotify or the next rescan drops it
+        bool hasLast = false;
+        bool active = false;  // did I/O since it was found
+        uint64_t cpuUsec = 0;
+        double cpuPercent = 0;
+        double memoryMB = 0;
+        std::vector<DeviceIo> io; // sorted by devnum
+        uint32_t id = DeviceIds::none; // frame id in the Cgroups view
+    };
+
+    struct KnownDevice {
+        std::string name;
+        bool wholeDisk;
+        bool inScope; // listed in the CgroupDevices view
+    };
+
+    std::string rootPath;
+    int rootFd = -1;
+    int inotifyFd = -1;
+    CgroupView view;
+    DiskScope scope;
+
+    std::vector<Node> nodes; // [slot], removed cgroups leave free slots
+    std::vector<int> freeSlots;
+    std::map<std::string, int> slots; // path -> slot
+    std::map<int, int> watches;       // inotify watch -> slot
+    bool watchFailed = false;         // some directory has no watch, rescan more often
+
+    BlockDeviceRegistry registry;
+    uint64_t registryGeneration = uint64_t(-1);
+    std::vector<KnownDevice> known;
+    std::vector<std::pair<uint64_t, int>> devnumIndex; // sorted (major:minor, index into known)
+
+    DeviceIds ids;
+    DeviceFrame<CgroupMetrics> frame;
+
+    ParallelFor pool;
+    std::function<void(size_t, size_t)> readRange;
+    std::atomic<size_t> cachedFds{0};
+    size_t fdBudget; // a quarter of the fd limit, ProcessStats caches up to half of it
+
+    std::chrono::steady_clock::time_point lastTime;
+    std::chrono::steady_clock::time_point lastScan;
+    double seconds = 0;
+    bool scanned = false;
+
+    static constexpr size_t chunkSize = 256;
+    static constexpr uint32_t watchMask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+
+    static uint64_t devnum(unsigned major, unsigned minor) { return (uint64_t(major) << 32) | minor; }
+
+    // Takes a cached fd from the budget, false once it is used up.
+    bool reserveFd() {
+        if (cachedFds.fetch_add(1) < fdBudget) return true;
+        cachedFds--;
+        return false;
+    }
+
+    void closeFd(int& fd) {
+        if (fd < 0) return;
+        close(fd);
+        fd = -1;
+        cachedFds--;
+    }
+
+    // A cgroup directory by its cached fd, or opened from the root. Temporary fds are returned in temp.
+    int openDir(const Node& n, int& temp) const {
+        temp = -1;
+        if (n.dirFd >= 0) return n.dirFd;
+        temp = openat(rootFd, n.path.empty() ? "." : n.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        return temp;
+    }
+
+    int addNode(int parent, const std::string& path, const char* name) {
+        int dirFd = -1;
+        if (parent >= 0) {
+            const Node& p = nodes[parent];
+            dirFd = p.dirFd >= 0 ? openat(p.dirFd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)
+                                 : openat(rootFd, path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        } else {
+            dirFd = openat(rootFd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        }
+        if (dirFd < 0) return -1; // removed again before we got to it
+        if (!reserveFd()) {
+            close(dirFd);
+            dirFd = -1;
+        }
+
+        int slot;
+        if (!freeSlots.empty()) {
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+            nodes[slot] = Node();
+        } else {
+            slot = nodes.size();
+            nodes.emplace_back();
+        }
+        Node& n = nodes[slot];
+        n.path = path;
+        n.dirFd = dirFd;
+        n.used = true;
+        n.visited = true;
+        slots[path] = slot;
+        if (inotifyFd >= 0) {
+            std::string full = path.empty() ? rootPath : rootPath + "/" + path;
+            n.watch = inotify_add_watch(inotifyFd, full.c_str(), watchMask);
+            if (n.watch >= 0) watches[n.watch] = slot;
+            else
+                watchFailed = true; // usually fs.inotify.max_user_watches
+        }
+        return slot;
+    }
+
+    // Frame ids of a removed cgroup, containers get unique names so they would pile up otherwise.
+    void releaseIds(Node& n) {
+        if (n.id != DeviceIds::none) ids.release(n.id);
+        n.id = DeviceIds::none;
+        for (auto& d : n.io) {
+            if (d.id != DeviceIds::none) ids.release(d.id);
+            d.id = DeviceIds::none;
+        }
+    }
+
+    // Removes a cgroup and everything below it.
+    void removeNode(int slot) {
+        std::string prefix = nodes[slot].path + "/";
+        std::vector<int> subtree{slot};
+        for (auto it = slots.lower_bound(prefix); it != slots.end() && it->first.compare(0, prefix.size(), prefix) == 0;
+             ++it) {
+            subtree.push_back(it->second);
+        }
+        for (int s : subtree) {
+            Node& n = nodes[s];
+            if (n.watch >= 0) {
+                inotify_rm_watch(inotifyFd, n.watch); // fails harmlessly once the directory is gone
+                watches.erase(n.watch);
+            }
+            closeFd(n.dirFd);
+            for (int& fd : n.files) closeFd(fd);
+            releaseIds(n);
+            slots.erase(n.path);
+            n = Node();
+            freeSlots.push_back(s);
+        }
+    }
+
+    // Lists the child cgroups of slot, new ones are added with their whole subtree. recursive also descends into
+    // the known ones, for rescans.
+    void listChildren(int slot, bool recursive) {
+        int temp;
+        int dir = openDir(nodes[slot], temp);
+        if (dir < 0) return;
+        int fd = openat(dir, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC); // fdopendir owns its fd
+        if (temp >= 0) close(temp);
+        DIR* d = fd >= 0 ? fdopendir(fd) : nullptr;
+        if (!d) {
+            if (fd >= 0) close(fd);
+            return;
+        }
+        std::vector<std::string> children;
+        while (dirent* e = readdir(d)) {
+            if (e->d_name[0] == '.') continue;
+            bool isDir = e->d_type == DT_DIR;
+            if (e->d_type == DT_UNKNOWN) {
+                struct stat st;
+                isDir = fstatat(dirfd(d), e->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+            }
+            if (isDir) children.push_back(e->d_name);
+        }
+        closedir(d);
+
+        std::string base = nodes[slot].path.empty() ? "" : nodes[slot].path + "/";
+        for (const std::string& name : children) {
+            std::string path = base + name;
+            auto it = slots.find(path);
+            if (it == slots.end()) {
+                int child = addNode(slot, path, name.c_str());
+                if (child >= 0) listChildren(child, false);
+            } else {
+                nodes[it->second].visited = true;
+                if (recursive) listChildren(it->second, true);
+            }
+        }
+    }
+
+    // Walks the whole tree, drops what is gone and retries the files that were missing.
+    void rescan() {
+        for (auto& n : nodes) {
+            n.visited = false;
+            n.missing = 0;
+        }
+        auto root = slots.find("");
+        int rootSlot = root != slots.end() ? root->second : addNode(-1, "", ".");
+        if (rootSlot < 0) return;
+        nodes[rootSlot].visited = true;
+        listChildren(rootSlot, true);
+        for (size_t s = 0; s < nodes.size(); s++) {
+            if (nodes[s].used && !nodes[s].visited) removeNode(s);
+        }
+        lastScan = std::chrono::steady_clock::now();
+        scanned = true;
+    }
+
+    // Applies the pending inotify events, false if the queue overflowed and a rescan is needed.
+    bool applyEvents() {
+        alignas(inotify_event) char buffer[16384];
+        while (true) {
+            ssize_t len = read(inotifyFd, buffer, sizeof(buffer));
+            if (len <= 0) return true;
+            for (char* p = buffer; p < buffer + len;) {
+                const inotify_event* e = reinterpret_cast<const inotify_event*>(p);
+                p += sizeof(inotify_event) + e->len;
+                if (e->mask & IN_Q_OVERFLOW) return false;
+                if (!(e->mask & IN_ISDIR) || e->len == 0) continue;
+                auto w = watches.find(e->wd);
+                if (w == watches.end()) continue;
+                int parent = w->second;
+                std::string path = nodes[parent].path.empty() ? e->name : nodes[parent].path + "/" + e->name;
+                auto existing = slots.find(path);
+                if (e->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    if (existing != slots.end()) continue;
+                    int child = addNode(parent, path, e->name);
+                    if (child >= 0) listChildren(child, false); // children made before the watch was in place
+                } else if (existing != slots.end()) {
+                    removeNode(existing->second);
+                }
+            }
+        }
+    }
+
+    void refreshTree() {
+        if (!scanned) return rescan();
+        if (inotifyFd >= 0 && !applyEvents()) return rescan();
+        auto interval = inotifyFd >= 0 && !watchFailed ? rescanInterval : rescanIntervalNoWatches;
+        if (std::chrono::steady_clock::now() - lastScan >= interval) rescan();
+    }
+
+    void refreshDevices() {
+        const auto& devs = registry.getDevices();
+        if (registry.getGeneration() == registryGeneration) return;
+        registryGeneration = registry.getGeneration();
+        known.clear();
+        devnumIndex.clear();
+        for (auto& dev : devs) {
+            bool inScope = scope == DiskScope::AllLayers || dev.isWholeDisk();
+            devnumIndex.push_back({devnum(dev.major, dev.minor), int(known.size())});
+            known.push_back({dev.name, dev.kind == BlockDeviceKind::Disk || dev.kind == BlockDeviceKind::MdRaid, inScope});
+        }
+        std::sort(devnumIndex.begin(), devnumIndex.end());
+        for (auto& n : nodes) {
+            for (auto& d : n.io) {
+                d.device = findDevice(d.devnum);
+                if (d.id == DeviceIds::none) continue;
+                // keeps the id unless the device left the view or got another name
+                const std::string& name = ids.getNames()[d.id]; // "<path>@<device>"
+                bool same = d.device >= 0 && known[d.device].inScope &&
+                            name.compare(n.path.size() + 1, std::string::npos, known[d.device].name) == 0;
+                if (!same) {
+                    ids.release(d.id);
+                    d.id = DeviceIds::none;
+                }
+            }
+        }
+    }
+
+    int findDevice(uint64_t dn) const {
+        auto it = std::lower_bound(devnumIndex.begin(), devnumIndex.end(), std::pair<uint64_t, int>{dn, -1});
+        return it != devnumIndex.end() && it->first == dn ? it->second : -1;
+    }
+
+    // The whole file into buffer, from the cached fd or an openat() that is kept if the budget allows. -1 and
+    // errno on failure.
+    ssize_t readFile(Node& n, int file, std::vector<char>& buffer) {
+        int fd = n.files[file];
+        bool temporary = false;
+        if (fd < 0 && n.dirFd >= 0) {
+            fd = openat(n.dirFd, fileNames[file], O_RDONLY | O_CLOEXEC);
+        } else if (fd < 0) {
+            static thread_local std::string path; // keeps its capacity, no allocation per open
+            path.assign(n.path).append("/").append(fileNames[file]);
+            fd = openat(rootFd, path.c_str(), O_RDONLY | O_CLOEXEC);
+        }
+        if (n.files[file] < 0) {
+            if (fd < 0) return -1;
+            if (reserveFd()) n.files[file] = fd;
+            else
+                temporary = true;
+        }
+        size_t length = 0;
+        while (true) {
+            if (length == buffer.size()) buffer.resize(buffer.size() * 2);
+            ssize_t r = pread(fd, buffer.data() + length, buffer.size() - length, length);
+            if (r < 0) {
+                int error = errno;
+                if (temporary) close(fd);
+                errno = error;
+                return -1;
+            }
+            length += r;
+            if (length < buffer.size()) break; // a short read is the end of a seq_file, saves a second pread
+        }
+        if (temporary) close(fd);
+        return length;
+    }
+
+    // "8:0 rbytes=1 wbytes=2 rios=3 wios=4 dbytes=0 dios=0" per device.
+    void parseIoStat(Node& n, std::string_view text) {
+        for (auto& d : n.io) d.seen = false;
+        size_t lineStart = 0;
+        while (lineStart < text.size()) {
+            size_t lineEnd = text.find('\n', lineStart);
+            if (lineEnd == std::string_view::npos) lineEnd = text.size();
+            std::string_view line = text.substr(lineStart, lineEnd - lineStart);
+            lineStart = lineEnd + 1;
+
+            size_t pos = 0;
+            std::string_view dev = nextToken(line, pos);
+            size_t colon = dev.find(':');
+            unsigned major, minor;
+            if (colon == std::string_view::npos || !parseNumber(dev.substr(0, colon), major) ||
+                !parseNumber(dev.substr(colon + 1), minor)) {
+                continue;
+            }
+            uint64_t dn = devnum(major, minor);
+            auto it = std::lower_bound(n.io.begin(), n.io.end(), dn, [](const DeviceIo& d, uint64_t v) {
+                return d.devnum < v;
+            });
+            if (it == n.io.end() || it->devnum != dn) {
+                it = n.io.insert(it, DeviceIo());
+                it->devnum = dn;
+                it->device = findDevice(dn);
+            }
+            DeviceIo& d = *it;
+            uint64_t values[4] = {d.counters[0], d.counters[1], d.counters[2], d.counters[3]};
+            for (std::string_view field = nextToken(line, pos); !field.empty(); field = nextToken(line, pos)) {
+                size_t eq = field.find('=');
+                if (eq == std::string_view::npos) continue;
+                std::string_view key = field.substr(0, eq);
+                std::string_view value = field.substr(eq + 1);
+                if (key == "rbytes") parseNumber(value, values[0]);
+                else if (key == "wbytes")
+                    parseNumber(value, values[1]);
+                else if (key == "rios")
+                    parseNumber(value, values[2]);
+                else if (key == "wios")
+                    parseNumber(value, values[3]);
+            }
+            for (int i = 0; i < 4; i++) {
+                double delta = d.hasLast && values[i] >= d.counters[i] ? double(values[i] - d.counters[i]) : 0.0;
+                d.rates[i] = seconds > 0 ? delta / seconds / (i < 2 ? 1000000.0 : 1.0) : 0.0;
+                d.counters[i] = values[i];
+            }
+            if (d.rates[0] > 0 || d.rates[1] > 0) d.active = true;
+            d.hasLast = true;
+            d.seen = true;
+        }
+        // devices without a line had no I/O in this cgroup yet, or were removed
+        for (auto& d : n.io) {
+            if (!d.seen) std::fill(std::begin(d.rates), std::end(d.rates), 0.0);
+        }
+    }
+
+    // Runs on the pool, every node is only touched by the thread that got its range.
+    void readNode(Node& n) {
+        static thread_local std::vector<char> buffer(16384);
+        if (!n.used || n.gone || n.path.empty()) return;
+        bool hadLast = n.hasLast;
+        for (int file = 0; file < fileCount; file++) {
+            if (n.missing & (1 << file)) continue;
+            ssize_t length = readFile(n, file, buffer);
+            if (length < 0) {
+                // a removed cgroup fails with ENODEV on open files and has no cpu.stat, which every cgroup has,
+                // the other files are missing where their controller is not enabled
+                if (errno == ENODEV || (errno == ENOENT && file == 1)) n.gone = true;
+                else if (errno == ENOENT)
+                    n.missing |= 1 << file;
+                if (file == 0) {
+                    for (auto& d : n.io) std::fill(std::begin(d.rates), std::end(d.rates), 0.0);
+                }
+                continue;
+            }
+            std::string_view text(buffer.data(), length);
+            if (file == 0) {
+                parseIoStat(n, text);
+            } else if (file == 1) {
+                // "usage_usec 123\nuser_usec ..."
+                size_t pos = 0;
+                uint64_t usec = n.cpuUsec;
+                while (pos < text.size()) {
+                    std::string_view key = nextToken(text, pos);
+                    std::string_view value = nextToken(text, pos);
+                    if (key == "usage_usec") {
+                        parseNumber(value, usec);
+                        break;
+                    }
+                }
+                n.cpuPercent = hadLast && seconds > 0 && usec >= n.cpuUsec ? (usec - n.cpuUsec) / seconds / 1e4 : 0.0;
+                n.cpuUsec = usec;
+            } else {
+                uint64_t bytes = 0;
+                size_t pos = 0;
+                parseNumber(nextToken(text, pos), bytes);
+                n.memoryMB = bytes / 1048576.0;
+            }
+        }
+        n.hasLast = !n.gone;
+    }
+
+    void buildFrame() {
+        // ids first, the frame is resized once per tick at most
+        for (auto& n : nodes) {
+            if (!n.used || n.path.empty()) continue;
+            if (view == CgroupView::Cgroups) {
+                if (n.id == DeviceIds::none) n.id = ids.intern(n.path);
+                continue;
+            }
+            for (auto& d : n.io) {
+                if (d.id == DeviceIds::none && d.device >= 0 && known[d.device].inScope) {
+                    d.id = ids.intern(n.path + "@" + known[d.device].name);
+                }
+            }
+        }
+        frame.resize(ids);
+        std::fill(frame.present.begin(), frame.present.end(), 0);
+
+        for (auto& n : nodes) {
+            if (!n.used || n.path.empty() || n.gone || !n.hasLast) continue;
+            CgroupMetrics total;
+            double read = 0, write = 0;
+            for (auto& d : n.io) {
+                if (d.device < 0 || !known[d.device].wholeDisk) continue;
+                read += d.rates[0];
+                write += d.rates[1];
+                total.readIops += d.rates[2];
+                total.writeIops += d.rates[3];
+            }
+            if (read > 0 || write > 0) n.active = true;
+            total.cpuPercent = n.cpuPercent;
+            total.memoryMB = n.memoryMB;
+            if (view == CgroupView::Cgroups) {
+                if (activeOnly && !n.active) continue;
+                frame.read[n.id] = read;
+                frame.write[n.id] = write;
+                frame.metrics[n.id] = total;
+                frame.present[n.id] = 1;
+                continue;
+            }
+            for (auto& d : n.io) {
+                if (d.id == DeviceIds::none || !d.hasLast || (activeOnly && !d.active)) continue;
+                frame.read[d.id] = d.rates[0];
+                frame.write[d.id] = d.rates[1];
+                frame.metrics[d.id] = {d.rates[2], d.rates[3], n.cpuPercent, n.memoryMB};
+                frame.present[d.id] = 1;
+            }
+        }
+    }
+
+public:
+    // Without inotify, or with cgroups it could not watch, the tree is rescanned that often.
+    std::chrono::milliseconds rescanInterval{60000};
+    std::chrono::milliseconds rescanIntervalNoWatches{5000};
+    // Only report cgroups (or cgroup and device pairs) once they did I/O, hosts have thousands of idle ones.
+    bool activeOnly = true;
+
+    // root is prepended to /sys, for fixture trees in benchmarks. threads are the extra reading threads.
+    CgroupStats(
+        std::string root = "", CgroupView view = CgroupView::Cgroups, DiskScope scope = DiskScope::WholeDisks,
+        size_t threads = std::min(3u, std::thread::hardware_concurrency() / 2)
+    ) :
+        rootPath(cgroupRoot(root)), view(view), scope(scope), registry(root + "/sys/block/"), pool(threads),
+        fdBudget(openFileBudget() / 2) {
+        if (!rootPath.empty()) rootFd = open(rootPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        readRange = [this](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) readNode(nodes[i]);
+        };
+    }
+    CgroupStats(const CgroupStats&) = delete;
+    CgroupStats& operator=(const CgroupStats&) = delete;
+    ~CgroupStats() {
+        for (auto& n : nodes) {
+            closeFd(n.dirFd);
+            for (int& fd : n.files) closeFd(fd);
+        }
+        if (inotifyFd >= 0) close(inotifyFd);
+        if (rootFd >= 0) close(rootFd);
+    }
+
+    // False without a cgroup v2 hierarchy, the frame then stays empty.
+    bool available() const { return rootFd >= 0; }
+
+    const DeviceFrame<CgroupMetrics>& getFrame() {
+        if (rootFd < 0) return frame;
+        auto now = std::chrono::steady_clock::now();
+        seconds = lastTime.time_since_epoch().count() ? std::chrono::duration<double>(now - lastTime).count() : 0;
+        lastTime = now;
+
+        refreshDevices();
+        refreshTree();
+        pool.run(nodes.size(), chunkSize, readRange);
+        buildFrame();
+        return frame;
+    }
+
+    size_t getCgroupCount() const { return slots.size(); }
+    size_t getCachedFileCount() const { return cachedFds.load(); }
+    size_t getWatchCount() const { return watches.size(); }
+    size_t getThreadCount() const { return pool.getThreadCount(); }
+};
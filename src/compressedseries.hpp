@@ -0,0 +1,266 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+// Bits appended most significant first to 64 bit words.
+class BitWriter {
+private:
+    std::vector<uint64_t>& words;
+    uint64_t bits = 0;
+
+public:
+    BitWriter(std::vector<uint64_t>& words) : words(words) {}
+
+    // The low n bits of value, n from 1 to 64.
+    void put(uint64_t value, unsigned n) {
+        if (n < 64) value &= (uint64_t(1) << n) - 1;
+        size_t word = bits / 64;
+        unsigned free = 64 - bits % 64;
+        if (word >= words.size()) words.push_back(0);
+        if (n <= free) {
+            words[word] |= value << (free - n);
+        } else {
+            words[word] |= value >> (n - free);
+            words.push_back(value << (64 - (n - free)));
+        }
+        bits += n;
+    }
+
+    uint64_t size() const { return bits; }
+};
+
+class BitReader {
+private:
+    const uint64_t* words;
+    uint64_t bits;
+
+public:
+    BitReader(const uint64_t* words, uint64_t start) : words(words), bits(start) {}
+
+    uint64_t get(unsigned n) {
+        size_t word = bits / 64;
+        unsigned free = 64 - bits % 64;
+        bits += n;
+        uint64_t mask = n < 64 ? (uint64_t(1) << n) - 1 : ~uint64_t(0);
+        if (n <= free) return (words[word] >> (free - n)) & mask;
+        return ((words[word] << (n - free)) | (words[word + 1] >> (64 - (n - free)))) & mask;
+    }
+
+    bool bit() { return get(1); }
+};
+
+// Rounds v to mantissaBits bits of mantissa, which leaves trailing zeros for the XOR encoding. 52 keeps v.
+double quantizeMantissa(double v, unsigned mantissaBits) {
+    if (mantissaBits >= 52) return v;
+    uint64_t b;
+    memcpy(&b, &v, sizeof(b));
+    unsigned drop = 52 - mantissaBits;
+    b = (b + (uint64_t(1) << (drop - 1))) & ~((uint64_t(1) << drop) - 1); // a carry into the exponent rounds up
+    memcpy(&v, &b, sizeof(v));
+    return v;
+}
+
+// Samples with one shared timestamp column and one value column per metric like SeriesBuffer, compressed in
+// chunks the way Gorilla does it: delta-of-delta timestamps and values XORed with their predecessor. A chunk
+// keeps one bit stream per column so a chart decodes only the chunks and columns of its window. The newest
+// chunk is kept uncompressed until it is full, so appends stay O(1) and cheap.
+class CompressedSeries {
+private:
+    struct Chunk {
+        int64_t firstTime;
+        int64_t lastTime;
+        uint32_t count;
+        std::vector<uint32_t> starts; // [stream] first bit, stream 0 are the times and 1 + c column c
+        std::vector<uint64_t> words;
+    };
+
+    size_t capacity;
+    size_t columns;
+    size_t chunkSize;
+    unsigned mantissaBits;
+    std::deque<Chunk> chunks;
+    size_t sealed = 0; // samples in chunks
+    std::vector<int64_t> openTimes;
+    std::vector<double> openValues; // [row * columns + column]
+    std::vector<uint64_t> scratch;
+    mutable std::vector<int64_t> decodedTimes; // forEach() buffers, a chunk at a time
+    mutable std::vector<double> decodedValues;
+
+    static void putTimes(BitWriter& w, const int64_t* times, size_t count) {
+        int64_t previousDelta = 0;
+        for (size_t i = 1; i < count; i++) {
+            int64_t delta = times[i] - times[i - 1];
+            int64_t dod = delta - previousDelta;
+            previousDelta = delta;
+            if (dod == 0) {
+                w.put(0, 1);
+            } else if (dod >= -63 && dod <= 64) {
+                w.put(0b10, 2);
+                w.put(dod + 63, 7);
+            } else if (dod >= -2047 && dod <= 2048) {
+                w.put(0b110, 3);
+                w.put(dod + 2047, 12);
+            } else if (dod >= -524287 && dod <= 524288) {
+                w.put(0b1110, 4);
+                w.put(dod + 524287, 20);
+            } else {
+                w.put(0b1111, 4);
+                w.put(uint64_t(dod), 64);
+            }
+        }
+    }
+
+    static void getTimes(BitReader& r, int64_t first, int64_t* times, size_t count) {
+        times[0] = first;
+        int64_t delta = 0;
+        for (size_t i = 1; i < count; i++) {
+            int64_t dod = 0;
+            if (r.bit()) {
+                if (!r.bit()) dod = int64_t(r.get(7)) - 63;
+                else if (!r.bit())
+                    dod = int64_t(r.get(12)) - 2047;
+                else if (!r.bit())
+                    dod = int64_t(r.get(20)) - 524287;
+                else
+                    dod = int64_t(r.get(64));
+            }
+            delta += dod;
+            times[i] = times[i - 1] + delta;
+        }
+    }
+
+    // '0' for a repeated value, '10' and the meaningful bits if they fit the previous window of leading and
+    // trailing zeros, else '11', 5 bits of leading zeros, 6 bits of length - 1 and the meaningful bits.
+    static void putValues(BitWriter& w, const double* values, size_t stride, size_t count) {
+        uint64_t previous;
+        memcpy(&previous, &values[0], sizeof(previous));
+        w.put(previous, 64);
+        unsigned leading = 65, trailing = 0; // no window yet
+        for (size_t i = 1; i < count; i++) {
+            uint64_t bits;
+            memcpy(&bits, &values[i * stride], sizeof(bits));
+            uint64_t x = bits ^ previous;
+            previous = bits;
+            if (x == 0) {
+                w.put(0, 1);
+                continue;
+            }
+            unsigned l = std::min(__builtin_clzll(x), 31);
+            unsigned t = __builtin_ctzll(x);
+            if (leading <= l && trailing <= t) {
+                w.put(0b10, 2);
+                w.put(x >> trailing, 64 - leading - trailing);
+            } else {
+                leading = l;
+                trailing = t;
+                w.put(0b11, 2);
+                w.put(leading, 5);
+                w.put(63 - leading - trailing, 6);
+                w.put(x >> trailing, 64 - leading - trailing);
+            }
+        }
+    }
+
+    static void getValues(BitReader& r, double* values, size_t stride, size_t count) {
+        uint64_t previous = r.get(64);
+        memcpy(&values[0], &previous, sizeof(previous));
+        unsigned leading = 0, trailing = 0;
+        for (size_t i = 1; i < count; i++) {
+            if (r.bit()) {
+                if (r.bit()) {
+                    leading = r.get(5);
+                    trailing = 64 - leading - (r.get(6) + 1);
+                }
+                previous ^= r.get(64 - leading - trailing) << trailing;
+            }
+            memcpy(&values[i * stride], &previous, sizeof(previous));
+        }
+    }
+
+    void seal() {
+        size_t count = openTimes.size();
+        scratch.clear();
+        BitWriter w(scratch);
+        Chunk chunk{openTimes.front(), openTimes.back(), uint32_t(count), {}, {}};
+        chunk.starts.reserve(columns + 1);
+        chunk.starts.push_back(0);
+        putTimes(w, openTimes.data(), count);
+        for (size_t c = 0; c < columns; c++) {
+            chunk.starts.push_back(w.size());
+            putValues(w, &openValues[c], columns, count);
+        }
+        chunk.words.assign(scratch.begin(), scratch.end()); // exact size, the scratch keeps its capacity
+        chunks.push_back(std::move(chunk));
+        sealed += count;
+        openTimes.clear();
+        openValues.clear();
+        // drop whole chunks as long as what stays still covers the capacity
+        while (!chunks.empty() && sealed - chunks.front().count >= capacity) {
+            sealed -= chunks.front().count;
+            chunks.pop_front();
+        }
+    }
+
+public:
+    // Keeps at least capacity samples, mantissaBits below 52 rounds values to that precision before they are
+    // stored (10 is within 0.05%, far below a chart pixel).
+    CompressedSeries(size_t capacity, size_t columns, unsigned mantissaBits = 52, size_t chunkSize = 120) :
+        capacity(std::max<size_t>(capacity, 1)), columns(columns), chunkSize(std::max<size_t>(chunkSize, 2)),
+        mantissaBits(mantissaBits) {}
+
+    // values must hold one entry per column, times have to increase.
+    void append(int64_t time, const double* values) {
+        if (openTimes.size() == chunkSize) seal();
+        openTimes.push_back(time);
+        for (size_t c = 0; c < columns; c++) openValues.push_back(quantizeMantissa(values[c], mantissaBits));
+    }
+
+    void append(int64_t time, const std::vector<double>& values) { append(time, values.data()); }
+
+    void clear() {
+        chunks.clear();
+        sealed = 0;
+        openTimes.clear();
+        openValues.clear();
+    }
+
+    size_t size() const { return sealed + openTimes.size(); }
+    size_t getColumns() const { return columns; }
+
+    // Heap and object bytes of the samples, the reusable buffers not counted.
+    size_t getMemoryBytes() const {
+        size_t bytes = sizeof(*this) + openTimes.capacity() * sizeof(int64_t) + openValues.capacity() * sizeof(double);
+        for (auto& c : chunks) bytes += sizeof(Chunk) + c.starts.capacity() * 4 + c.words.capacity() * 8;
+        return bytes;
+    }
+
+    // Calls f(time, const double* values) for every sample at or after from, oldest first, with the count
+    // columns starting at firstColumn. Only the chunks that reach from are decoded. Not reentrant, the
+    // decode buffers are shared.
+    template <class F>
+    void forEach(size_t firstColumn, size_t count, int64_t from, F f) const {
+        auto chunk = std::partition_point(chunks.begin(), chunks.end(), [&](const Chunk& c) {
+            return c.lastTime < from;
+        });
+        for (; chunk != chunks.end(); ++chunk) {
+            size_t n = chunk->count;
+            decodedTimes.resize(n);
+            decodedValues.resize(n * count);
+            BitReader times(chunk->words.data(), chunk->starts[0]);
+            getTimes(times, chunk->firstTime, decodedTimes.data(), n);
+            for (size_t c = 0; c < count; c++) {
+                BitReader values(chunk->words.data(), chunk->starts[1 + firstColumn + c]);
+                getValues(values, &decodedValues[c], count, n);
+            }
+            for (size_t i = 0; i < n; i++) {
+                if (decodedTimes[i] >= from) f(decodedTimes[i], &decodedValues[i * count]);
+            }
+        }
+        for (size_t i = 0; i < openTimes.size(); i++) {
+            if (openTimes[i] >= from) f(openTimes[i], &openValues[i * columns + firstColumn]);
+        }
+    }
+};
@@ -0,0 +1,156 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "./fileutil.hpp"
+#include "./procsnapshot.hpp"
+
+// The /proc/stat columns we keep, guest time is already included in user and nice.
+enum CpuState { CpuUser, CpuNice, CpuSystem, CpuIdle, CpuIoWait, CpuIrq, CpuSoftIrq, CpuSteal, CpuStateCount };
+
+const char* cpuStateName(int state) {
+    static const char* names[] = {"user", "nice", "system", "idle", "iowait", "irq", "softirq", "steal"};
+    return names[state];
+}
+
+// Percentages of the last interval. Index 0 is the aggregate "cpu" line, index 1 + i is cpu<i>.
+struct CpuUsage {
+    size_t slots = 0; // cores + 1
+    std::vector<float> busy;         // [slot], 100 - idle - iowait
+    std::vector<float> statePercent; // [state * slots + slot]
+
+    size_t getCoreCount() const { return slots > 0 ? slots - 1 : 0; }
+    float getState(int state, size_t slot) const { return statePercent[state * slots + slot]; }
+};
+
+// Fills usage (sized for slots) from two jiffies samples laid out [state * slots + slot], total is scratch.
+void computeCpuUsage(
+    const uint64_t* current, const uint64_t* last, size_t slots, std::vector<float>& total, CpuUsage& usage
+) {
+    const size_t n = slots;
+    total.assign(n, 0.0f);
+    for (int s = 0; s < CpuStateCount; s++) {
+        const uint64_t* cur = &current[s * n];
+        const uint64_t* prev = &last[s * n];
+        float* pct = &usage.statePercent[s * n];
+        for (size_t i = 0; i < n; i++) {
+            // counters can go backwards for a hotplugged cpu, treat that as no time
+            float d = cur[i] > prev[i] ? float(cur[i] - prev[i]) : 0.0f;
+            pct[i] = d;
+            total[i] += d;
+        }
+    }
+    for (size_t i = 0; i < n; i++) total[i] = total[i] > 0 ? 100.0f / total[i] : 0.0f;
+    for (int s = 0; s < CpuStateCount; s++) {
+        float* pct = &usage.statePercent[s * n];
+        for (size_t i = 0; i < n; i++) pct[i] *= total[i];
+    }
+    const float* idle = &usage.statePercent[CpuIdle * n];
+    const float* iowait = &usage.statePercent[CpuIoWait * n];
+    for (size_t i = 0; i < n; i++) {
+        usage.busy[i] = total[i] > 0 ? std::clamp(100.0f - idle[i] - iowait[i], 0.0f, 100.0f) : 0.0f;
+    }
+}
+
+// Per core CPU collector, jiffies are kept as 64 bit counters in flat arrays (one row per state)
+// so the delta and percentage math is a handful of straight loops over all cores at once.
+class CpuStats {
+private:
+    ProcSnapshot::File stat;
+    size_t slots = 0;
+    std::vector<uint64_t> current; // [state * slots + slot]
+    std::vector<uint64_t> last;
+    std::vector<float> total; // [slot] scratch
+    CpuUsage usage;
+    bool hasLast = false;
+
+    void resize(size_t newSlots) {
+        slots = newSlots;
+        current.assign(CpuStateCount * slots, 0);
+        last.assign(CpuStateCount * slots, 0);
+        total.assign(slots, 0);
+        usage.slots = slots;
+        usage.busy.assign(slots, 0);
+        usage.statePercent.assign(CpuStateCount * slots, 0);
+        hasLast = false;
+    }
+
+    // Returns false if a cpu appeared that does not fit the current arrays.
+    bool parse(std::string_view file) {
+        std::fill(current.begin(), current.end(), 0);
+        size_t lineStart = 0;
+        bool seenCpu = false;
+        while (lineStart < file.size()) {
+            size_t lineEnd = file.find('\n', lineStart);
+            if (lineEnd == std::string_view::npos) lineEnd = file.size();
+            std::string_view line = file.substr(lineStart, lineEnd - lineStart);
+            lineStart = lineEnd + 1;
+
+            if (line.substr(0, 3) != "cpu") {
+                // the cpu lines are all at the start of the file, skip the rest (intr alone can be huge)
+                if (seenCpu) break;
+                continue;
+            }
+            seenCpu = true;
+            size_t pos = 0;
+            std::string_view name = nextToken(line, pos);
+            size_t slot = 0;
+            if (name.size() > 3) {
+                if (!parseNumber(name.substr(3), slot)) continue;
+                slot += 1;
+            }
+            if (slot >= slots) return false;
+            for (int s = 0; s < CpuStateCount; s++) {
+                uint64_t v = 0;
+                if (!parseNumber(nextToken(line, pos), v)) break;
+                current[s * slots + slot] = v;
+            }
+        }
+        return true;
+    }
+
+    size_t countSlots(std::string_view file) {
+        size_t maxSlot = 0;
+        size_t pos = 0;
+        while ((pos = file.find("\ncpu", pos)) != std::string_view::npos) {
+            pos += 4;
+            size_t end = pos;
+            while (end < file.size() && file[end] >= '0' && file[end] <= '9') end++;
+            size_t cpu = 0;
+            if (end > pos && parseNumber(file.substr(pos, end - pos), cpu)) maxSlot = std::max(maxSlot, cpu + 1);
+        }
+        return maxSlot + 1;
+    }
+
+    void computeDeltas() { computeCpuUsage(current.data(), last.data(), slots, total, usage); }
+
+public:
+    CpuStats(ProcSnapshot& snapshot = sharedProcSnapshot(), std::string procStat = "/proc/stat") :
+        stat(snapshot.subscribe(procStat)) {}
+
+    // Reads /proc/stat (or reuses this interval's snapshot of it), returns false if it could not be read.
+    bool sample() {
+        bool ok = stat.with([&](std::string_view file) {
+            if (file.empty()) return false;
+            if (slots == 0 || !parse(file)) {
+                resize(countSlots(file));
+                parse(file);
+            }
+            return true;
+        });
+        if (!ok) return false;
+        if (hasLast) computeDeltas();
+        std::swap(current, last);
+        hasLast = true;
+        return true;
+    }
+
+    // Usage over the interval between the last two sample() calls.
+    const CpuUsage& getUsage() const { return usage; }
+
+    // Raw jiffies of the last sample() (slot 0 is the aggregate), 0 before the first one.
+    size_t getSlots() const { return hasLast ? slots : 0; }
+    uint64_t getJiffies(int state, size_t slot) const { return last[state * slots + slot]; }
+};
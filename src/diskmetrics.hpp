@@ -0,0 +1,132 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "./fileutil.hpp"
+
+// The fields of /sys/block/<dev>/stat, also found after "major minor name" in /proc/diskstats.
+// See Documentation/admin-guide/iostats.rst, sectors are always 512 bytes.
+struct DiskCounters {
+    uint64_t readIos = 0;
+    uint64_t readMerges = 0;
+    uint64_t readSectors = 0;
+    uint64_t readTicks = 0; // ms
+    uint64_t writeIos = 0;
+    uint64_t writeMerges = 0;
+    uint64_t writeSectors = 0;
+    uint64_t writeTicks = 0;
+    uint64_t inFlight = 0;
+    uint64_t ioTicks = 0;     // ms the device had I/O in flight
+    uint64_t timeInQueue = 0; // ms, weighted by the number of requests
+    uint64_t discardIos = 0;
+    uint64_t discardMerges = 0;
+    uint64_t discardSectors = 0;
+    uint64_t discardTicks = 0;
+    uint64_t flushIos = 0;
+    uint64_t flushTicks = 0;
+    uint8_t fieldCount = 0; // 11 before 4.18, 15 with discards, 17 with flushes (5.5+)
+};
+
+// Parses the whitespace separated counters at the start of fields, returns false if fewer than 11 are present.
+bool parseDiskCounters(std::string_view fields, DiskCounters& out) {
+    uint64_t* dst[] = {
+        &out.readIos,        &out.readMerges,    &out.readSectors,    &out.readTicks,    &out.writeIos,
+        &out.writeMerges,    &out.writeSectors,  &out.writeTicks,     &out.inFlight,     &out.ioTicks,
+        &out.timeInQueue,    &out.discardIos,    &out.discardMerges,  &out.discardSectors, &out.discardTicks,
+        &out.flushIos,       &out.flushTicks,
+    };
+    size_t pos = 0;
+    out.fieldCount = 0;
+    for (uint64_t* d : dst) {
+        std::string_view tok = nextToken(fields, pos);
+        if (!parseNumber(tok, *d)) break;
+        out.fieldCount++;
+    }
+    return out.fieldCount >= 11;
+}
+
+// iostat -x style metrics derived from two DiskCounters samples.
+struct DiskMetrics {
+    double readMBps = 0;
+    double writeMBps = 0;
+    double readIops = 0;
+    double writeIops = 0;
+    double readRequestKB = 0; // average request size
+    double writeRequestKB = 0;
+    double readAwaitMs = 0;
+    double writeAwaitMs = 0;
+    double inFlight = 0;      // requests in flight at the time of the sample
+    double avgQueueDepth = 0; // aqu-sz
+    double utilPercent = 0;
+    double discardIops = 0;
+    double discardMBps = 0;
+    double flushIops = 0;
+    double flushAwaitMs = 0;
+    bool hasDiscard = false;
+    bool hasFlush = false;
+};
+
+// False when the I/O and sector counters went backwards: the device was removed and created again under the same
+// name, or the counters of a recording were reset. Such a sample has no rates. The ticks are not checked, they
+// are 32 bit in /proc/diskstats and wrap on their own.
+bool diskCountersAdvanced(const DiskCounters& cur, const DiskCounters& last) {
+    return cur.readIos >= last.readIos && cur.writeIos >= last.writeIos && cur.readSectors >= last.readSectors &&
+           cur.writeSectors >= last.writeSectors && cur.discardIos >= last.discardIos &&
+           cur.discardSectors >= last.discardSectors && cur.flushIos >= last.flushIos;
+}
+
+// The kernel prints the read, write, discard and flush ticks, io_ticks and time_in_queue with %u: they wrap at
+// 2^32 ms, time_in_queue of a busy disk within days.
+inline double tickDelta(uint64_t cur, uint64_t last) { return uint32_t(cur - last); }
+
+// Rates are 0 unless diskCountersAdvanced(), callers should drop such a sample.
+DiskMetrics computeDiskMetrics(const DiskCounters& cur, const DiskCounters& last, double seconds) {
+    DiskMetrics m;
+    m.inFlight = cur.inFlight;
+    m.hasDiscard = cur.fieldCount >= 15;
+    m.hasFlush = cur.fieldCount >= 17;
+    if (seconds <= 0 || !diskCountersAdvanced(cur, last)) return m;
+
+    double ms = seconds * 1000.0;
+    double readIos = cur.readIos - last.readIos;
+    double writeIos = cur.writeIos - last.writeIos;
+    double readBytes = (cur.readSectors - last.readSectors) * 512.0;
+    double writeBytes = (cur.writeSectors - last.writeSectors) * 512.0;
+
+    m.readMBps = readBytes / 1000000.0 / seconds;
+    m.writeMBps = writeBytes / 1000000.0 / seconds;
+    m.readIops = readIos / seconds;
+    m.writeIops = writeIos / seconds;
+    if (readIos > 0) {
+        m.readRequestKB = readBytes / 1024.0 / readIos;
+        m.readAwaitMs = tickDelta(cur.readTicks, last.readTicks) / readIos;
+    }
+    if (writeIos > 0) {
+        m.writeRequestKB = writeBytes / 1024.0 / writeIos;
+        m.writeAwaitMs = tickDelta(cur.writeTicks, last.writeTicks) / writeIos;
+    }
+    m.avgQueueDepth = tickDelta(cur.timeInQueue, last.timeInQueue) / ms;
+    m.utilPercent = std::min(100.0, tickDelta(cur.ioTicks, last.ioTicks) / ms * 100.0);
+
+    if (m.hasDiscard) {
+        m.discardIops = (cur.discardIos - last.discardIos) / seconds;
+        m.discardMBps = (cur.discardSectors - last.discardSectors) * 512.0 / 1000000.0 / seconds;
+    }
+    if (m.hasFlush) {
+        double flushIos = cur.flushIos - last.flushIos;
+        m.flushIops = flushIos / seconds;
+        if (flushIos > 0) m.flushAwaitMs = tickDelta(cur.flushTicks, last.flushTicks) / flushIos;
+    }
+    return m;
+}
+
+// True for collectors that expose per device DiskMetrics next to getRate().
+template <class T, class = void>
+struct hasDiskMetrics : std::false_type {};
+template <class T>
+struct hasDiskMetrics<T, std::void_t<decltype(std::declval<T&>().getMetrics())>> :
+    std::is_same<std::decay_t<decltype(std::declval<T&>().getMetrics())>, std::map<std::string, DiskMetrics>> {};
@@ -1,85 +1,60 @@
 
 #pragma once
-void printMap(const std::map<std::string, std::pair<double, double>>& myMap) {
-    for (const auto& entry : myMap) {
-        std::cout << entry.first << ": (" << entry.second.first << ", " << entry.second.second << ")" << std::endl;
-    }
-}
-
-std::string readfile(std::string path) {
-    std::ifstream t(path);
-    std::stringstream buffer;
-    buffer << t.rdbuf();
-    return buffer.str();
-}
+#include <chrono>
+#include <estd/string_util.h>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
-std::vector<std::string> getPaths(std::string path) {
-    std::set<std::string> resultset;
-    std::vector<std::string> result;
-    for (const auto& entry : fs::directory_iterator(path)) resultset.insert(entry.path());
-    for (const auto& entry : resultset) result.push_back(entry);
-    return result;
-}
+#include "./blockdevices.hpp"
+#include "./diskmetrics.hpp"
+#include "./fileutil.hpp"
 
 class DiskStats {
 private:
-    uint64_t getSectorSize(std::string dev) {
-        std::string s = readfile("/sys/block/" + dev + "/queue/hw_sector_size");
-        return stoll(s);
-    }
+    BlockDeviceRegistry registry;
 
-    std::vector<std::string> getDevices() {
-        std::vector<std::string> devices = getPaths("/sys/block/");
-        std::vector<std::string> result;
-        for (auto d : devices) {
-            if (!contains(d, "loop", true) && !contains(d, "zram", true) && !contains(d, "dm", true)) {
-                auto sd = splitAll(d, "/");
-                result.push_back(sd.at(sd.size() - 1)); //will throw this way vs back or operator[]
-            }
-        }
-        return result;
+    DiskCounters getDevStats(const BlockDevice& dev) {
+        std::string f = readfile(registry.getSysBlockPath() + dev.dir + "/stat");
+        DiskCounters c;
+        if (!parseDiskCounters(f, c)) throw std::runtime_error("filestats invalid " + std::to_string(c.fieldCount));
+        return c;
     }
 
-    std::pair<uint64_t, uint64_t> getDevStats(std::string dev) {
-        // Field 3 -- # of sectors read
-        // Field 7 -- # of sectors written
-
-        std::string f = readfile("/sys/block/" + dev + "/stat");
-        auto tok = splitAll(f, " ", false);
-        if (tok.size() < 17) throw std::runtime_error("filestats invalid " + std::to_string(tok.size()));
-        uint64_t sectorSize = getSectorSize(dev);
-        return {stoll(tok[2]) * sectorSize, stoll(tok[6]) * sectorSize};
-    }
+    std::map<std::string, DiskCounters> lastCounters;
+    std::map<std::string, DiskMetrics> metrics;
 
 public:
-    uint64_t lastTime = 0;
-    std::map<std::string, std::pair<uint64_t, uint64_t>> lastBytes;
+    // root is prepended to /sys/block, for fixture trees in benchmarks.
+    DiskStats(std::string root = "") : registry(root + "/sys/block/") {}
+
+    std::chrono::steady_clock::time_point lastTime;
+    bool hasLast = false;
     std::map<std::string, std::pair<double, double>> getRate() {
-        auto millisec_since_epoch =
-            std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch())
-                .count();
+        auto now = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(now - lastTime).count();
 
-        std::map<std::string, std::pair<uint64_t, uint64_t>> currentBytes;
         std::map<std::string, std::pair<double, double>> mbps;
-        auto devs = getDevices();
-        for (auto& dev : devs) {
-            auto stat = getDevStats(dev);
-            currentBytes[dev] = stat;
+        std::map<std::string, DiskCounters> currentCounters;
+        for (auto& dev : registry.getDevices()) {
+            if (dev.isWholeDisk()) currentCounters[dev.name] = getDevStats(dev);
         }
-        for (auto& [k, v] : currentBytes) {
-            if (lastBytes.count(k))
-                mbps[k] = {
-                    (v.first - lastBytes[k].first) / 1000000.0 * 1000.0 / (millisec_since_epoch - lastTime),
-                    (v.second - lastBytes[k].second) / 1000000.0 * 1000.0 / (millisec_since_epoch - lastTime),
-                };
+        metrics.clear();
+        for (auto& [k, c] : currentCounters) {
+            auto last = lastCounters.find(k);
+            // counters that went backwards were reset, there is no rate until the next sample
+            if (last == lastCounters.end() || seconds <= 0 || !diskCountersAdvanced(c, last->second)) continue;
+            DiskMetrics& m = metrics[k] = computeDiskMetrics(c, last->second, seconds);
+            mbps[k] = {m.readMBps, m.writeMBps}; // sectors are 512 bytes whatever the hardware sector size
         }
-        lastBytes = currentBytes;
+        lastCounters = currentCounters;
 
-        if (lastTime != 0) {
-            lastTime = millisec_since_epoch;
-            return mbps;
-        }
-        lastTime = millisec_since_epoch;
+        lastTime = now;
+        if (hasLast) return mbps;
+        hasLast = true;
         return {};
     }
+
+    const std::map<std::string, DiskMetrics>& getMetrics() const { return metrics; }
 };
\ No newline at end of file
@@ -0,0 +1,106 @@
+#pragma once
+#include <algorithm>
+#include <charconv>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <vector>
+
+void printMap(const std::map<std::string, std::pair<double, double>>& myMap) {
+    for (const auto& entry : myMap) {
+        std::cout << entry.first << ": (" << entry.second.first << ", " << entry.second.second << ")" << std::endl;
+    }
+}
+
+std::string readfile(std::string path) {
+    std::ifstream t(path);
+    std::stringstream buffer;
+    buffer << t.rdbuf();
+    return buffer.str();
+}
+
+std::vector<std::string> getPaths(std::string path) {
+    std::set<std::string> resultset;
+    std::vector<std::string> result;
+    for (const auto& entry : std::filesystem::directory_iterator(path)) resultset.insert(entry.path());
+    for (const auto& entry : resultset) result.push_back(entry);
+    return result;
+}
+
+// Raises the soft fd limit to the hard one, at most 1 << 20, so collectors can keep their files open. Meant to be
+// called once at startup, child processes inherit the raised limit.
+void raiseOpenFileLimit() {
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur >= limit.rlim_max) return;
+    limit.rlim_cur = std::min<rlim_t>(limit.rlim_max, 1 << 20);
+    setrlimit(RLIMIT_NOFILE, &limit);
+}
+
+// Half of the current soft fd limit, what a collector may keep open for cached files. Collectors that share the
+// process take a share of it.
+size_t openFileBudget() {
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) return 0;
+    return limit.rlim_cur > 512 ? (limit.rlim_cur - 256) / 2 : 0;
+}
+
+// Reads the next whitespace separated token from line starting at pos, advances pos past it.
+std::string_view nextToken(std::string_view line, size_t& pos) {
+    auto isSpace = [](char c) { return c == ' ' || c == '\t' || c == '\n'; };
+    while (pos < line.size() && isSpace(line[pos])) pos++;
+    size_t start = pos;
+    while (pos < line.size() && !isSpace(line[pos])) pos++;
+    return line.substr(start, pos - start);
+}
+
+template <class T>
+bool parseNumber(std::string_view tok, T& out) {
+    auto res = std::from_chars(tok.data(), tok.data() + tok.size(), out);
+    return res.ec == std::errc() && res.ptr == tok.data() + tok.size();
+}
+
+// Keeps a procfs/sysfs file open and rereads it into the same buffer, procfs files must be read from offset 0 every time.
+class ReusedFileReader {
+private:
+    std::string path;
+    int fd = -1;
+    std::vector<char> buffer = std::vector<char>(16384);
+    size_t length = 0;
+
+public:
+    ReusedFileReader(std::string path) : path(path) {}
+    ReusedFileReader(const ReusedFileReader&) = delete;
+    ReusedFileReader& operator=(const ReusedFileReader&) = delete;
+    ~ReusedFileReader() {
+        if (fd >= 0) close(fd);
+    }
+
+    // Returns an empty view if the file can not be read, the view stays valid until the next read().
+    std::string_view read() {
+        length = 0;
+        if (fd < 0) fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return {};
+        while (true) {
+            if (length == buffer.size()) buffer.resize(buffer.size() * 2);
+            ssize_t r = pread(fd, buffer.data() + length, buffer.size() - length, length);
+            if (r < 0) {
+                close(fd);
+                fd = -1;
+                return {};
+            }
+            if (r == 0) break;
+            length += r;
+        }
+        return std::string_view(buffer.data(), length);
+    }
+
+    const std::string& getPath() const { return path; }
+};
@@ -0,0 +1,189 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <limits>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "./sampler.hpp"
+
+struct Envelope {
+    double min = 0;
+    double mean = 0;
+    double max = 0;
+};
+
+// What the sampler thread itself cost over the last display interval.
+struct SamplerCost {
+    uint64_t samples = 0;
+    uint64_t late = 0;         // samples that started after their deadline
+    double cpuFraction = 0;    // sampler thread CPU time / wall time
+    double nsPerSample = 0;    // sampler thread CPU time per sample
+    std::chrono::nanoseconds interval{0};
+};
+
+struct EnvelopeFrame {
+    std::map<std::string, std::pair<Envelope, Envelope>> envelopes;
+    SamplerCost cost;
+};
+
+// Samples STAT_TYPE::getRate() every 1-10 ms on a dedicated thread and reduces the samples of every
+// display interval to min/mean/max envelopes, so bursts shorter than a display tick stay visible.
+template <class STAT_TYPE>
+class HighFrequencySampler {
+private:
+    using Rates = std::map<std::string, std::pair<double, double>>;
+
+    struct Accumulator {
+        double min = std::numeric_limits<double>::infinity();
+        double max = -std::numeric_limits<double>::infinity();
+        double sum = 0;
+        uint32_t count = 0;
+
+        void add(double v) {
+            min = std::min(min, v);
+            max = std::max(max, v);
+            sum += v;
+            count++;
+        }
+        Envelope get() const {
+            if (count == 0) return {};
+            return {min, sum / count, max};
+        }
+    };
+
+    STAT_TYPE stats; // only touched by the sampler thread
+    OverheadStage& stage = monitorOverhead().stage("collect: " + typeName<STAT_TYPE>() + " (high frequency)");
+    std::chrono::nanoseconds interval;
+    std::chrono::nanoseconds displayInterval;
+
+    // sorted like the rate map so a sample is accumulated with one merge walk and no lookups
+    std::vector<std::pair<std::string, std::pair<Accumulator, Accumulator>>> acc;
+    uint64_t samples = 0;
+    uint64_t late = 0;
+
+    SpscRing<SampleFrame<EnvelopeFrame>, 8> ring;
+    std::thread worker;
+    std::atomic<bool> stopping{false};
+
+    SampleFrame<EnvelopeFrame> latest;
+    Rates means;
+
+    static int64_t threadCpuNs() {
+        timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+    void accumulate(const Rates& rates) {
+        bool same = rates.size() == acc.size();
+        if (same) {
+            size_t i = 0;
+            for (auto& [name, rate] : rates) {
+                if (acc[i].first != name) {
+                    same = false;
+                    break;
+                }
+                acc[i].second.first.add(rate.first);
+                acc[i].second.second.add(rate.second);
+                i++;
+            }
+        }
+        if (same) return;
+
+        // device set changed, start over for this display interval
+        acc.clear();
+        for (auto& [name, rate] : rates) {
+            acc.push_back({name, {}});
+            acc.back().second.first.add(rate.first);
+            acc.back().second.second.add(rate.second);
+        }
+    }
+
+    void publish(std::chrono::nanoseconds wall, int64_t cpuNs) {
+        SampleFrame<EnvelopeFrame> frame;
+        frame.time = std::chrono::steady_clock::now();
+        for (auto& [name, a] : acc) {
+            frame.data.envelopes[name] = {a.first.get(), a.second.get()};
+            a = {};
+        }
+        frame.data.cost.samples = samples;
+        frame.data.cost.late = late;
+        frame.data.cost.interval = interval;
+        frame.data.cost.cpuFraction = wall.count() > 0 ? double(cpuNs) / wall.count() : 0;
+        frame.data.cost.nsPerSample = samples > 0 ? double(cpuNs) / samples : 0;
+        ring.tryPush(std::move(frame));
+        samples = 0;
+        late = 0;
+    }
+
+    void run() {
+        auto now = std::chrono::steady_clock::now();
+        auto next = now;
+        auto windowStart = now;
+        int64_t cpuStart = threadCpuNs();
+
+        while (!stopping.load(std::memory_order_relaxed)) {
+            try {
+                OverheadScope scope(stage);
+                accumulate(stats.getRate());
+            } catch (...) {}
+            samples++;
+
+            now = std::chrono::steady_clock::now();
+            if (now - windowStart >= displayInterval) {
+                int64_t cpuNow = threadCpuNs();
+                publish(now - windowStart, cpuNow - cpuStart);
+                windowStart = now;
+                cpuStart = cpuNow;
+            }
+
+            next += interval;
+            if (now > next) {
+                late++;
+                next = now;
+            }
+            std::this_thread::sleep_until(next);
+        }
+    }
+
+public:
+    HighFrequencySampler(
+        std::chrono::nanoseconds interval = std::chrono::milliseconds(1),
+        std::chrono::nanoseconds displayInterval = std::chrono::milliseconds(250)
+    ) :
+        interval(std::clamp<std::chrono::nanoseconds>(interval, std::chrono::milliseconds(1), std::chrono::milliseconds(10))),
+        displayInterval(displayInterval) {
+        worker = std::thread([this] { run(); });
+    }
+    HighFrequencySampler(const HighFrequencySampler&) = delete;
+    HighFrequencySampler& operator=(const HighFrequencySampler&) = delete;
+    ~HighFrequencySampler() {
+        stopping = true;
+        if (worker.joinable()) worker.join();
+    }
+
+    // Mean rate of every device over the last display interval, keeps the STAT_TYPE interface.
+    const Rates& getRate() {
+        SampleFrame<EnvelopeFrame> frame;
+        bool updated = false;
+        while (ring.tryPop(frame)) {
+            latest = std::move(frame);
+            updated = true;
+        }
+        if (updated) {
+            means.clear();
+            for (auto& [name, e] : latest.data.envelopes) means[name] = {e.first.mean, e.second.mean};
+        }
+        return means;
+    }
+
+    // Envelopes matching the last getRate() call.
+    const std::map<std::string, std::pair<Envelope, Envelope>>& getEnvelopes() const { return latest.data.envelopes; }
+
+    const SamplerCost& getCost() const { return latest.data.cost; }
+};
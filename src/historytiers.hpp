@@ -0,0 +1,124 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "./compressedseries.hpp"
+
+// One retention level: samples are kept in buckets of bucketMs for retentionMs.
+// For the first (raw) tier bucketMs is only the expected sampling interval, used to size it.
+struct HistoryTier {
+    int64_t bucketMs;
+    int64_t retentionMs;
+};
+
+std::vector<HistoryTier> defaultHistoryTiers() {
+    return {
+        {250, 10 * 60 * 1000},                  // raw samples for 10 minutes
+        {1000, 24 * 60 * 60 * 1000},            // 1 s buckets for a day
+        {10 * 1000, 24 * 60 * 60 * 1000},       // 10 s buckets for a day, for hour long windows
+        {60 * 1000, 30LL * 24 * 60 * 60 * 1000} // 1 min buckets for 30 days
+    };
+}
+
+// Mantissa bits the history keeps, within 0.05% of every value and far below a chart pixel.
+constexpr unsigned historyMantissaBits = 10;
+
+// Raw samples plus coarser tiers that are rolled up as samples arrive. Every bucket keeps the min, mean and
+// max of each column so short spikes are still visible in the coarse tiers. The tiers are CompressedSeries,
+// which keeps a day of 1 s buckets for every device affordable.
+class TieredHistory {
+private:
+    struct Tier {
+        HistoryTier spec;
+        CompressedSeries buffer; // raw tier: one column per column, else [column * 3 + 0/1/2] = min, mean, max
+        int64_t bucketStart = std::numeric_limits<int64_t>::min();
+        size_t samples = 0;
+        std::vector<double> pending; // same layout as a buffer row, mean holds the running sum
+
+        Tier(HistoryTier spec, size_t width) :
+            spec(spec), buffer(spec.retentionMs / std::max<int64_t>(spec.bucketMs, 1), width, historyMantissaBits),
+            pending(width) {}
+    };
+
+    size_t columns;
+    std::vector<Tier> tiers;
+    std::vector<double> row; // scratch
+
+    void flush(Tier& tier) {
+        row = tier.pending;
+        for (size_t c = 0; c < columns; c++) row[c * 3 + 1] /= tier.samples;
+        tier.buffer.append(tier.bucketStart, row);
+        tier.samples = 0;
+    }
+
+public:
+    TieredHistory(size_t columns, std::vector<HistoryTier> specs = defaultHistoryTiers()) :
+        columns(columns), row(columns * 3) {
+        // raw samples are their own min, mean and max, only rolled up tiers store all three
+        for (size_t t = 0; t < specs.size(); t++) tiers.emplace_back(specs[t], t == 0 ? columns : columns * 3);
+    }
+
+    // values must hold one entry per column, times have to increase.
+    void append(int64_t time, const double* values) {
+        tiers[0].buffer.append(time, values);
+
+        for (size_t t = 1; t < tiers.size(); t++) {
+            Tier& tier = tiers[t];
+            int64_t bucket = time - time % tier.spec.bucketMs;
+            if (bucket != tier.bucketStart && tier.samples > 0) flush(tier);
+            tier.bucketStart = bucket;
+            double* p = tier.pending.data();
+            for (size_t c = 0; c < columns; c++) {
+                double v = values[c];
+                if (tier.samples == 0) {
+                    p[c * 3] = p[c * 3 + 2] = v;
+                    p[c * 3 + 1] = 0;
+                }
+                p[c * 3] = std::min(p[c * 3], v);
+                p[c * 3 + 1] += v;
+                p[c * 3 + 2] = std::max(p[c * 3 + 2], v);
+            }
+            tier.samples++;
+        }
+    }
+
+    void append(int64_t time, const std::vector<double>& values) { append(time, values.data()); }
+
+    // The finest tier that still covers spanMs and needs at most maxPoints points for it, else the coarsest.
+    size_t selectTier(int64_t spanMs, size_t maxPoints) const {
+        for (size_t t = 0; t < tiers.size(); t++) {
+            const HistoryTier& spec = tiers[t].spec;
+            if (spec.retentionMs >= spanMs && size_t(spanMs / std::max<int64_t>(spec.bucketMs, 1)) <= maxPoints) return t;
+        }
+        return tiers.size() - 1;
+    }
+
+    // Calls f(time, min, mean, max) for every bucket of a tier at or after from, oldest first. The bucket that
+    // is still being filled comes last so the newest samples show up in every tier. Only the compressed chunks
+    // that reach from are decoded.
+    template <class F>
+    void forEach(size_t tierIndex, size_t column, int64_t from, F f) const {
+        const Tier& tier = tiers[tierIndex];
+        if (tierIndex == 0) {
+            tier.buffer.forEach(column, 1, from, [&](int64_t time, const double* v) { f(time, v[0], v[0], v[0]); });
+            return;
+        }
+        tier.buffer.forEach(column * 3, 3, from, [&](int64_t time, const double* v) { f(time, v[0], v[1], v[2]); });
+        if (tier.samples > 0 && tier.bucketStart >= from) {
+            const double* p = tier.pending.data();
+            f(tier.bucketStart, p[column * 3], p[column * 3 + 1] / tier.samples, p[column * 3 + 2]);
+        }
+    }
+
+    size_t getColumns() const { return columns; }
+    size_t getTierCount() const { return tiers.size(); }
+    const HistoryTier& getTier(size_t i) const { return tiers[i].spec; }
+
+    size_t getMemoryBytes() const {
+        size_t bytes = sizeof(*this);
+        for (auto& tier : tiers) bytes += tier.buffer.getMemoryBytes() + tier.pending.capacity() * sizeof(double);
+        return bytes;
+    }
+};
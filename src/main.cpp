@@ -2,6 +2,7 @@
 #include <QApplication>
 #include <QChartView>
 #include <QColorDialog>
+#include <QCommandLineParser>
 #include <QGridLayout>
 #include <QLineSeries>
 #include <QMainWindow>
@@ -30,61 +31,291 @@ using namespace estd::shortnames;
 using namespace estd::string_util;
 
 
+#include "./alertrules.hpp"
+#include "./cgroupstats.hpp"
+#include "./DiskTopologyWidget.hpp"
 #include "./DiskUsageWidget.hpp"
+#include "./hfsampler.hpp"
+#include "./metricsexporter.hpp"
 #include "./SystemThemedChart.hpp"
 #include "./systemstats.hpp"
+#include "./netlinkstats.hpp"
+#include "./OverheadWidget.hpp"
+#include "./ProcessIoWidget.hpp"
 #include "./networkstats.hpp"
+#include "./procdiskstats.hpp"
+#include "./renderbench.hpp"
+#include "./ReplayControls.hpp"
+#include "./sampler.hpp"
 #include "SystemOverviewWidgets.hpp"
 
 
 int main(int argc, char** argv) {
-    cptr<QApplication> app = new QApplication(argc, argv);
+    raiseOpenFileLimit(); // the process and cgroup collectors keep a file open per process and cgroup
+    cptr<InstrumentedApplication> app = new InstrumentedApplication(argc, argv);
     QMainWindow* mw = new QMainWindow();
 
     QTabWidget* tabWidget = new QTabWidget(mw);
 
     QLambdaTimer qlt(250);
 
-    DiskUsageWidget<DiskStats>* duw = new DiskUsageWidget<DiskStats>();
-    DiskUsageWidget<NetworkStats>* nuw = new DiskUsageWidget<NetworkStats>();
-    OverviewWidget* ovr = new OverviewWidget();
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption hfOption(
+        "hf-interval",
+        "Sample disk and network counters every <ms> (1-10) and chart min/mean/max envelopes.",
+        "ms"
+    );
+    parser.addOption(hfOption);
+    QCommandLineOption compactOption("compact", "Draw all device charts in one lightweight grid, for many disks.");
+    parser.addOption(compactOption);
+    QCommandLineOption renderBenchOption(
+        "render-bench", "Print frame times of both renderers at 10, 100 and 500 synthetic devices and exit."
+    );
+    parser.addOption(renderBenchOption);
+    QCommandLineOption historyDirOption(
+        "history-dir", "Keep disk and network history in <dir> so it survives restarts.", "dir", defaultHistoryDir()
+    );
+    parser.addOption(historyDirOption);
+    QCommandLineOption historySizeOption(
+        "history-mb", "Size of each history file in MB, 0 turns the history off (default 16).", "MB", "16"
+    );
+    parser.addOption(historySizeOption);
+    QCommandLineOption overheadReportOption(
+        "overhead-report", "Write what the monitor itself cost, per stage, to <file> on exit.", "file"
+    );
+    parser.addOption(overheadReportOption);
+    QCommandLineOption metricsListenOption(
+        "metrics-listen", "Serve the latest samples for Prometheus on http://<address>/metrics, e.g. 127.0.0.1:9101.",
+        "address"
+    );
+    parser.addOption(metricsListenOption);
+    QCommandLineOption recordOption(
+        "record", "Record the raw disk, network, CPU and memory counters to <file> while running.", "file"
+    );
+    parser.addOption(recordOption);
+    QCommandLineOption replayOption("replay", "Show a recording made with --record instead of this machine.", "file");
+    parser.addOption(replayOption);
+    QCommandLineOption replaySpeedOption(
+        "replay-speed", "Start the replay at <x> times real time (default 1).", "x", "1"
+    );
+    parser.addOption(replaySpeedOption);
+    QCommandLineOption cgroupDevicesOption(
+        "cgroup-devices", "Split the I/O of every cgroup by disk in the Containers tab (cgroup@disk)."
+    );
+    parser.addOption(cgroupDevicesOption);
+    QCommandLineOption alertRulesOption(
+        "alert-rules", "Evaluate the alert rules in <file> every tick, firing devices are marked and notified.", "file"
+    );
+    parser.addOption(alertRulesOption);
+    parser.process(QCoreApplication::arguments());
+    int hfIntervalMs = parser.value(hfOption).toInt();
+    bool compact = parser.isSet(compactOption);
+
+    if (parser.isSet(renderBenchOption)) {
+        runRenderBench(std::cout);
+        return 0;
+    }
+
+    // like the widgets these live until exit, the replay collectors read the recording from their threads
+    Recording* recording = nullptr;
+    ReplayClock* replayClock = nullptr;
+    if (parser.isSet(replayOption)) {
+        recording = new Recording();
+        if (!recording->open(parser.value(replayOption).toStdString()) || recording->getFrameCount() == 0) {
+            std::string error = recording->getError();
+            std::cerr << (error.empty() ? "the recording is empty" : error) << std::endl;
+            return 1;
+        }
+        replayClock = new ReplayClock(recording->getFirstTime(), parser.value(replaySpeedOption).toDouble());
+    }
+
+    // lives until exit, the disk and network widgets feed it every tick
+    AlertEngine* alerts = nullptr;
+    if (parser.isSet(alertRulesOption)) {
+        std::string path = parser.value(alertRulesOption).toStdString();
+        std::ifstream in(path);
+        if (!in) {
+            std::cerr << "cannot open " << path << std::endl;
+            return 1;
+        }
+        try {
+            alerts = new AlertEngine(parseAlertRules(in));
+        } catch (const std::exception& e) {
+            std::cerr << path << ": " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    QWidget* duw;
+    QWidget* nuw;
+    AsyncStats<ProcDiskStats>* diskStats = nullptr; // what the metrics endpoint renders from
+    AsyncStats<NetlinkNetworkStats>* netStats = nullptr;
+    if (recording) {
+        auto interval = std::chrono::milliseconds(250);
+        auto* disk = new DiskUsageWidget<AsyncStats<ReplayDiskStats>>(
+            nullptr, interval, nullptr, *recording, *replayClock
+        );
+        auto* net = new DiskUsageWidget<AsyncStats<ReplayNetworkStats>>(
+            nullptr, interval, nullptr, *recording, *replayClock
+        );
+        disk->setCompact(compact);
+        net->setCompact(compact);
+        disk->setAlerts(alerts, AlertFamily::Disk);
+        net->setAlerts(alerts, AlertFamily::Network);
+        disk->attachTo(qlt);
+        net->attachTo(qlt);
+        duw = disk;
+        nuw = net;
+    } else if (hfIntervalMs > 0) {
+        auto interval = std::chrono::milliseconds(hfIntervalMs);
+        auto* hfDisk = new DiskUsageWidget<HighFrequencySampler<ProcDiskStats>>(nullptr, interval);
+        auto* hfNet = new DiskUsageWidget<HighFrequencySampler<NetlinkNetworkStats>>(nullptr, interval);
+        hfDisk->setCompact(compact);
+        hfNet->setCompact(compact);
+        hfDisk->setAlerts(alerts, AlertFamily::Disk);
+        hfNet->setAlerts(alerts, AlertFamily::Network);
+        hfDisk->attachTo(qlt);
+        hfNet->attachTo(qlt);
+        duw = hfDisk;
+        nuw = hfNet;
+    } else {
+        // the rings are never unmapped, the sampler threads append to them until the process exits
+        std::string historyDir = parser.value(historyDirOption).toStdString();
+        uint64_t historyBytes = parser.value(historySizeOption).toULongLong() * 1024 * 1024;
+        auto* diskHistory = new MappedRing<MetricRecord>();
+        auto* netHistory = new MappedRing<MetricRecord>();
+        if (historyBytes > 0) {
+            bool diskOk = openHistoryRing(*diskHistory, historyDir, "disk", historyBytes);
+            bool netOk = openHistoryRing(*netHistory, historyDir, "network", historyBytes);
+            if (!diskOk || !netOk) {
+                std::cerr << "cannot map history files in " << historyDir << ", is another instance running?"
+                          << std::endl;
+            }
+        }
+        auto diskRecords = groupByName(*diskHistory);
+        auto netRecords = groupByName(*netHistory);
+
+        auto* disk = new DiskUsageWidget<AsyncStats<ProcDiskStats>>(nullptr, std::chrono::milliseconds(250), diskHistory);
+        auto* net = new DiskUsageWidget<AsyncStats<NetlinkNetworkStats>>(
+            nullptr, std::chrono::milliseconds(250), netHistory
+        );
+        disk->setHistory(std::move(diskRecords));
+        net->setHistory(std::move(netRecords));
+        disk->setCompact(compact);
+        net->setCompact(compact);
+        disk->setAlerts(alerts, AlertFamily::Disk);
+        net->setAlerts(alerts, AlertFamily::Network);
+        disk->attachTo(qlt);
+        net->attachTo(qlt);
+        duw = disk;
+        nuw = net;
+        diskStats = &disk->getStats();
+        netStats = &net->getStats();
+    }
+    std::function<SystemSample()> systemSource;
+    if (recording) {
+        auto* replay = new ReplaySystemStats(*recording, *replayClock);
+        systemSource = [replay]() { return replay->next(); };
+    }
+    OverviewWidget* ovr = new OverviewWidget(systemSource);
+
+    if (parser.isSet(recordOption) && !recording) {
+        auto* recorder = new CounterRecorder();
+        if (!recorder->start(parser.value(recordOption).toStdString())) std::cerr << recorder->getError() << std::endl;
+    }
+
+    // lives until exit like the widgets, the collectors render into its sections from their worker threads
+    if (parser.isSet(metricsListenOption) && !recording) {
+        auto* exporter = new MetricsExporter();
+        // the hf samplers keep no frames, these read the same shared procfs snapshot once a second
+        if (!diskStats) diskStats = new AsyncStats<ProcDiskStats>(std::chrono::milliseconds(1000));
+        if (!netStats) netStats = new AsyncStats<NetlinkNetworkStats>(std::chrono::milliseconds(1000));
+        diskStats->exportTo(exporter->addSection(), diskRateFamilies);
+        netStats->exportTo(exporter->addSection(), networkRateFamilies);
+        ovr->getStats().exportTo(exporter->addSection());
+        if (!exporter->start(parser.value(metricsListenOption).toStdString())) {
+            std::cerr << exporter->getError() << std::endl;
+        }
+    }
+
+    // per cgroup I/O once a second, cgroups only get a chart once they did I/O. Always the compact grid, container
+    // hosts have thousands of cgroups and a QtCharts view each would not do.
+    QWidget* containers = nullptr;
+    if (!recording && !cgroupRoot().empty()) {
+        CgroupView view = parser.isSet(cgroupDevicesOption) ? CgroupView::CgroupDevices : CgroupView::Cgroups;
+        auto* cgroups = new DiskUsageWidget<AsyncStats<CgroupStats>>(
+            nullptr, std::chrono::milliseconds(1000), nullptr, std::string(), view
+        );
+        cgroups->setCompact(true);
+        cgroups->attachTo(qlt);
+        containers = cgroups;
+    }
+
+    OverheadWidget* overhead = new OverheadWidget();
+
+    // topology and processes describe this machine as it is now, a recording has neither
+    DiskTopologyWidget* topology = recording ? nullptr : new DiskTopologyWidget();
+    ProcessIoWidget* processes = recording ? nullptr : new ProcessIoWidget();
 
     tabWidget->addTab(ovr, "Summary");
     tabWidget->addTab(duw, "Disk");
+    if (topology) tabWidget->addTab(topology, "Topology");
     tabWidget->addTab(nuw, "Network");
+    if (processes) tabWidget->addTab(processes, "Processes");
+    if (containers) tabWidget->addTab(containers, "Containers");
+    tabWidget->addTab(overhead, "Monitor overhead");
 
-    mw->setCentralWidget(tabWidget);
+    if (recording) {
+        QWidget* central = new QWidget(mw);
+        QVBoxLayout* layout = new QVBoxLayout(central);
+        ReplayControls* controls = new ReplayControls(*recording, *replayClock, central);
+        layout->addWidget(tabWidget);
+        layout->addWidget(controls);
+        controls->attachTo(qlt);
+        mw->setCentralWidget(central);
+    } else {
+        mw->setCentralWidget(tabWidget);
+    }
     mw->resize(600, 600);
 
     mw->show();
 
-    duw->attachTo(qlt);
-    nuw->attachTo(qlt);
     ovr->attachTo(qlt);
+    if (topology) topology->attachTo(qlt);
+    if (processes) processes->attachTo(qlt);
+    if (alerts) {
+        // transitions go to the status bar and stderr, rules that start firing also to a desktop notification
+        QSystemTrayIcon* tray = nullptr;
+        if (QSystemTrayIcon::isSystemTrayAvailable()) {
+            tray = new QSystemTrayIcon(mw->style()->standardIcon(QStyle::SP_MessageBoxWarning), mw);
+            tray->show();
+        }
+        qlt.addLambda([=]() {
+            std::vector<AlertEvent> events = alerts->takeEvents();
+            if (events.empty()) return;
+            QStringList fired;
+            for (const AlertEvent& e : events) {
+                std::string text = describeAlert(e);
+                std::cerr << text << std::endl;
+                if (e.firing) fired << QString::fromStdString(text);
+            }
+            mw->statusBar()->showMessage(QString::fromStdString(describeAlert(events.back())), 10000);
+            if (tray && !fired.isEmpty()) {
+                // one notification per tick however many rules fired
+                QString more = fired.size() > 1 ? QString(" and %1 more").arg(fired.size() - 1) : QString();
+                tray->showMessage("diskio alert", fired.front() + more, QSystemTrayIcon::Warning);
+            }
+        }, "alerts: notify");
+    }
     qlt.start();
 
     int code = app->exec();
+    if (parser.isSet(overheadReportOption)) {
+        std::ofstream report(parser.value(overheadReportOption).toStdString());
+        if (report) monitorOverhead().writeReport(report);
+        else
+            std::cerr << "cannot write " << parser.value(overheadReportOption).toStdString() << std::endl;
+    }
     return code;
 }
-
-
-
-// int main() {
-//     NetworkStats monitor;
-
-//     while (true) {
-//         try {
-//             // monitor.getRate();
-//             printMap(monitor.getRate());
-            
-//         }
-//         catch (const std::exception& e) {
-//             std::cerr << "Error: " << e.what() << std::endl;
-//             return 1;
-//         }
-
-//         std::this_thread::sleep_for(std::chrono::seconds(1));
-//     }
-
-//     return 0;
-// }
@@ -0,0 +1,425 @@
+#pragma once
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "./sampleframe.hpp"
+
+// Prometheus text exposition format 0.0.4, appended to a reused std::string so rendering a tick does not
+// allocate once the buffer has grown to its working size.
+void appendFamily(std::string& out, std::string_view name, std::string_view help, std::string_view type = "gauge") {
+    out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+    out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+void appendLabelValue(std::string& out, std::string_view value) {
+    for (char c : value) {
+        if (c == '\\' || c == '"') out.push_back('\\');
+        if (c == '\n') out.append("\\n");
+        else out.push_back(c);
+    }
+}
+
+// One sample, labels are (name, value) pairs, e.g. {{"device", "sda"}}.
+void appendSample(
+    std::string& out, std::string_view name, std::initializer_list<std::pair<std::string_view, std::string_view>> labels,
+    double value
+) {
+    out.append(name);
+    if (labels.size() > 0) {
+        out.push_back('{');
+        bool first = true;
+        for (auto& [label, labelValue] : labels) {
+            if (!first) out.push_back(',');
+            first = false;
+            out.append(label).append("=\"");
+            appendLabelValue(out, labelValue);
+            out.push_back('"');
+        }
+        out.push_back('}');
+    }
+    out.push_back(' ');
+    if (value != value) {
+        out.append("NaN");
+    } else {
+        char number[32];
+        out.append(number, std::to_chars(number, number + sizeof(number), value).ptr - number);
+    }
+    out.push_back('\n');
+}
+
+// Metric names of a frame's read and write rates and the label naming its devices.
+struct RateFamilies {
+    const char* read;
+    const char* readHelp;
+    const char* write;
+    const char* writeHelp;
+    const char* label;
+};
+
+const RateFamilies diskRateFamilies{
+    "diskio_disk_read_bytes_per_second", "Bytes read per second.", "diskio_disk_written_bytes_per_second",
+    "Bytes written per second.", "device"
+};
+const RateFamilies networkRateFamilies{
+    "diskio_network_receive_bytes_per_second", "Bytes received per second.", "diskio_network_transmit_bytes_per_second",
+    "Bytes sent per second.", "interface"
+};
+
+// The rates of every present device, plus the iostat style metrics for disk frames.
+template <class METRICS>
+void renderFrame(std::string& out, const RateFamilies& families, const DeviceFrame<METRICS>& frame) {
+    auto family = [&](const char* name, const char* help, auto value) {
+        appendFamily(out, name, help);
+        frame.forEachPresent([&](uint32_t id) { appendSample(out, name, {{families.label, frame.names[id]}}, value(id)); });
+    };
+    family(families.read, families.readHelp, [&](uint32_t id) { return frame.read[id] * 1e6; });
+    family(families.write, families.writeHelp, [&](uint32_t id) { return frame.write[id] * 1e6; });
+    if constexpr (std::is_same_v<METRICS, DiskMetrics>) {
+        const auto& m = frame.metrics;
+        family("diskio_disk_reads_per_second", "Completed read requests per second.", [&](uint32_t id) {
+            return m[id].readIops;
+        });
+        family("diskio_disk_writes_per_second", "Completed write requests per second.", [&](uint32_t id) {
+            return m[id].writeIops;
+        });
+        family("diskio_disk_read_await_seconds", "Average time a read request took, queueing included.", [&](uint32_t id) {
+            return m[id].readAwaitMs / 1000;
+        });
+        family("diskio_disk_write_await_seconds", "Average time a write request took, queueing included.", [&](uint32_t id) {
+            return m[id].writeAwaitMs / 1000;
+        });
+        family("diskio_disk_queue_depth", "Average number of requests queued or in flight.", [&](uint32_t id) {
+            return m[id].avgQueueDepth;
+        });
+        family("diskio_disk_in_flight", "Requests in flight when the sample was taken.", [&](uint32_t id) {
+            return m[id].inFlight;
+        });
+        family("diskio_disk_utilization_ratio", "Fraction of the time the device was busy.", [&](uint32_t id) {
+            return m[id].utilPercent / 100;
+        });
+    }
+}
+
+// One counter family over every device collector.forEachCounters() reports, value(counters) gives the sample.
+template <class COLLECTOR, class VALUE>
+void appendCounterFamily(
+    std::string& out, const COLLECTOR& collector, const char* label, const char* name, const char* help, VALUE value
+) {
+    appendFamily(out, name, help, "counter");
+    collector.forEachCounters([&](const std::string& device, const auto& c) {
+        appendSample(out, name, {{label, device}}, double(value(c)));
+    });
+}
+
+// The cumulative /proc/diskstats counters of a collector like ProcDiskStats. The rate gauges only cover the last
+// sample interval, rate() over these sees all the I/O between two scrapes. The times are 32 bit milliseconds in
+// the kernel and wrap, which rate() treats like a reset.
+template <class COLLECTOR>
+void renderDiskCounters(std::string& out, const COLLECTOR& disk) {
+    auto family = [&](const char* name, const char* help, auto value) {
+        appendCounterFamily(out, disk, diskRateFamilies.label, name, help, value);
+    };
+    family("diskio_disk_read_bytes_total", "Bytes read.", [](const auto& c) { return c.readSectors * 512; });
+    family("diskio_disk_written_bytes_total", "Bytes written.", [](const auto& c) { return c.writeSectors * 512; });
+    family("diskio_disk_reads_completed_total", "Completed read requests.", [](const auto& c) { return c.readIos; });
+    family("diskio_disk_writes_completed_total", "Completed write requests.", [](const auto& c) {
+        return c.writeIos;
+    });
+    family("diskio_disk_read_time_seconds_total", "Time read requests took, queueing included.", [](const auto& c) {
+        return c.readTicks / 1000.0;
+    });
+    family("diskio_disk_write_time_seconds_total", "Time write requests took, queueing included.", [](const auto& c) {
+        return c.writeTicks / 1000.0;
+    });
+    family("diskio_disk_io_time_seconds_total", "Time the device had requests in flight.", [](const auto& c) {
+        return c.ioTicks / 1000.0;
+    });
+    family(
+        "diskio_disk_io_time_weighted_seconds_total", "Time the device had requests in flight times their number.",
+        [](const auto& c) { return c.timeInQueue / 1000.0; }
+    );
+}
+
+// The rtnl_link_stats64 counters of a collector like NetlinkNetworkStats, see renderDiskCounters().
+template <class COLLECTOR>
+void renderNetworkCounters(std::string& out, const COLLECTOR& net) {
+    auto family = [&](const char* name, const char* help, auto value) {
+        appendCounterFamily(out, net, networkRateFamilies.label, name, help, value);
+    };
+    family("diskio_network_receive_bytes_total", "Bytes received.", [](const auto& s) { return s.rx_bytes; });
+    family("diskio_network_transmit_bytes_total", "Bytes sent.", [](const auto& s) { return s.tx_bytes; });
+    family("diskio_network_receive_packets_total", "Packets received.", [](const auto& s) { return s.rx_packets; });
+    family("diskio_network_transmit_packets_total", "Packets sent.", [](const auto& s) { return s.tx_packets; });
+    family("diskio_network_receive_drop_total", "Received packets dropped.", [](const auto& s) {
+        return s.rx_dropped;
+    });
+    family("diskio_network_transmit_drop_total", "Packets dropped on send.", [](const auto& s) {
+        return s.tx_dropped;
+    });
+    family("diskio_network_receive_errs_total", "Receive errors.", [](const auto& s) { return s.rx_errors; });
+    family("diskio_network_transmit_errs_total", "Transmit errors.", [](const auto& s) { return s.tx_errors; });
+}
+
+// The part of the exposition one producer owns, e.g. the disk collector. The producer renders into the back
+// buffer and publish() swaps it to the front, scrapes only take a reference to the front buffer. The back buffer
+// is reused unless a slow scrape still holds it from before the last swap.
+class ExpositionSection {
+private:
+    std::mutex mutex; // guards front
+    std::shared_ptr<std::string> front = std::make_shared<std::string>();
+    std::shared_ptr<std::string> back = std::make_shared<std::string>(); // producer only
+
+public:
+    // Producer side: an empty buffer to render the next tick into.
+    std::string& begin() {
+        if (back.use_count() > 1) {
+            back = std::make_shared<std::string>();
+            back->reserve(front->capacity());
+        } else {
+            // pairs with the release of the last scrape dropping its reference
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        back->clear();
+        return *back;
+    }
+
+    void publish() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::swap(front, back);
+    }
+
+    std::shared_ptr<const std::string> get() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return front;
+    }
+};
+
+// Serves the concatenated sections on GET /metrics from one thread with poll(). A scrape copies a reference to
+// every section and sends header and sections with a single sendmsg() (writev() with MSG_NOSIGNAL), so the number
+// of scrapers changes nothing for the collectors or the GUI thread. Connections are closed after each response.
+class MetricsExporter {
+private:
+    static constexpr size_t maxConnections = 64;
+    static constexpr size_t maxRequestSize = 4096;
+    static constexpr auto requestTimeout = std::chrono::seconds(10);
+
+    struct Connection {
+        int fd = -1;
+        std::chrono::steady_clock::time_point accepted;
+        std::string request;
+        bool responding = false;
+        char header[160];
+        std::vector<std::shared_ptr<const std::string>> bodies;
+        std::vector<iovec> iov;
+        size_t iovDone = 0; // fully sent entries of iov
+    };
+
+    std::deque<ExpositionSection> sections;
+    std::vector<Connection> connections;
+    std::vector<pollfd> pollFds;
+    int listenFd = -1;
+    int wakeFds[2] = {-1, -1};
+    std::thread server;
+    std::atomic<bool> stopping{false};
+    std::atomic<uint64_t> scrapes{0};
+    std::string error;
+
+    static bool parseAddress(const std::string& address, sockaddr_in& out) {
+        std::string host = "127.0.0.1";
+        std::string port = address;
+        size_t colon = address.rfind(':');
+        if (colon != std::string::npos) {
+            host = address.substr(0, colon);
+            port = address.substr(colon + 1);
+        }
+        if (host.empty() || host == "localhost") host = "127.0.0.1";
+        unsigned value = 0;
+        auto [end, ec] = std::from_chars(port.data(), port.data() + port.size(), value);
+        if (ec != std::errc() || end != port.data() + port.size() || value == 0 || value > 65535) return false;
+        out = {};
+        out.sin_family = AF_INET;
+        out.sin_port = htons(value);
+        return inet_pton(AF_INET, host.c_str(), &out.sin_addr) == 1;
+    }
+
+    void close(Connection& c) {
+        ::close(c.fd);
+        c.fd = -1;
+        c.request.clear();
+        c.responding = false;
+        c.bodies.clear();
+        c.iov.clear();
+        c.iovDone = 0;
+    }
+
+    void respond(Connection& c) {
+        const char* status = "200 OK";
+        size_t firstLine = c.request.find("\r\n");
+        std::string_view line(c.request.data(), firstLine == std::string::npos ? c.request.size() : firstLine);
+        if (line.substr(0, 4) != "GET ") status = "405 Method Not Allowed";
+        else if (line.substr(4, 9) != "/metrics " && line.substr(4, 9) != "/metrics?")
+            status = "404 Not Found";
+
+        size_t length = 0;
+        if (status[0] == '2') {
+            for (auto& section : sections) {
+                c.bodies.push_back(section.get());
+                length += c.bodies.back()->size();
+            }
+        }
+        int headerSize = snprintf(
+            c.header, sizeof(c.header),
+            "HTTP/1.1 %s\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: %zu\r\n"
+            "Connection: close\r\n\r\n",
+            status, length
+        );
+        c.iov.push_back({c.header, size_t(headerSize)});
+        for (auto& body : c.bodies) {
+            if (!body->empty()) c.iov.push_back({(void*)body->data(), body->size()});
+        }
+        c.responding = true;
+        scrapes.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Returns false once the connection is done, either sent or failed.
+    bool send(Connection& c) {
+        msghdr msg{};
+        msg.msg_iov = c.iov.data() + c.iovDone;
+        msg.msg_iovlen = c.iov.size() - c.iovDone;
+        ssize_t n = sendmsg(c.fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) return errno == EAGAIN || errno == EINTR;
+        while (c.iovDone < c.iov.size() && size_t(n) >= c.iov[c.iovDone].iov_len) {
+            n -= c.iov[c.iovDone].iov_len;
+            c.iovDone++;
+        }
+        if (c.iovDone == c.iov.size()) return false;
+        c.iov[c.iovDone].iov_base = (char*)c.iov[c.iovDone].iov_base + n;
+        c.iov[c.iovDone].iov_len -= n;
+        return true;
+    }
+
+    // Returns false once the connection should be closed.
+    bool receive(Connection& c) {
+        char buffer[1024];
+        ssize_t n = recv(c.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (n < 0) return errno == EAGAIN || errno == EINTR;
+        if (n == 0) return false;
+        c.request.append(buffer, n);
+        if (c.request.find("\r\n\r\n") != std::string::npos || c.request.find("\n\n") != std::string::npos) {
+            respond(c);
+            return send(c);
+        }
+        return c.request.size() < maxRequestSize;
+    }
+
+    void accept() {
+        while (true) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return;
+            Connection* free = nullptr;
+            for (auto& c : connections) {
+                if (c.fd < 0) {
+                    free = &c;
+                    break;
+                }
+            }
+            if (!free) {
+                ::close(fd); // the scraper retries on its next interval
+                continue;
+            }
+            free->fd = fd;
+            free->accepted = std::chrono::steady_clock::now();
+        }
+    }
+
+    void run() {
+        while (!stopping) {
+            pollFds.clear();
+            pollFds.push_back({wakeFds[0], POLLIN, 0});
+            pollFds.push_back({listenFd, POLLIN, 0});
+            for (auto& c : connections) {
+                if (c.fd >= 0) pollFds.push_back({c.fd, short(c.responding ? POLLOUT : POLLIN), 0});
+            }
+            if (poll(pollFds.data(), pollFds.size(), 1000) < 0 && errno != EINTR) break;
+
+            auto now = std::chrono::steady_clock::now();
+            size_t p = 2;
+            for (auto& c : connections) {
+                if (c.fd < 0) continue;
+                short revents = pollFds[p++].revents;
+                bool keep = true;
+                if (revents & (POLLERR | POLLHUP | POLLNVAL)) keep = false;
+                else if (revents & POLLOUT)
+                    keep = send(c);
+                else if (revents & POLLIN)
+                    keep = receive(c);
+                if (keep && now - c.accepted > requestTimeout) keep = false;
+                if (!keep) close(c);
+            }
+            if (pollFds[1].revents & POLLIN) accept();
+        }
+    }
+
+public:
+    MetricsExporter() : connections(maxConnections) {}
+    MetricsExporter(const MetricsExporter&) = delete;
+    MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+    ~MetricsExporter() {
+        if (server.joinable()) {
+            stopping = true;
+            char c = 0;
+            if (write(wakeFds[1], &c, 1) < 0) {}
+            server.join();
+        }
+        for (auto& c : connections) {
+            if (c.fd >= 0) ::close(c.fd);
+        }
+        for (int fd : {listenFd, wakeFds[0], wakeFds[1]}) {
+            if (fd >= 0) ::close(fd);
+        }
+    }
+
+    // Sections are served in the order they were added. Add them all before start().
+    ExpositionSection& addSection() { return sections.emplace_back(); }
+
+    // address is "host:port" or just "port" for 127.0.0.1, returns false with getError() set on failure.
+    bool start(const std::string& address) {
+        sockaddr_in addr;
+        if (!parseAddress(address, addr)) {
+            error = "invalid listen address " + address + ", expected host:port with an IPv4 host";
+            return false;
+        }
+        listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int one = 1;
+        if (listenFd < 0 || setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+            bind(listenFd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listenFd, 64) < 0 ||
+            pipe2(wakeFds, O_CLOEXEC) < 0) {
+            error = "cannot listen on " + address + ": " + strerror(errno);
+            return false;
+        }
+        server = std::thread([this] { run(); });
+        return true;
+    }
+
+    const std::string& getError() const { return error; }
+    uint64_t getScrapeCount() const { return scrapes.load(std::memory_order_relaxed); }
+};
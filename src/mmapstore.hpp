@@ -0,0 +1,184 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <initializer_list>
+#include <iterator>
+#include <map>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// One sample of one device, a cache line each. Names longer than the field are cut.
+struct MetricRecord {
+    int64_t timeMs; // wall clock, ms since the epoch
+    char name[24];
+    double values[4];
+
+    static MetricRecord make(int64_t timeMs, std::string_view name, std::initializer_list<double> values) {
+        MetricRecord r{};
+        r.timeMs = timeMs;
+        std::memcpy(r.name, name.data(), std::min(name.size(), sizeof(r.name) - 1));
+        size_t i = 0;
+        for (double v : values) {
+            if (i == std::size(r.values)) break;
+            r.values[i++] = v;
+        }
+        return r;
+    }
+
+    std::string_view getName() const { return std::string_view(name, strnlen(name, sizeof(name))); }
+};
+static_assert(sizeof(MetricRecord) == 64);
+
+// A ring of fixed size records in a memory mapped file: a 64 byte header followed by capacity records.
+// One writer appends without locks or syscalls, the record is written first and the cursor in the header is
+// bumped after it, so after a crash the file holds every record up to the cursor and nothing half written. Once
+// the ring is full the next append overwrites the oldest slot before the cursor moves, so readers leave that slot
+// out and see at most capacity - 1 records.
+// Readers map the same file and copy records out, there is no parse step. The writer holds an exclusive flock()
+// on the file for as long as it is mapped.
+template <class RECORD>
+class MappedRing {
+private:
+    static_assert(std::is_trivially_copyable_v<RECORD>);
+    static constexpr uint64_t magic = 0x53544f494b534944; // "DISKIOTS" in little endian
+    static constexpr uint32_t version = 1;
+
+    struct alignas(64) Header {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t recordSize;
+        uint64_t capacity;
+        std::atomic<uint64_t> cursor; // records appended since the file was created
+    };
+    static_assert(std::atomic<uint64_t>::is_always_lock_free);
+
+    int fd = -1;
+    void* mapping = MAP_FAILED;
+    size_t mappingSize = 0;
+    Header* header = nullptr;
+    RECORD* records = nullptr;
+    uint64_t capacity = 0;
+    uint64_t cursor = 0; // writer's copy, avoids reading the shared one back
+
+    void unmap() {
+        if (mapping != MAP_FAILED) munmap(mapping, mappingSize);
+        if (fd >= 0) close(fd);
+        mapping = MAP_FAILED;
+        fd = -1;
+        header = nullptr;
+        records = nullptr;
+    }
+
+public:
+    MappedRing() {}
+    // capacity is in records, the file is header + capacity * sizeof(RECORD) bytes and never grows.
+    MappedRing(const std::string& path, uint64_t capacity) { open(path, capacity); }
+    MappedRing(const MappedRing&) = delete;
+    MappedRing& operator=(const MappedRing&) = delete;
+    ~MappedRing() { unmap(); }
+
+    // Maps an existing ring or creates a new one. A file with a different layout or capacity is started over.
+    // Fails without touching the file while another process has it open, whose cursor and mapping it would break.
+    bool open(const std::string& path, uint64_t newCapacity) {
+        unmap();
+        if (newCapacity == 0) return false;
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+        if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+            unmap();
+            return false;
+        }
+        mappingSize = sizeof(Header) + newCapacity * sizeof(RECORD);
+
+        struct stat st;
+        bool reuse = fstat(fd, &st) == 0 && size_t(st.st_size) == mappingSize;
+        if (!reuse && ftruncate(fd, 0) != 0) {
+            unmap();
+            return false;
+        }
+        if (!reuse && ftruncate(fd, mappingSize) != 0) {
+            unmap();
+            return false;
+        }
+        mapping = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            unmap();
+            return false;
+        }
+        header = static_cast<Header*>(mapping);
+        records = reinterpret_cast<RECORD*>(static_cast<char*>(mapping) + sizeof(Header));
+        capacity = newCapacity;
+
+        if (!reuse || header->magic != magic || header->version != version || header->recordSize != sizeof(RECORD) ||
+            header->capacity != capacity) {
+            header->magic = 0; // a torn init is not mistaken for a valid file
+            header->version = version;
+            header->recordSize = sizeof(RECORD);
+            header->capacity = capacity;
+            header->cursor.store(0, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            header->magic = magic;
+        }
+        cursor = header->cursor.load(std::memory_order_acquire);
+        return true;
+    }
+
+    bool valid() const { return header != nullptr; }
+
+    // Single writer, enforced by the lock taken in open().
+    void append(const RECORD& record) {
+        records[cursor % capacity] = record;
+        header->cursor.store(++cursor, std::memory_order_release);
+    }
+
+    uint64_t size() const {
+        if (!header) return 0;
+        return std::min(header->cursor.load(std::memory_order_acquire), capacity - 1);
+    }
+    uint64_t getCapacity() const { return capacity; }
+
+    // Calls f(const RECORD&) from the oldest to the newest record. Meant for startup backfill, while a writer
+    // is active the oldest records may be overwritten during the walk.
+    template <class F>
+    void forEach(F f) const {
+        if (!header) return;
+        uint64_t end = header->cursor.load(std::memory_order_acquire);
+        uint64_t begin = end >= capacity ? end - capacity + 1 : 0; // the slot at end is the one written next
+        for (uint64_t i = begin; i < end; i++) f(records[i % capacity]);
+    }
+};
+
+// Where history files go unless --history-dir says otherwise: $XDG_STATE_HOME/diskio or ~/.local/state/diskio.
+std::string defaultHistoryDir() {
+    if (const char* state = getenv("XDG_STATE_HOME"); state && *state) return std::string(state) + "/diskio";
+    if (const char* home = getenv("HOME"); home && *home) return std::string(home) + "/.local/state/diskio";
+    return "/tmp/diskio";
+}
+
+// Opens <dir>/<family>.ring sized to at most maxBytes, creating the directory if needed.
+bool openHistoryRing(MappedRing<MetricRecord>& ring, const std::string& dir, const std::string& family, uint64_t maxBytes) {
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    uint64_t capacity = maxBytes / sizeof(MetricRecord);
+    return ring.open(dir + "/" + family + ".ring", capacity);
+}
+
+// The records of a ring per device name, oldest first. Call it before the writer starts so the walk
+// cannot race with appends.
+std::map<std::string, std::vector<MetricRecord>> groupByName(const MappedRing<MetricRecord>& ring) {
+    std::map<std::string, std::vector<MetricRecord>> result;
+    ring.forEach([&](const MetricRecord& r) { result[std::string(r.getName())].push_back(r); });
+    return result;
+}
@@ -0,0 +1,346 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <linux/if_link.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <map>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include "./networkstats.hpp"
+#include "./sampleframe.hpp"
+
+struct LinkStats {
+    int ifindex = 0;
+    std::string name;
+    rtnl_link_stats64 stats{};
+};
+
+// Packet rates per second and the cumulative drop and error counters of a link. Ticks read from the /proc/net/dev
+// fallback have no packet rates (NaN) and keep the counters of the last netlink tick.
+struct LinkMetrics {
+    double rxPackets = 0;
+    double txPackets = 0;
+    double rxDrops = 0;
+    double txDrops = 0;
+    double rxErrors = 0;
+    double txErrors = 0;
+};
+
+// Fetches binary rtnl_link_stats64 for every link with one RTM_GETSTATS dump, buffers are reused between calls.
+class NetlinkSocket {
+private:
+    int fd = -1;
+    uint32_t seq = 0;
+    std::vector<char> buffer = std::vector<char>(65536);
+
+    bool send(uint16_t type, const void* payload, size_t payloadLen) {
+        struct {
+            nlmsghdr hdr;
+            char payload[64];
+        } req{};
+        if (payloadLen > sizeof(req.payload)) return false;
+        req.hdr.nlmsg_len = NLMSG_LENGTH(payloadLen);
+        req.hdr.nlmsg_type = type;
+        req.hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+        req.hdr.nlmsg_seq = ++seq;
+        memcpy(NLMSG_DATA(&req.hdr), payload, payloadLen);
+
+        sockaddr_nl kernel{};
+        kernel.nl_family = AF_NETLINK;
+        return sendto(fd, &req, req.hdr.nlmsg_len, 0, (sockaddr*)&kernel, sizeof(kernel)) >= 0;
+    }
+
+    // Calls onMessage for every message of the dump until NLMSG_DONE, returns false on error.
+    template <class F>
+    bool receive(F onMessage) {
+        while (true) {
+            ssize_t len = recv(fd, buffer.data(), buffer.size(), 0);
+            if (len < 0) return false;
+            for (nlmsghdr* h = (nlmsghdr*)buffer.data(); NLMSG_OK(h, (size_t)len); h = NLMSG_NEXT(h, len)) {
+                if (h->nlmsg_seq != seq) continue;
+                if (h->nlmsg_type == NLMSG_DONE) return true;
+                if (h->nlmsg_type == NLMSG_ERROR) return false;
+                onMessage(h);
+            }
+        }
+    }
+
+public:
+    NetlinkSocket() {
+        fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+        if (fd < 0) return;
+        sockaddr_nl addr{};
+        addr.nl_family = AF_NETLINK;
+        if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    NetlinkSocket(const NetlinkSocket&) = delete;
+    NetlinkSocket& operator=(const NetlinkSocket&) = delete;
+    ~NetlinkSocket() {
+        if (fd >= 0) close(fd);
+    }
+
+    bool valid() const { return fd >= 0; }
+
+    // onLink(ifindex, const rtnl_link_stats64&)
+    template <class F>
+    bool dumpStats64(F onLink) {
+        if (fd < 0) return false;
+        if_stats_msg msg{};
+        msg.family = AF_UNSPEC;
+        msg.filter_mask = IFLA_STATS_FILTER_BIT(IFLA_STATS_LINK_64);
+        if (!send(RTM_GETSTATS, &msg, sizeof(msg))) return false;
+        return receive([&](nlmsghdr* h) {
+            if (h->nlmsg_type != RTM_NEWSTATS) return;
+            if_stats_msg* ifsm = (if_stats_msg*)NLMSG_DATA(h);
+            int attrLen = h->nlmsg_len - NLMSG_LENGTH(sizeof(*ifsm));
+            for (rtattr* a = (rtattr*)((char*)ifsm + NLMSG_ALIGN(sizeof(*ifsm))); RTA_OK(a, attrLen);
+                 a = RTA_NEXT(a, attrLen)) {
+                if (a->rta_type != IFLA_STATS_LINK_64 || RTA_PAYLOAD(a) < sizeof(rtnl_link_stats64)) continue;
+                rtnl_link_stats64 stats;
+                memcpy(&stats, RTA_DATA(a), sizeof(stats)); // attribute payload is only 4 byte aligned
+                onLink((int)ifsm->ifindex, stats);
+            }
+        });
+    }
+
+    // onLink(ifindex, const char* name)
+    template <class F>
+    bool dumpLinkNames(F onLink) {
+        if (fd < 0) return false;
+        ifinfomsg msg{};
+        msg.ifi_family = AF_UNSPEC;
+        if (!send(RTM_GETLINK, &msg, sizeof(msg))) return false;
+        return receive([&](nlmsghdr* h) {
+            if (h->nlmsg_type != RTM_NEWLINK) return;
+            ifinfomsg* ifi = (ifinfomsg*)NLMSG_DATA(h);
+            int attrLen = IFLA_PAYLOAD(h);
+            for (rtattr* a = IFLA_RTA(ifi); RTA_OK(a, attrLen); a = RTA_NEXT(a, attrLen)) {
+                if (a->rta_type == IFLA_IFNAME) onLink(ifi->ifi_index, (const char*)RTA_DATA(a));
+            }
+        });
+    }
+};
+
+// Alternative NetworkStats backend using netlink, falls back to parsing /proc/net/dev if RTM_GETSTATS is unavailable.
+// A dump that fails on the way (ENOBUFS, EINTR) only falls back for that tick.
+class NetlinkNetworkStats {
+private:
+    NetlinkSocket nl;
+    NetworkStats fallback;
+    bool useNetlink = true; // RTM_GETSTATS worked at startup
+    bool fromNetlink = true; // the last update() came from netlink
+    bool includeLoopback = false;
+
+    std::vector<LinkStats> links; // sorted by ifindex
+    std::vector<rtnl_link_stats64> last;
+    std::vector<char> seen;
+    std::map<std::string, std::pair<double, double>> mbps;
+    std::vector<std::pair<double, double>*> rateSlots; // points into mbps, null for excluded links
+    DeviceIds ids;
+    std::vector<uint32_t> linkIds; // [link] frame id, DeviceIds::none for excluded links
+    DeviceFrame<LinkMetrics> frame;
+    std::chrono::steady_clock::time_point lastTime;
+    bool hasLast = false;
+
+    size_t findLink(int ifindex) const {
+        auto it = std::lower_bound(links.begin(), links.end(), ifindex, [](const LinkStats& l, int i) {
+            return l.ifindex < i;
+        });
+        if (it == links.end() || it->ifindex != ifindex) return (size_t)-1;
+        return it - links.begin();
+    }
+
+    bool rebuildLinks() {
+        std::vector<LinkStats> result;
+        bool ok = nl.dumpLinkNames([&](int ifindex, const char* name) {
+            LinkStats l;
+            l.ifindex = ifindex;
+            l.name = name;
+            result.push_back(l);
+        });
+        if (!ok) return false;
+        std::sort(result.begin(), result.end(), [](const LinkStats& a, const LinkStats& b) {
+            return a.ifindex < b.ifindex;
+        });
+
+        // by ifindex, a link deleted and created again under the same name (tun0 on a VPN reconnect) starts from 0
+        std::map<int, rtnl_link_stats64> previous;
+        for (size_t i = 0; i < links.size(); i++) {
+            if (seen[i]) previous[links[i].ifindex] = last[i];
+        }
+
+        links = std::move(result);
+        last.assign(links.size(), rtnl_link_stats64{});
+        seen.assign(links.size(), 0);
+        mbps.clear();
+        rateSlots.clear();
+        linkIds.clear();
+        for (size_t i = 0; i < links.size(); i++) {
+            auto prev = previous.find(links[i].ifindex);
+            if (prev != previous.end()) {
+                last[i] = prev->second;
+                seen[i] = 1;
+            }
+            bool excluded = links[i].name == "lo" && !includeLoopback;
+            rateSlots.push_back(excluded ? nullptr : &mbps[links[i].name]);
+            linkIds.push_back(excluded ? DeviceIds::none : ids.intern(links[i].name));
+        }
+        frame.resize(ids);
+        return true;
+    }
+
+    bool sample(bool retry = true) {
+        bool unknownLink = false;
+        size_t count = 0;
+        bool ok = nl.dumpStats64([&](int ifindex, const rtnl_link_stats64& stats) {
+            size_t i = findLink(ifindex);
+            if (i == (size_t)-1) {
+                unknownLink = true;
+                return;
+            }
+            links[i].stats = stats;
+            count++;
+        });
+        if (!ok) return false;
+        if (unknownLink || count != links.size()) {
+            // links were added or removed since the last name dump
+            if (!retry || !rebuildLinks()) return false;
+            return sample(false);
+        }
+        return true;
+    }
+
+    // False when a counter went backwards, the driver reset its statistics.
+    static bool advanced(const rtnl_link_stats64& cur, const rtnl_link_stats64& last) {
+        return cur.rx_bytes >= last.rx_bytes && cur.tx_bytes >= last.tx_bytes && cur.rx_packets >= last.rx_packets &&
+               cur.tx_packets >= last.tx_packets;
+    }
+
+    // A failed dump: rates from the /proc/net/dev bytes against the last netlink counters, which stay the baseline
+    // of the next tick. Links missing from the file or whose bytes went backwards are not present this tick.
+    bool fallbackTick() {
+        if (!hasLast) return false;
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - lastTime).count();
+        auto bytes = fallback.getDeviceStats();
+        for (size_t i = 0; i < links.size(); i++) {
+            if (!rateSlots[i]) continue;
+            auto cur = bytes.find(links[i].name);
+            bool rates = seen[i] && seconds > 0 && cur != bytes.end() && cur->second.first >= last[i].rx_bytes &&
+                         cur->second.second >= last[i].tx_bytes;
+            if (rates) {
+                *rateSlots[i] = {
+                    (cur->second.first - last[i].rx_bytes) / 1000000.0 / seconds,
+                    (cur->second.second - last[i].tx_bytes) / 1000000.0 / seconds,
+                };
+            } else {
+                *rateSlots[i] = {0, 0};
+            }
+            uint32_t id = linkIds[i];
+            frame.read[id] = rateSlots[i]->first;
+            frame.write[id] = rateSlots[i]->second;
+            frame.present[id] = rates;
+            LinkMetrics& m = frame.metrics[id];
+            m.rxPackets = m.txPackets = std::numeric_limits<double>::quiet_NaN();
+        }
+        return true;
+    }
+
+public:
+    NetlinkNetworkStats(bool includeLoopback = false) : includeLoopback(includeLoopback) {
+        useNetlink = nl.valid() && rebuildLinks() && sample();
+    }
+
+    bool isUsingNetlink() const { return useNetlink && fromNetlink; }
+
+    // Full counter set of every link from the last getRate() call, empty when running on the fallback.
+    const std::vector<LinkStats>& getCounters() const { return links; }
+
+    // Fills mbps and the frame, returns false while there is no previous sample to compute rates from.
+    bool update() {
+        std::fill(frame.present.begin(), frame.present.end(), 0);
+        fromNetlink = useNetlink && sample();
+        if (useNetlink && !fromNetlink) return fallbackTick();
+        if (!useNetlink) {
+            mbps = fallback.getRate();
+            for (auto& [name, rate] : mbps) ids.intern(name);
+            frame.resize(ids);
+            for (auto& [name, rate] : mbps) {
+                uint32_t id = ids.find(name);
+                frame.read[id] = rate.first;
+                frame.write[id] = rate.second;
+                LinkMetrics& m = frame.metrics[id];
+                m.rxPackets = m.txPackets = std::numeric_limits<double>::quiet_NaN();
+                frame.present[id] = 1;
+            }
+            return true;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(now - lastTime).count();
+        for (size_t i = 0; i < links.size(); i++) {
+            const auto& cur = links[i].stats;
+            if (rateSlots[i]) {
+                bool rates = hasLast && seconds > 0 && seen[i] && advanced(cur, last[i]);
+                if (rates) {
+                    *rateSlots[i] = {
+                        (cur.rx_bytes - last[i].rx_bytes) / 1000000.0 / seconds,
+                        (cur.tx_bytes - last[i].tx_bytes) / 1000000.0 / seconds,
+                    };
+                } else {
+                    *rateSlots[i] = {0, 0};
+                }
+                uint32_t id = linkIds[i];
+                frame.read[id] = rateSlots[i]->first;
+                frame.write[id] = rateSlots[i]->second;
+                frame.present[id] = rates;
+                LinkMetrics& m = frame.metrics[id];
+                m.rxPackets = rates ? (cur.rx_packets - last[i].rx_packets) / seconds : 0;
+                m.txPackets = rates ? (cur.tx_packets - last[i].tx_packets) / seconds : 0;
+                m.rxDrops = cur.rx_dropped;
+                m.txDrops = cur.tx_dropped;
+                m.rxErrors = cur.rx_errors;
+                m.txErrors = cur.tx_errors;
+            }
+            last[i] = cur;
+            seen[i] = 1;
+        }
+        lastTime = now;
+
+        bool hadLast = hasLast;
+        hasLast = true;
+        return hadLast;
+    }
+
+    const std::map<std::string, std::pair<double, double>>& getRate() {
+        if (!update()) {
+            static const std::map<std::string, std::pair<double, double>> empty;
+            return empty;
+        }
+        return mbps;
+    }
+
+    // The same tick as getRate() as arrays indexed by link id.
+    const DeviceFrame<LinkMetrics>& getFrame() {
+        update();
+        return frame;
+    }
+
+    // Calls f(name, stats) with the counters of the last update() of every reported link. Nothing in the sysfs
+    // fallback, which only keeps rates.
+    template <class F>
+    void forEachCounters(F f) const {
+        if (!isUsingNetlink()) return;
+        for (size_t i = 0; i < links.size(); i++) {
+            if (rateSlots[i] && seen[i]) f(links[i].name, links[i].stats);
+        }
+    }
+};
@@ -18,9 +18,13 @@
 
 class NetworkStats {
 private:
+    std::string procNetDev;
+
+public:
+    // Received and sent bytes of every interface, loopback included.
     std::map<std::string, std::pair<uint64_t, uint64_t>> getDeviceStats() {
         std::map<std::string, std::pair<uint64_t, uint64_t>> result;
-        std::string fileStr = readfile("/proc/net/dev");
+        std::string fileStr = readfile(procNetDev);
         auto lines = estd::string_util::splitAll(fileStr, "\n", false);
 
 
@@ -29,36 +33,40 @@ private:
             auto name = estd::string_util::splitAll(namePlusTokens.at(0), " ", false).at(0);
             auto tokens = estd::string_util::splitAll(namePlusTokens.at(1), " ", false);
 
-            if (name != "lo") { result[name] = {stoll(tokens.at(0)), stoll(tokens.at(8))}; }
+            result[name] = {stoll(tokens.at(0)), stoll(tokens.at(8))};
         }
         // printMap(result);
         return result;
     }
 
-public:
-    uint64_t lastTime = 0;
+    // root is prepended to /proc, for fixture trees in benchmarks.
+    NetworkStats(std::string root = "") : procNetDev(root + "/proc/net/dev") {}
+
+    std::chrono::steady_clock::time_point lastTime;
+    bool hasLast = false;
     std::map<std::string, std::pair<uint64_t, uint64_t>> lastBytes;
     std::map<std::string, std::pair<double, double>> getRate() {
-        auto millisec_since_epoch =
-            std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch())
-                .count();
+        auto now = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(now - lastTime).count();
 
         std::map<std::string, std::pair<uint64_t, uint64_t>> currentBytes = getDeviceStats();
+        currentBytes.erase("lo");
         std::map<std::string, std::pair<double, double>> mbps;
         for (auto& [k, v] : currentBytes) {
-            if (lastBytes.count(k))
+            auto last = lastBytes.find(k);
+            // a counter that went backwards was reset, there is no rate until the next sample
+            if (last != lastBytes.end() && seconds > 0 && v.first >= last->second.first &&
+                v.second >= last->second.second)
                 mbps[k] = {
-                    (v.first - lastBytes[k].first) / 1000000.0 * 1000.0 / (millisec_since_epoch - lastTime),
-                    (v.second - lastBytes[k].second) / 1000000.0 * 1000.0 / (millisec_since_epoch - lastTime),
+                    (v.first - last->second.first) / 1000000.0 / seconds,
+                    (v.second - last->second.second) / 1000000.0 / seconds,
                 };
         }
         lastBytes = currentBytes;
 
-        if (lastTime != 0) {
-            lastTime = millisec_since_epoch;
-            return mbps;
-        }
-        lastTime = millisec_since_epoch;
+        lastTime = now;
+        if (hasLast) return mbps;
+        hasLast = true;
         return {};
     }
 };
\ No newline at end of file
@@ -0,0 +1,218 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <cxxabi.h>
+#include <deque>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+#include <unistd.h>
+
+// Log-linear histogram of nanosecond values in the style of HdrHistogram: exact below 128 ns, then 64 buckets
+// per power of two (about 1.6% resolution) up to maxTrackable. record() is a few relaxed atomic adds, safe from
+// any thread without locks; readers may see a sample in the count a moment before it shows up in the buckets.
+class LatencyHistogram {
+private:
+    static constexpr int subBits = 6;
+    static constexpr uint64_t sub = 1 << subBits;
+    static constexpr int maxExponent = 40; // ~18 minutes, longer values are clamped
+    static constexpr size_t bucketCount = 2 * sub + (maxExponent - subBits) * sub;
+
+    std::atomic<uint64_t> counts[bucketCount] = {};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> maxValue{0};
+
+    static size_t indexOf(uint64_t v) {
+        if (v < 2 * sub) return v;
+        if (v >> (maxExponent + 1)) v = (uint64_t(1) << (maxExponent + 1)) - 1;
+        int e = 63 - __builtin_clzll(v);
+        int shift = e - subBits;
+        return 2 * sub + (e - subBits - 1) * sub + ((v >> shift) - sub);
+    }
+
+    // Highest value that lands in bucket i.
+    static uint64_t upperBound(size_t i) {
+        if (i < 2 * sub) return i;
+        size_t group = (i - 2 * sub) / sub;
+        uint64_t mantissa = (i - 2 * sub) % sub + sub;
+        return ((mantissa + 1) << (group + 1)) - 1;
+    }
+
+public:
+    void record(uint64_t ns) {
+        counts[indexOf(ns)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t m = maxValue.load(std::memory_order_relaxed);
+        while (ns > m && !maxValue.compare_exchange_weak(m, ns, std::memory_order_relaxed)) {}
+    }
+
+    void record(std::chrono::nanoseconds d) { record(uint64_t(std::max<int64_t>(0, d.count()))); }
+
+    // Not atomic as a whole, samples recorded during a reset may survive it.
+    void reset() {
+        for (auto& c : counts) c.store(0, std::memory_order_relaxed);
+        total = 0;
+        sum = 0;
+        maxValue = 0;
+    }
+
+    uint64_t getCount() const { return total.load(std::memory_order_relaxed); }
+    uint64_t getMax() const { return maxValue.load(std::memory_order_relaxed); }
+    double getMean() const {
+        uint64_t n = getCount();
+        return n ? double(sum.load(std::memory_order_relaxed)) / n : 0.0;
+    }
+
+    // The value below which the fraction q (0-1) of the samples fall, rounded up to the bucket bound.
+    uint64_t getPercentile(double q) const {
+        uint64_t n = getCount();
+        if (n == 0) return 0;
+        uint64_t target = std::max<uint64_t>(1, uint64_t(q * n + 0.5));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < bucketCount; i++) {
+            seen += counts[i].load(std::memory_order_relaxed);
+            if (seen >= target) return std::min(upperBound(i), getMax());
+        }
+        return getMax();
+    }
+};
+
+// One instrumented step of the monitor, e.g. a collector's sample or a chart's updateData().
+struct OverheadStage {
+    std::string name;
+    LatencyHistogram latency;
+
+    OverheadStage(std::string name) : name(std::move(name)) {}
+};
+
+struct ProcessUsage {
+    double cpuSeconds = 0; // user + system, all threads
+    uint64_t rssBytes = 0;
+};
+
+double processCpuSeconds() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Resident set size from /proc/self/statm, getrusage only knows the peak.
+uint64_t processRssBytes() {
+    FILE* f = fopen("/proc/self/statm", "re");
+    if (!f) return 0;
+    unsigned long long size = 0, resident = 0;
+    int n = fscanf(f, "%llu %llu", &size, &resident);
+    fclose(f);
+    return n == 2 ? resident * uint64_t(sysconf(_SC_PAGESIZE)) : 0;
+}
+
+// "ProcDiskStats" rather than the mangled typeid name, for stage names.
+template <class T>
+std::string typeName() {
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(typeid(T).name(), nullptr, nullptr, &status);
+    std::string name = status == 0 && demangled ? demangled : typeid(T).name();
+    std::free(demangled);
+    return name;
+}
+
+// What the monitor itself costs: a latency histogram per stage, the jitter of the display tick and the CPU time
+// and memory of the whole process. Stages are created once and never removed, callers keep the reference.
+class MonitorOverhead {
+private:
+    std::mutex mutex; // only guards the stage list, recording never locks
+    std::deque<OverheadStage> stages;
+    LatencyHistogram tickJitter;
+    std::atomic<int64_t> tickTargetNs{0};
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    double cpuAtStart = processCpuSeconds();
+
+public:
+    OverheadStage& stage(const std::string& name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& s : stages) {
+            if (s.name == name) return s;
+        }
+        return stages.emplace_back(name);
+    }
+
+    std::vector<const OverheadStage*> getStages() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<const OverheadStage*> result;
+        for (auto& s : stages) result.push_back(&s);
+        return result;
+    }
+
+    // Deviation of a display tick from its target interval, in either direction.
+    void recordTick(std::chrono::nanoseconds interval, std::chrono::nanoseconds target) {
+        tickTargetNs.store(target.count(), std::memory_order_relaxed);
+        tickJitter.record(interval > target ? interval - target : target - interval);
+    }
+    const LatencyHistogram& getTickJitter() const { return tickJitter; }
+    std::chrono::nanoseconds getTickTarget() const { return std::chrono::nanoseconds(tickTargetNs.load()); }
+
+    ProcessUsage getUsage() const { return {processCpuSeconds(), processRssBytes()}; }
+
+    // CPU time since the process started as a fraction of one core.
+    double getCpuFraction() const {
+        double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        return wall > 0 ? (processCpuSeconds() - cpuAtStart) / wall : 0.0;
+    }
+
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& s : stages) s.latency.reset();
+        tickJitter.reset();
+    }
+
+    // Plain text, one line per stage, times in microseconds.
+    void writeReport(std::ostream& out) {
+        auto us = [](double ns) { return ns / 1000.0; };
+        auto row = [&](const std::string& name, const LatencyHistogram& h) {
+            out << std::left << std::setw(48) << name << std::right << std::setw(10) << h.getCount() << std::fixed
+                << std::setprecision(1) << std::setw(11) << us(h.getMean()) << std::setw(11) << us(h.getPercentile(0.5))
+                << std::setw(11) << us(h.getPercentile(0.99)) << std::setw(11) << us(h.getPercentile(0.999))
+                << std::setw(11) << us(h.getMax()) << "\n";
+        };
+        ProcessUsage usage = getUsage();
+        double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        out << "uptime_s " << std::fixed << std::setprecision(1) << wall << "\n";
+        out << "cpu_s " << std::setprecision(3) << usage.cpuSeconds - cpuAtStart << " (" << std::setprecision(3)
+            << getCpuFraction() * 100 << "% of one core)\n";
+        out << "rss_mb " << std::setprecision(1) << usage.rssBytes / 1048576.0 << "\n";
+        out << "tick_target_ms " << getTickTarget().count() / 1e6 << "\n\n";
+        out << std::left << std::setw(48) << "stage" << std::right << std::setw(10) << "count" << std::setw(11)
+            << "mean_us" << std::setw(11) << "p50_us" << std::setw(11) << "p99_us" << std::setw(11) << "p99.9_us"
+            << std::setw(11) << "max_us" << "\n";
+        row("tick jitter", tickJitter);
+        for (auto* s : getStages()) row(s->name, s->latency);
+    }
+};
+
+MonitorOverhead& monitorOverhead() {
+    static MonitorOverhead overhead;
+    return overhead;
+}
+
+// Records the lifetime of the scope into a stage.
+class OverheadScope {
+private:
+    LatencyHistogram& histogram;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+public:
+    OverheadScope(OverheadStage& stage) : histogram(stage.latency) {}
+    OverheadScope(const OverheadScope&) = delete;
+    OverheadScope& operator=(const OverheadScope&) = delete;
+    ~OverheadScope() { histogram.record(std::chrono::steady_clock::now() - start); }
+};
@@ -0,0 +1,206 @@
+#pragma once
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <fcntl.h>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <vector>
+
+#include "./blockdevices.hpp"
+#include "./blocktopology.hpp"
+#include "./diskmetrics.hpp"
+#include "./procsnapshot.hpp"
+#include "./sampleframe.hpp"
+
+// Alternative DiskStats backend, reads /proc/diskstats once per tick and parses every row in place.
+// With DiskScope::AllLayers partitions and dm/md volumes are reported too, and the same read feeds the roll-ups
+// of getTopology().
+class ProcDiskStats {
+private:
+    struct Counters {
+        DiskCounters disk;
+        bool seen = false;
+    };
+
+    BlockDeviceRegistry registry;
+    ProcSnapshot::File diskstats;
+    DiskScope scope;
+    uint64_t registryGeneration = (uint64_t)-1;
+
+    // sorted by major:minor, rebuilt only when the registry changes
+    std::vector<std::pair<uint64_t, size_t>> devnumIndex;
+    std::vector<Counters> current;
+    std::vector<Counters> last;
+    std::vector<std::string> names;
+    std::vector<std::pair<uint64_t, uint64_t>> identities; // [slot] major:minor and diskseq
+    std::map<std::string, std::pair<double, double>> mbps;
+    std::vector<std::pair<double, double>*> rateSlots; // points into mbps, map nodes never move, null without a rate
+    std::map<std::string, DiskMetrics> metrics;
+    std::vector<DiskMetrics*> metricSlots;
+    DeviceIds ids;
+    std::vector<uint32_t> slotIds; // [slot] frame id of the device
+    DeviceFrame<DiskMetrics> frame;
+    BlockTopology topology; // slots are the device indices, only built for AllLayers
+    std::vector<double> slotRead;
+    std::vector<double> slotWrite;
+
+    std::chrono::steady_clock::time_point lastTime;
+    bool hasLast = false;
+
+    static uint64_t devnum(unsigned major, unsigned minor) { return (uint64_t(major) << 32) | minor; }
+
+    void rebuildIndex(const std::vector<BlockDevice>& allDevs) {
+        std::vector<BlockDevice> devs;
+        for (auto& dev : allDevs) {
+            if (scope == DiskScope::AllLayers || dev.isWholeDisk()) devs.push_back(dev);
+        }
+
+        // carry the previous sample of devices that are still present so they do not skip a tick, not of a new
+        // device that took the name of a removed one
+        std::map<std::string, std::pair<std::pair<uint64_t, uint64_t>, Counters>> previous;
+        for (size_t i = 0; i < names.size(); i++) previous[names[i]] = {identities[i], last[i]};
+
+        devnumIndex.clear();
+        names.clear();
+        identities.clear();
+        rateSlots.clear();
+        mbps.clear();
+        metricSlots.clear();
+        metrics.clear();
+        slotIds.clear();
+        last.assign(devs.size(), Counters{});
+        current.assign(devs.size(), Counters{});
+        for (size_t i = 0; i < devs.size(); i++) {
+            devnumIndex.push_back({devnum(devs[i].major, devs[i].minor), i});
+            names.push_back(devs[i].name);
+            identities.push_back({devnum(devs[i].major, devs[i].minor), devs[i].diskseq});
+            auto prev = previous.find(devs[i].name);
+            if (prev != previous.end() && prev->second.first == identities.back()) last[i] = prev->second.second;
+            rateSlots.push_back(nullptr);
+            metricSlots.push_back(&metrics[devs[i].name]);
+            slotIds.push_back(ids.intern(devs[i].name));
+        }
+        frame.resize(ids);
+        if (scope == DiskScope::AllLayers) {
+            topology.build(devs);
+            slotRead.assign(devs.size(), 0.0);
+            slotWrite.assign(devs.size(), 0.0);
+        }
+        std::sort(devnumIndex.begin(), devnumIndex.end());
+        registryGeneration = registry.getGeneration();
+    }
+
+    size_t findDevice(uint64_t dn) const {
+        auto it = std::lower_bound(devnumIndex.begin(), devnumIndex.end(), std::pair<uint64_t, size_t>{dn, 0});
+        if (it == devnumIndex.end() || it->first != dn) return (size_t)-1;
+        return it->second;
+    }
+
+    // One pass over the whole file, no allocations: "major minor name f1 f2 ... f17"
+    void parse(std::string_view file) {
+        for (auto& c : current) c.seen = false;
+        size_t lineStart = 0;
+        while (lineStart < file.size()) {
+            size_t lineEnd = file.find('\n', lineStart);
+            if (lineEnd == std::string_view::npos) lineEnd = file.size();
+            std::string_view line = file.substr(lineStart, lineEnd - lineStart);
+            lineStart = lineEnd + 1;
+
+            size_t pos = 0;
+            unsigned major = 0, minor = 0;
+            if (!parseNumber(nextToken(line, pos), major)) continue;
+            if (!parseNumber(nextToken(line, pos), minor)) continue;
+            size_t idx = findDevice(devnum(major, minor));
+            if (idx == (size_t)-1) continue;
+
+            nextToken(line, pos); // name
+
+            Counters& c = current[idx];
+            c.seen = parseDiskCounters(line.substr(pos), c.disk);
+        }
+    }
+
+public:
+    // root is prepended to /proc and /sys, for fixture trees in benchmarks.
+    ProcDiskStats(
+        ProcSnapshot& snapshot = sharedProcSnapshot(), std::string root = "", DiskScope scope = DiskScope::WholeDisks
+    ) :
+        registry(root + "/sys/block/"), diskstats(snapshot.subscribe(root + "/proc/diskstats")), scope(scope) {}
+
+    // Returns false for the first call, which has no previous sample to compute rates from.
+    bool sample() {
+        const auto& devs = registry.getDevices();
+        if (registry.getGeneration() != registryGeneration) rebuildIndex(devs);
+
+        auto now = std::chrono::steady_clock::now();
+        diskstats.with([&](std::string_view file) { parse(file); });
+
+        double seconds = std::chrono::duration<double>(now - lastTime).count();
+        std::fill(frame.present.begin(), frame.present.end(), 0);
+        for (size_t i = 0; i < current.size(); i++) {
+            uint32_t id = slotIds[i];
+            DiskMetrics& m = *metricSlots[i];
+            bool both = current[i].seen && last[i].seen;
+            bool reset = both && !diskCountersAdvanced(current[i].disk, last[i].disk);
+            // a new device, one without a row and one whose counters went backwards have no rate this tick
+            bool rates = hasLast && seconds > 0 && both && !reset;
+            if (rates) {
+                m = computeDiskMetrics(current[i].disk, last[i].disk, seconds);
+                if (!rateSlots[i]) rateSlots[i] = &mbps[names[i]];
+                *rateSlots[i] = {m.readMBps, m.writeMBps};
+            } else {
+                m = DiskMetrics{};
+                if (rateSlots[i]) mbps.erase(names[i]);
+                rateSlots[i] = nullptr;
+            }
+            frame.read[id] = m.readMBps;
+            frame.write[id] = m.writeMBps;
+            frame.metrics[id] = m;
+            frame.present[id] = rates;
+        }
+        if (scope == DiskScope::AllLayers) {
+            for (size_t i = 0; i < current.size(); i++) {
+                slotRead[i] = metricSlots[i]->readMBps;
+                slotWrite[i] = metricSlots[i]->writeMBps;
+            }
+            topology.update(slotRead.data(), slotWrite.data());
+        }
+        std::swap(current, last);
+        lastTime = now;
+
+        bool hadLast = hasLast;
+        hasLast = true;
+        return hadLast;
+    }
+
+    const std::map<std::string, std::pair<double, double>>& getRate() {
+        if (!sample()) {
+            static const std::map<std::string, std::pair<double, double>> empty;
+            return empty;
+        }
+        return mbps;
+    }
+
+    // The same tick as getRate() as arrays indexed by device id, DiskMetrics included.
+    const DeviceFrame<DiskMetrics>& getFrame() {
+        sample();
+        return frame;
+    }
+
+    // The stacking of the devices with the roll-ups of the last sample, empty unless the scope is AllLayers.
+    const BlockTopology& getTopology() const { return topology; }
+
+    // IOPS, request size, await, queue depth and utilization of every device, from the same read as getRate().
+    const std::map<std::string, DiskMetrics>& getMetrics() const { return metrics; }
+
+    // Calls f(name, counters) with the raw counters of the last sample of every device that had a row.
+    template <class F>
+    void forEachCounters(F f) const {
+        for (size_t i = 0; i < names.size(); i++) {
+            if (last[i].seen) f(names[i], last[i].disk);
+        }
+    }
+};
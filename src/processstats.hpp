@@ -0,0 +1,351 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "./fileutil.hpp"
+#include "./sampler.hpp"
+
+// A fixed set of worker threads that split index ranges between them, the calling thread takes a share too.
+class ParallelFor {
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(size_t, size_t)>* job = nullptr;
+    size_t count = 0;
+    size_t chunk = 1;
+    std::atomic<size_t> nextChunk{0};
+    uint64_t generation = 0;
+    size_t running = 0;
+    bool stopping = false;
+
+    void work() {
+        for (size_t c = nextChunk.fetch_add(1); c * chunk < count; c = nextChunk.fetch_add(1)) {
+            (*job)(c * chunk, std::min(count, (c + 1) * chunk));
+        }
+    }
+
+    void run() {
+        uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            work();
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--running == 0) done.notify_one();
+        }
+    }
+
+public:
+    ParallelFor(size_t threads) {
+        for (size_t i = 0; i < threads; i++) workers.emplace_back([this] { run(); });
+    }
+    ParallelFor(const ParallelFor&) = delete;
+    ParallelFor& operator=(const ParallelFor&) = delete;
+    ~ParallelFor() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& w : workers) w.join();
+    }
+
+    // Calls f(begin, end) for ranges of at most chunkSize covering [0, n), returns once all of them ran.
+    // Small inputs stay on the calling thread, waking the workers would cost more than it saves.
+    void run(size_t n, size_t chunkSize, const std::function<void(size_t, size_t)>& f) {
+        if (workers.empty() || n <= chunkSize) {
+            if (n > 0) f(0, n);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &f;
+            count = n;
+            chunk = chunkSize;
+            nextChunk = 0;
+            running = workers.size();
+            generation++;
+        }
+        wake.notify_all();
+        work();
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&] { return running == 0; });
+    }
+
+    size_t getThreadCount() const { return workers.size() + 1; }
+};
+
+// Storage and syscall rates of one process, from /proc/[pid]/io.
+struct ProcessIo {
+    int pid = 0;
+    std::string comm;
+    double readMBps = 0;  // read_bytes, what actually hit the block layer
+    double writeMBps = 0; // write_bytes
+    double readOps = 0;   // syscr per second
+    double writeOps = 0;  // syscw per second
+};
+
+// Reads /proc/[pid]/io of every process each tick. The pid list is diffed against the previous scan so only
+// new processes pay for opening their files and reading comm, long lived processes keep their io file open
+// and are reread with a single pread. The reads are split across a few threads once there are enough pids.
+// /proc/[pid]/io of other users needs root or CAP_SYS_PTRACE, those processes are counted as unreadable.
+class ProcessStats {
+private:
+    struct Entry {
+        int pid = 0;
+        int fd = -1;           // cached /proc/[pid]/io, -1 until the process survived one scan
+        uint32_t scans = 0;    // scans the process was seen in
+        bool readable = true;  // false after EACCES, never retried
+        bool reset = false;    // the read failed, the pid may have been reused: reread comm, drop the counters
+        bool hasLast = false;
+        char comm[16] = {};    // TASK_COMM_LEN
+        uint64_t counters[4] = {}; // read_bytes, write_bytes, syscr, syscw
+        double rates[4] = {};
+    };
+
+    std::string procDir;
+    std::vector<Entry> entries; // sorted by pid
+    std::vector<Entry> merged;  // scratch for the pid diff
+    std::vector<int> pids;      // scratch for the directory listing
+    std::vector<uint32_t> order; // scratch for the top-N selection
+    std::vector<ProcessIo> top;
+
+    ParallelFor pool;
+    std::atomic<size_t> cachedFds{0};
+    size_t fdBudget = 0;
+    std::function<void(size_t, size_t)> readRange;
+
+    std::chrono::steady_clock::time_point lastTime;
+    double seconds = 0;
+    size_t unreadable = 0;
+
+    static constexpr size_t chunkSize = 1024;
+
+    void closeFd(Entry& e) {
+        if (e.fd < 0) return;
+        close(e.fd);
+        e.fd = -1;
+        cachedFds--;
+    }
+
+    void listPids() {
+        pids.clear();
+        DIR* dir = opendir(procDir.c_str());
+        if (!dir) return;
+        while (dirent* d = readdir(dir)) {
+            int pid;
+            if (parseNumber(std::string_view(d->d_name), pid)) pids.push_back(pid);
+        }
+        closedir(dir);
+        std::sort(pids.begin(), pids.end());
+    }
+
+    // Keeps the entries of pids that are still listed, adds new ones and closes the files of the ones that exited.
+    void diffPids() {
+        merged.clear();
+        size_t e = 0;
+        for (int pid : pids) {
+            while (e < entries.size() && entries[e].pid < pid) closeFd(entries[e++]);
+            if (e < entries.size() && entries[e].pid == pid) {
+                merged.push_back(entries[e++]);
+            } else {
+                merged.emplace_back();
+                merged.back().pid = pid;
+            }
+        }
+        while (e < entries.size()) closeFd(entries[e++]);
+        std::swap(entries, merged);
+    }
+
+    size_t pathOf(char* path, size_t size, int pid, const char* file) const {
+        return snprintf(path, size, "%s/%d/%s", procDir.c_str(), pid, file);
+    }
+
+    void readComm(Entry& e) {
+        char path[256];
+        pathOf(path, sizeof(path), e.pid, "comm");
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        ssize_t n = fd >= 0 ? pread(fd, e.comm, sizeof(e.comm) - 1, 0) : -1;
+        if (fd >= 0) close(fd);
+        if (n < 0) n = 0;
+        if (n > 0 && e.comm[n - 1] == '\n') n--;
+        e.comm[n] = 0;
+    }
+
+    // Runs on the pool, every entry is only touched by the thread that got its range.
+    void readEntry(Entry& e) {
+        if (e.reset || e.scans == 0) {
+            closeFd(e);
+            readComm(e);
+            e.hasLast = false;
+            e.reset = false;
+        }
+        e.scans++;
+        if (!e.readable) return;
+
+        int fd = e.fd;
+        if (fd < 0) {
+            char path[256];
+            pathOf(path, sizeof(path), e.pid, "io");
+            fd = open(path, O_RDONLY | O_CLOEXEC);
+        }
+        char buf[512];
+        ssize_t n = fd >= 0 ? pread(fd, buf, sizeof(buf) - 1, 0) : -1;
+        int error = n < 0 ? errno : 0;
+        if (e.fd < 0 && fd >= 0) {
+            // short lived processes are read with open/pread/close, the file is kept from the second scan on
+            if (n >= 0 && e.scans > 1 && cachedFds.fetch_add(1) < fdBudget) e.fd = fd;
+            else {
+                if (n >= 0 && e.scans > 1) cachedFds--;
+                close(fd);
+            }
+        }
+        if (n < 0) {
+            if (error == EACCES || error == EPERM) e.readable = false;
+            else e.reset = true; // gone, or the pid now belongs to another process
+            e.hasLast = false;
+            std::fill(std::begin(e.rates), std::end(e.rates), 0.0);
+            return;
+        }
+
+        std::string_view text(buf, n);
+        uint64_t values[4] = {e.counters[0], e.counters[1], e.counters[2], e.counters[3]};
+        size_t pos = 0;
+        while (pos < text.size()) {
+            std::string_view key = nextToken(text, pos);
+            std::string_view value = nextToken(text, pos);
+            if (key == "read_bytes:") parseNumber(value, values[0]);
+            else if (key == "write_bytes:") parseNumber(value, values[1]);
+            else if (key == "syscr:") parseNumber(value, values[2]);
+            else if (key == "syscw:") parseNumber(value, values[3]);
+        }
+        for (int i = 0; i < 4; i++) {
+            double delta = e.hasLast && values[i] >= e.counters[i] ? double(values[i] - e.counters[i]) : 0.0;
+            e.rates[i] = seconds > 0 ? delta / seconds / (i < 2 ? 1000000.0 : 1.0) : 0.0;
+            e.counters[i] = values[i];
+        }
+        e.hasLast = true;
+    }
+
+public:
+    // root is prepended to /proc, for fixture trees in benchmarks. threads are the extra scanning threads.
+    ProcessStats(std::string root = "", size_t threads = std::min(3u, std::thread::hardware_concurrency() / 2)) :
+        procDir(root + "/proc"), pool(threads), fdBudget(openFileBudget()) {
+        readRange = [this](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) readEntry(entries[i]);
+        };
+    }
+    ProcessStats(const ProcessStats&) = delete;
+    ProcessStats& operator=(const ProcessStats&) = delete;
+    ~ProcessStats() {
+        for (auto& e : entries) closeFd(e);
+    }
+
+    // Rescans every process and returns the n with the most storage I/O, highest first. Processes without
+    // storage I/O are ordered by their syscall rate. The first scan has no rates yet.
+    const std::vector<ProcessIo>& getTop(size_t n) {
+        auto now = std::chrono::steady_clock::now();
+        seconds = lastTime.time_since_epoch().count() ? std::chrono::duration<double>(now - lastTime).count() : 0;
+        lastTime = now;
+
+        listPids();
+        diffPids();
+        pool.run(entries.size(), chunkSize, readRange);
+
+        order.clear();
+        unreadable = 0;
+        for (uint32_t i = 0; i < entries.size(); i++) {
+            if (!entries[i].readable) unreadable++;
+            else if (entries[i].hasLast) order.push_back(i);
+        }
+        auto busier = [&](uint32_t a, uint32_t b) {
+            const double* ra = entries[a].rates;
+            const double* rb = entries[b].rates;
+            if (ra[0] + ra[1] != rb[0] + rb[1]) return ra[0] + ra[1] > rb[0] + rb[1];
+            return ra[2] + ra[3] > rb[2] + rb[3];
+        };
+        size_t count = std::min(n, order.size());
+        std::partial_sort(order.begin(), order.begin() + count, order.end(), busier);
+
+        top.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            const Entry& e = entries[order[i]];
+            top[i].pid = e.pid;
+            top[i].comm = e.comm; // at most 15 characters, fits the small string buffer
+            top[i].readMBps = e.rates[0];
+            top[i].writeMBps = e.rates[1];
+            top[i].readOps = e.rates[2];
+            top[i].writeOps = e.rates[3];
+        }
+        return top;
+    }
+
+    size_t getProcessCount() const { return entries.size(); }
+    size_t getUnreadableCount() const { return unreadable; }
+    size_t getCachedFileCount() const { return cachedFds.load(); }
+    size_t getThreadCount() const { return pool.getThreadCount(); }
+};
+
+struct ProcessSample {
+    std::vector<ProcessIo> top;
+    size_t processes = 0;
+    size_t unreadable = 0;
+    double scanMs = 0;
+};
+
+// ProcessStats on a BackgroundSampler, a scan of tens of thousands of processes does not belong on the GUI thread.
+class AsyncProcessStats {
+private:
+    ProcessStats stats; // only touched by the sampler thread
+    size_t topCount;
+    OverheadStage& stage = monitorOverhead().stage("collect: ProcessStats");
+    BackgroundSampler<ProcessSample> sampler;
+    SampleFrame<ProcessSample> latest;
+
+public:
+    AsyncProcessStats(size_t topCount = 20, std::chrono::milliseconds interval = std::chrono::milliseconds(1000)) :
+        topCount(topCount),
+        sampler(
+            [this](ProcessSample& s) {
+                OverheadScope scope(stage);
+                auto start = std::chrono::steady_clock::now();
+                s.top = stats.getTop(this->topCount);
+                s.processes = stats.getProcessCount();
+                s.unreadable = stats.getUnreadableCount();
+                s.scanMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            },
+            interval
+        ) {
+        sampler.start();
+    }
+
+    // Returns true when a new scan arrived since the last poll.
+    bool poll() { return sampler.poll(latest); }
+
+    const ProcessSample& getSample() const { return latest.data; }
+    SamplerCounters getCounters() const { return sampler.getCounters(); }
+};
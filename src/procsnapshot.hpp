@@ -0,0 +1,94 @@
+#pragma once
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "./fileutil.hpp"
+
+// Shares procfs/sysfs reads between collectors: every file is read at most once per sampling interval
+// into a reused buffer, no matter how many collectors look at it. Files are only opened once somebody
+// actually reads them through a subscription, so unused sources are never touched.
+class ProcSnapshot {
+private:
+    struct Entry {
+        ReusedFileReader reader;
+        std::mutex mutex;
+        std::string_view content;
+        std::chrono::steady_clock::time_point readAt;
+        bool valid = false;
+        uint64_t reads = 0;
+        uint64_t hits = 0;
+
+        Entry(std::string path) : reader(path) {}
+    };
+
+    std::mutex entriesMutex;
+    std::map<std::string, std::unique_ptr<Entry>> entries;
+
+public:
+    // A single consumer's view of one file, not shared between threads.
+    class File {
+    private:
+        Entry* entry = nullptr;
+        std::chrono::nanoseconds maxAge{0};
+        std::chrono::steady_clock::time_point lastSeen;
+
+    public:
+        File() {}
+        File(Entry* entry, std::chrono::nanoseconds maxAge) : entry(entry), maxAge(maxAge) {}
+
+        // Calls f with the file contents while the entry is locked. The cached contents are used if another
+        // consumer read the file after our previous call and no longer than maxAge ago, otherwise it is reread.
+        template <class F>
+        decltype(auto) with(F f) {
+            std::lock_guard<std::mutex> lock(entry->mutex);
+            auto now = std::chrono::steady_clock::now();
+            if (entry->valid && entry->readAt > lastSeen && now - entry->readAt < maxAge) {
+                entry->hits++;
+            } else {
+                entry->content = entry->reader.read();
+                entry->readAt = now;
+                entry->valid = true;
+                entry->reads++;
+            }
+            lastSeen = entry->readAt;
+            return f(entry->content);
+        }
+
+        const std::string& getPath() const { return entry->reader.getPath(); }
+    };
+
+    // Does not touch the file, it is opened on the first File::with() call.
+    File subscribe(const std::string& path, std::chrono::nanoseconds maxAge = std::chrono::milliseconds(50)) {
+        std::lock_guard<std::mutex> lock(entriesMutex);
+        auto& entry = entries[path];
+        if (!entry) entry = std::make_unique<Entry>(path);
+        return File(entry.get(), maxAge);
+    }
+
+    struct FileStats {
+        std::string path;
+        uint64_t reads;
+        uint64_t hits; // reads saved by sharing
+    };
+
+    std::vector<FileStats> getStats() {
+        std::lock_guard<std::mutex> lock(entriesMutex);
+        std::vector<FileStats> result;
+        for (auto& [path, entry] : entries) {
+            std::lock_guard<std::mutex> entryLock(entry->mutex);
+            result.push_back({path, entry->reads, entry->hits});
+        }
+        return result;
+    }
+};
+
+// The snapshot every collector uses unless it is handed a different one.
+ProcSnapshot& sharedProcSnapshot() {
+    static ProcSnapshot snapshot;
+    return snapshot;
+}
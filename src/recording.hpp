@@ -0,0 +1,491 @@
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Which collector a recorded series comes from.
+enum class CounterFamily : uint8_t { Disk = 1, Network = 2, Cpu = 3, Memory = 4 };
+
+// Recordings of raw cumulative counters. Every integer is a LEB128 varint, signed ones are zigzag encoded.
+//   "DIOREC2\n"
+//   'S' series:   id, family, name length, name, field count. Precedes the first frame that uses the series.
+//   'K' keyframe: time ms, series count, then per series the id delta and every field as an absolute value.
+//   'F' frame:    delta-of-delta of the time, series count, then per series the id delta, a bit mask of the
+//                 fields whose delta changed and a delta-of-delta per set bit. Every field of every series of the
+//                 keyframe advances by its previous delta, series without a changed delta are left out.
+// Keyframes are written every keyframeIntervalMs and whenever the set of series changes. They reset the decoder
+// and the deltas to 0, so a reader can start at any of them.
+// Idle devices and counters moving at a steady rate cost nothing per frame, busy ones a byte or two per counter
+// whose rate changed.
+constexpr char recordingMagic[] = "DIOREC2\n";
+constexpr size_t recordingMaxFields = 64;
+
+uint64_t zigzag(int64_t v) { return (uint64_t(v) << 1) ^ uint64_t(v >> 63); }
+int64_t unzigzag(uint64_t v) { return int64_t(v >> 1) ^ -int64_t(v & 1); }
+
+void putVarint(std::vector<uint8_t>& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(uint8_t(v) | 0x80);
+        v >>= 7;
+    }
+    out.push_back(uint8_t(v));
+}
+
+// Writes frames of counters to a file, one write() per frame so a crash loses at most the frame in flight.
+// Allocates only when a series is first seen.
+class RecordingWriter {
+private:
+    struct Series {
+        std::vector<uint64_t> values; // as last written
+        std::vector<int64_t> deltas;  // of the last frame, 0 after a keyframe
+        bool inKeyframe = false;      // deltas are only valid for series a reader starting at the keyframe knows
+    };
+
+    int fd = -1;
+    std::map<std::string, uint32_t, std::less<>> index; // family byte + name
+    std::vector<Series> series;
+    std::string key;
+    std::vector<uint32_t> frameSeries; // ids added since beginFrame(), in order
+    std::vector<uint64_t> frameValues; // their fields, concatenated
+    std::vector<uint8_t> out;
+    std::vector<uint8_t> body;
+    int64_t frameTime = 0;
+    int64_t lastTime = 0;
+    int64_t lastDelta = 0;
+    int64_t lastKeyframe = 0;
+    size_t keyframeSeries = 0; // series in the last keyframe
+    bool hasFrame = false;
+    bool failed = false;
+    uint64_t bytes = 0;
+    uint64_t frames = 0;
+
+    void flush() {
+        size_t done = 0;
+        while (done < out.size()) {
+            ssize_t n = write(fd, out.data() + done, out.size() - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                failed = true;
+                break;
+            }
+            done += n;
+        }
+        bytes += done;
+        out.clear();
+    }
+
+public:
+    int64_t keyframeIntervalMs = 60000;
+
+    RecordingWriter() = default;
+    RecordingWriter(const RecordingWriter&) = delete;
+    RecordingWriter& operator=(const RecordingWriter&) = delete;
+    ~RecordingWriter() {
+        if (fd >= 0) close(fd);
+    }
+
+    // Truncates path, returns false with errno set if it cannot be created.
+    bool open(const std::string& path) {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+        out.assign(recordingMagic, recordingMagic + sizeof(recordingMagic) - 1);
+        flush();
+        return !failed;
+    }
+
+    void beginFrame(int64_t timeMs) {
+        frameTime = timeMs;
+        frameSeries.clear();
+        frameValues.clear();
+    }
+
+    // count is fixed per series by its first frame, extra fields are dropped and missing ones are 0.
+    void add(CounterFamily family, std::string_view name, const uint64_t* values, size_t count) {
+        key.assign(1, char(family));
+        key.append(name);
+        auto it = index.find(key);
+        if (it == index.end()) {
+            uint32_t id = series.size();
+            it = index.emplace(key, id).first;
+            size_t fields = std::min(count, recordingMaxFields);
+            series.push_back({std::vector<uint64_t>(fields), std::vector<int64_t>(fields)});
+            out.push_back('S');
+            putVarint(out, id);
+            out.push_back(uint8_t(family));
+            putVarint(out, name.size());
+            out.insert(out.end(), name.begin(), name.end());
+            putVarint(out, series.back().values.size());
+        }
+        size_t fields = series[it->second].values.size();
+        frameSeries.push_back(it->second);
+        for (size_t f = 0; f < fields; f++) frameValues.push_back(f < count ? values[f] : 0);
+    }
+
+    // Encodes and writes the frame, returns false once a write failed.
+    bool endFrame() {
+        if (failed) return false;
+        bool keyframe = !hasFrame || frameTime - lastKeyframe >= keyframeIntervalMs;
+        // a device appeared, or one went away and must not look idle to the reader
+        for (uint32_t id : frameSeries) keyframe = keyframe || !series[id].inKeyframe;
+        keyframe = keyframe || frameSeries.size() != keyframeSeries;
+        if (keyframe) {
+            for (auto& s : series) s.inKeyframe = false;
+            for (uint32_t id : frameSeries) series[id].inKeyframe = true;
+            keyframeSeries = frameSeries.size();
+        }
+        body.clear();
+        size_t entries = 0;
+        int64_t previousId = 0;
+        const uint64_t* values = frameValues.data();
+        for (uint32_t id : frameSeries) {
+            std::vector<uint64_t>& old = series[id].values;
+            std::vector<int64_t>& deltas = series[id].deltas;
+            size_t fields = old.size();
+            bool written = keyframe;
+            if (keyframe) {
+                putVarint(body, zigzag(int64_t(id) - previousId));
+                for (size_t f = 0; f < fields; f++) putVarint(body, values[f]);
+                std::fill(deltas.begin(), deltas.end(), 0);
+            } else {
+                // wrapping subtractions, a counter reset becomes a negative delta
+                uint64_t mask = 0;
+                for (size_t f = 0; f < fields; f++) {
+                    if (int64_t(values[f] - old[f]) != deltas[f]) mask |= uint64_t(1) << f;
+                }
+                if (mask != 0) {
+                    putVarint(body, zigzag(int64_t(id) - previousId));
+                    putVarint(body, mask);
+                    for (size_t f = 0; f < fields; f++) {
+                        if (!(mask >> f & 1)) continue;
+                        int64_t delta = int64_t(values[f] - old[f]);
+                        putVarint(body, zigzag(int64_t(uint64_t(delta) - uint64_t(deltas[f]))));
+                        deltas[f] = delta;
+                    }
+                    written = true;
+                }
+            }
+            if (written) {
+                previousId = id;
+                entries++;
+            }
+            std::copy(values, values + fields, old.begin());
+            values += fields;
+        }
+
+        if (keyframe) {
+            out.push_back('K');
+            putVarint(out, zigzag(frameTime));
+            lastDelta = 0;
+            lastKeyframe = frameTime;
+        } else {
+            int64_t delta = frameTime - lastTime;
+            out.push_back('F');
+            putVarint(out, zigzag(delta - lastDelta));
+            lastDelta = delta;
+        }
+        putVarint(out, entries);
+        out.insert(out.end(), body.begin(), body.end());
+        lastTime = frameTime;
+        hasFrame = true;
+        frames++;
+        flush();
+        return !failed;
+    }
+
+    bool ok() const { return fd >= 0 && !failed; }
+    uint64_t getBytesWritten() const { return bytes; }
+    uint64_t getFrameCount() const { return frames; }
+};
+
+struct RecordedSeries {
+    CounterFamily family;
+    std::string name;
+    size_t fields;
+};
+
+// A recording read into memory and indexed: the series and the offset of every keyframe. A file that ends
+// in the middle of a frame, e.g. after a crash, is cut back to its last complete frame.
+class Recording {
+private:
+    friend class RecordingCursor;
+
+    struct Keyframe {
+        int64_t timeMs;
+        size_t offset;
+    };
+
+    std::vector<uint8_t> data;
+    std::vector<RecordedSeries> series;
+    std::vector<Keyframe> keyframes;
+    int64_t firstTime = 0;
+    int64_t lastTime = 0;
+    size_t frames = 0;
+    std::string error;
+
+public:
+    // Bounds checked reads over data, ok turns false at the first read past the end.
+    struct Decoder {
+        const std::vector<uint8_t>& data;
+        size_t pos;
+        bool ok = true;
+
+        uint64_t varint() {
+            uint64_t v = 0;
+            for (int shift = 0; shift < 64; shift += 7) {
+                if (pos >= data.size()) break;
+                uint8_t b = data[pos++];
+                v |= uint64_t(b & 0x7f) << shift;
+                if (!(b & 0x80)) return v;
+            }
+            ok = false;
+            return 0;
+        }
+        int64_t svarint() { return unzigzag(varint()); }
+        uint8_t byte() {
+            if (pos >= data.size()) {
+                ok = false;
+                return 0;
+            }
+            return data[pos++];
+        }
+    };
+
+    bool open(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) < 0) {
+            error = path + ": " + strerror(errno);
+            if (fd >= 0) close(fd);
+            return false;
+        }
+        data.resize(st.st_size);
+        size_t done = 0;
+        while (done < data.size()) {
+            ssize_t n = read(fd, data.data() + done, data.size() - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            done += n;
+        }
+        close(fd);
+        data.resize(done);
+
+        size_t magic = sizeof(recordingMagic) - 1;
+        if (data.size() < magic || memcmp(data.data(), recordingMagic, magic) != 0) {
+            error = path + " is not a diskio recording";
+            return false;
+        }
+
+        Decoder d{data, magic};
+        int64_t time = 0;
+        int64_t delta = 0;
+        size_t complete = d.pos;
+        while (d.pos < data.size()) {
+            size_t start = d.pos;
+            uint8_t tag = d.byte();
+            if (tag == 'S') {
+                uint64_t id = d.varint();
+                CounterFamily family = CounterFamily(d.byte());
+                uint64_t length = d.varint();
+                if (!d.ok || id != series.size() || length > data.size() - d.pos) break;
+                std::string name((const char*)data.data() + d.pos, length);
+                d.pos += length;
+                uint64_t fields = d.varint();
+                if (!d.ok || fields > recordingMaxFields) break;
+                series.push_back({family, std::move(name), size_t(fields)});
+            } else if (tag == 'K' || tag == 'F') {
+                if (tag == 'K') {
+                    time = d.svarint();
+                    delta = 0;
+                } else {
+                    delta += d.svarint();
+                    time += delta;
+                }
+                uint64_t entries = d.varint();
+                int64_t id = 0;
+                for (uint64_t e = 0; e < entries && d.ok; e++) {
+                    id += d.svarint();
+                    if (id < 0 || size_t(id) >= series.size()) d.ok = false;
+                    if (!d.ok) break;
+                    uint64_t mask = tag == 'K' ? ~uint64_t(0) : d.varint();
+                    for (size_t f = 0; f < series[id].fields; f++) {
+                        if (mask >> f & 1) d.varint();
+                    }
+                }
+                if (!d.ok) break;
+                if (tag == 'K') keyframes.push_back({time, start});
+                if (frames == 0) firstTime = time;
+                lastTime = time;
+                frames++;
+            } else {
+                break;
+            }
+            complete = d.pos;
+        }
+        data.resize(complete);
+        return true;
+    }
+
+    const std::vector<RecordedSeries>& getSeries() const { return series; }
+    int64_t getFirstTime() const { return firstTime; }
+    int64_t getLastTime() const { return lastTime; }
+    size_t getFrameCount() const { return frames; }
+    size_t getKeyframeCount() const { return keyframes.size(); }
+    size_t getSize() const { return data.size(); }
+    const std::string& getError() const { return error; }
+};
+
+// Decodes a Recording frame by frame and keeps the current counters of every series. Cursors are independent,
+// any number of them can read one Recording from different threads.
+class RecordingCursor {
+private:
+    const Recording& recording;
+    size_t pos = 0; // next record, data.size() at the end
+    int64_t time = 0;
+    int64_t delta = 0;
+    bool started = false;
+    std::vector<size_t> offsets; // [series] into values
+    std::vector<uint64_t> values;
+    std::vector<int64_t> deltas;   // [offset] of the last frame, every series of the keyframe advances by them
+    std::vector<uint32_t> moving;  // series with a nonzero delta, or a stale entry with moves[series] 0
+    std::vector<uint8_t> moves;    // [series] is in moving and has a nonzero delta
+    std::vector<uint8_t> seen;     // [series] had a value since the keyframe the cursor started from
+
+    size_t skipDefinitions(size_t at) const {
+        Recording::Decoder d{recording.data, at};
+        while (d.pos < recording.data.size() && recording.data[d.pos] == 'S') {
+            d.byte();
+            d.varint();
+            d.byte();
+            d.pos += d.varint();
+            d.varint();
+        }
+        return d.pos;
+    }
+
+    // Time of the frame at at, without decoding it.
+    bool peekTime(size_t at, int64_t& out) const {
+        at = skipDefinitions(at);
+        if (at >= recording.data.size()) return false;
+        Recording::Decoder d{recording.data, at};
+        uint8_t tag = d.byte();
+        if (tag == 'K') out = d.svarint();
+        else if (!started)
+            return false;
+        else
+            out = time + delta + d.svarint();
+        return d.ok;
+    }
+
+    bool decode() {
+        size_t at = skipDefinitions(pos);
+        if (at >= recording.data.size()) return false;
+        Recording::Decoder d{recording.data, at};
+        uint8_t tag = d.byte();
+        if (tag == 'K') {
+            time = d.svarint();
+            delta = 0;
+            std::fill(seen.begin(), seen.end(), 0);
+            std::fill(deltas.begin(), deltas.end(), 0);
+            std::fill(moves.begin(), moves.end(), 0);
+            moving.clear();
+        } else {
+            if (!started) return false;
+            delta += d.svarint();
+            time += delta;
+            // every series of the keyframe advances by its deltas, only the moving ones have any
+            size_t kept = 0;
+            for (uint32_t id : moving) {
+                if (!moves[id]) continue;
+                size_t begin = offsets[id], end = begin + recording.series[id].fields;
+                for (size_t i = begin; i < end; i++) values[i] += uint64_t(deltas[i]);
+                moving[kept++] = id;
+            }
+            moving.resize(kept);
+        }
+        uint64_t entries = d.varint();
+        int64_t id = 0;
+        for (uint64_t e = 0; e < entries; e++) {
+            id += d.svarint();
+            const RecordedSeries& s = recording.series[id];
+            uint64_t* v = &values[offsets[id]];
+            int64_t* dv = &deltas[offsets[id]];
+            if (tag == 'K') {
+                for (size_t f = 0; f < s.fields; f++) v[f] = d.varint();
+                seen[id] = 1;
+            } else {
+                // the previous deltas are already applied, add the change of each set field on top
+                uint64_t mask = d.varint();
+                for (size_t f = 0; f < s.fields; f++) {
+                    if (!(mask >> f & 1)) continue;
+                    int64_t change = d.svarint();
+                    v[f] += uint64_t(change);
+                    dv[f] = int64_t(uint64_t(dv[f]) + uint64_t(change));
+                }
+                bool nonzero = std::any_of(dv, dv + s.fields, [](int64_t v) { return v != 0; });
+                if (nonzero && !moves[id]) moving.push_back(id);
+                moves[id] = nonzero;
+            }
+        }
+        pos = d.pos;
+        started = true;
+        return true;
+    }
+
+public:
+    RecordingCursor(const Recording& recording) : recording(recording) {
+        size_t total = 0;
+        for (auto& s : recording.series) {
+            offsets.push_back(total);
+            total += s.fields;
+        }
+        values.assign(total, 0);
+        deltas.assign(total, 0);
+        moves.assign(recording.series.size(), 0);
+        moving.reserve(recording.series.size());
+        seen.assign(recording.series.size(), 0);
+        seek(recording.firstTime);
+    }
+
+    // Decodes the next frame, false at the end of the recording.
+    bool next() { return decode(); }
+
+    // Moves forward to the newest frame at or before timeMs, returns false if there was none.
+    bool advanceTo(int64_t timeMs) {
+        bool moved = false;
+        int64_t t;
+        while (peekTime(pos, t) && t <= timeMs && decode()) moved = true;
+        return moved;
+    }
+
+    // Jumps to the newest frame at or before timeMs, or the first frame for earlier times.
+    void seek(int64_t timeMs) {
+        const auto& keyframes = recording.keyframes;
+        started = false;
+        if (keyframes.empty()) {
+            pos = recording.data.size();
+            return;
+        }
+        auto it = std::upper_bound(keyframes.begin(), keyframes.end(), timeMs, [](int64_t t, const auto& k) {
+            return t < k.timeMs;
+        });
+        if (it != keyframes.begin()) --it;
+        pos = it->offset;
+        decode();
+        advanceTo(timeMs);
+    }
+
+    int64_t getTime() const { return time; }
+    bool atEnd() const { return skipDefinitions(pos) >= recording.data.size(); }
+    bool isSeen(size_t series) const { return seen[series]; }
+    const uint64_t* getValues(size_t series) const { return &values[offsets[series]]; }
+    const Recording& getRecording() const { return recording; }
+};
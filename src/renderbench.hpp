@@ -0,0 +1,94 @@
+#pragma once
+
+#include <QApplication>
+#include <QElapsedTimer>
+#include <cmath>
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include <random>
+#include <string>
+#include <utility>
+
+#include "./DiskUsageWidget.hpp"
+
+// Random walk rates for a fixed number of made up devices, drives the renderers without real disks.
+class SyntheticStats {
+private:
+    std::map<std::string, std::pair<double, double>> mbps;
+    std::mt19937 rng{42};
+
+public:
+    SyntheticStats(size_t devices = 10) {
+        for (size_t i = 0; i < devices; i++) mbps["dev" + std::to_string(i)] = {0, 0};
+    }
+
+    const std::map<std::string, std::pair<double, double>>& getRate() {
+        std::normal_distribution<double> step(0, 5);
+        for (auto& [_, rate] : mbps) {
+            rate.first = std::abs(rate.first + step(rng));
+            rate.second = std::abs(rate.second + step(rng));
+        }
+        return mbps;
+    }
+};
+
+struct RenderBenchResult {
+    double firstFrameMs; // creating the charts for every device and painting them once
+    double meanFrameMs;  // one tick: new sample for every device plus a synchronous repaint
+    double maxFrameMs;
+};
+
+// Fills the history like a minute of 250 ms ticks would, then times frames the way the UI timer drives them.
+template <class WIDGET>
+RenderBenchResult timeFrames(WIDGET& widget, int frames) {
+    RenderBenchResult result{};
+    widget.resize(1600, 1000);
+    widget.show();
+
+    QElapsedTimer timer;
+    timer.start();
+    widget.updateData();
+    QApplication::processEvents();
+    widget.repaint();
+    result.firstFrameMs = timer.nsecsElapsed() / 1e6;
+
+    for (int i = 0; i < 240; i++) widget.updateData();
+    QApplication::processEvents();
+
+    double total = 0;
+    for (int i = 0; i < frames; i++) {
+        timer.restart();
+        widget.updateData();
+        QApplication::processEvents();
+        widget.repaint();
+        double ms = timer.nsecsElapsed() / 1e6;
+        total += ms;
+        result.maxFrameMs = std::max(result.maxFrameMs, ms);
+    }
+    result.meanFrameMs = total / frames;
+    widget.hide();
+    return result;
+}
+
+// Prints frame times of the QtCharts grid and the compact grid for each device count.
+void runRenderBench(std::ostream& out, std::vector<int> deviceCounts = {10, 100, 500}, int frames = 50) {
+    out << std::left << std::setw(10) << "devices" << std::setw(10) << "renderer" << std::right << std::setw(16)
+        << "first frame ms" << std::setw(12) << "mean ms" << std::setw(12) << "max ms" << std::endl;
+    auto print = [&](int devices, const char* renderer, const RenderBenchResult& r) {
+        out << std::left << std::setw(10) << devices << std::setw(10) << renderer << std::right << std::fixed
+            << std::setprecision(2) << std::setw(16) << r.firstFrameMs << std::setw(12) << r.meanFrameMs
+            << std::setw(12) << r.maxFrameMs << std::endl;
+    };
+    for (int devices : deviceCounts) {
+        {
+            DiskUsageWidget<SyntheticStats> charts(nullptr, devices);
+            print(devices, "qtcharts", timeFrames(charts, frames));
+        }
+        {
+            DiskUsageWidget<SyntheticStats> compact(nullptr, devices);
+            compact.setCompact(true);
+            print(devices, "compact", timeFrames(compact, frames));
+        }
+    }
+}
@@ -0,0 +1,378 @@
+#pragma once
+#include <chrono>
+#include <cstdio>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "./netlinkstats.hpp"
+#include "./procdiskstats.hpp"
+#include "./recording.hpp"
+#include "./sampleframe.hpp"
+#include "./systemstats.hpp"
+
+// Field order of the recorded series: DiskCounters in declaration order with fieldCount last, (rx, tx) bytes for
+// links, CpuState jiffies for cpu slots and (MemTotal, MemAvailable) kB for memory.
+constexpr size_t recordedDiskFields = 18;
+
+void diskCountersToFields(const DiskCounters& c, uint64_t* out) {
+    const uint64_t fields[] = {
+        c.readIos,      c.readMerges,  c.readSectors, c.readTicks,    c.writeIos,       c.writeMerges,
+        c.writeSectors, c.writeTicks,  c.inFlight,    c.ioTicks,      c.timeInQueue,    c.discardIos,
+        c.discardMerges, c.discardSectors, c.discardTicks, c.flushIos, c.flushTicks,     c.fieldCount,
+    };
+    std::copy(fields, fields + recordedDiskFields, out);
+}
+
+DiskCounters diskCountersFromFields(const uint64_t* v) {
+    DiskCounters c;
+    uint64_t* dst[] = {
+        &c.readIos,      &c.readMerges,  &c.readSectors, &c.readTicks,    &c.writeIos,       &c.writeMerges,
+        &c.writeSectors, &c.writeTicks,  &c.inFlight,    &c.ioTicks,      &c.timeInQueue,    &c.discardIos,
+        &c.discardMerges, &c.discardSectors, &c.discardTicks, &c.flushIos, &c.flushTicks,
+    };
+    for (size_t f = 0; f < recordedDiskFields - 1; f++) *dst[f] = v[f];
+    c.fieldCount = uint8_t(v[recordedDiskFields - 1]);
+    return c;
+}
+
+// "cpu" for the aggregate slot 0, "cpu<n>" for slot n + 1, like the rows of /proc/stat.
+std::string_view cpuSlotName(size_t slot, char (&buffer)[24]) {
+    if (slot == 0) return "cpu";
+    return std::string_view(buffer, snprintf(buffer, sizeof(buffer), "cpu%zu", slot - 1));
+}
+
+// Adds the counters of the last sample of each collector to one frame, null collectors are left out.
+bool recordCounters(
+    RecordingWriter& writer, int64_t timeMs, const ProcDiskStats* disk, const NetlinkNetworkStats* net,
+    const SystemStats* system
+) {
+    uint64_t v[std::max<size_t>(recordedDiskFields, CpuStateCount)];
+    writer.beginFrame(timeMs);
+    if (disk) {
+        disk->forEachCounters([&](const std::string& name, const DiskCounters& c) {
+            diskCountersToFields(c, v);
+            writer.add(CounterFamily::Disk, name, v, recordedDiskFields);
+        });
+    }
+    if (net) {
+        net->forEachCounters([&](const std::string& name, const rtnl_link_stats64& s) {
+            v[0] = s.rx_bytes;
+            v[1] = s.tx_bytes;
+            writer.add(CounterFamily::Network, name, v, 2);
+        });
+    }
+    if (system) {
+        const CpuStats& cpu = system->getCpuStats();
+        char name[24];
+        for (size_t slot = 0; slot < cpu.getSlots(); slot++) {
+            for (int s = 0; s < CpuStateCount; s++) v[s] = cpu.getJiffies(s, slot);
+            writer.add(CounterFamily::Cpu, cpuSlotName(slot, name), v, CpuStateCount);
+        }
+        if (system->getMemoryTotalKB() > 0) {
+            v[0] = system->getMemoryTotalKB();
+            v[1] = system->getMemoryAvailableKB();
+            writer.add(CounterFamily::Memory, "mem", v, 2);
+        }
+    }
+    return writer.endFrame();
+}
+
+// Samples the live collectors on its own thread and records their counters, for --record in the GUI. Reads go
+// through the shared ProcSnapshot, so the charts sampling the same files at the same time cost little extra.
+class CounterRecorder {
+private:
+    ProcDiskStats disk;
+    NetlinkNetworkStats net;
+    SystemStats system;
+    RecordingWriter writer;
+    std::chrono::milliseconds interval;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::string error;
+
+    void run() {
+        auto next = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping) {
+            lock.unlock();
+            disk.getFrame();
+            net.getFrame();
+            system.getCpuUsage();
+            system.getMemoryUsage();
+            int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                              std::chrono::system_clock::now().time_since_epoch()
+            ).count();
+            bool ok = recordCounters(writer, now, &disk, &net, &system);
+            lock.lock();
+            if (!ok) {
+                error = std::string("recording stopped: ") + strerror(errno);
+                break;
+            }
+            next += interval;
+            wake.wait_until(lock, next, [this] { return stopping; });
+        }
+    }
+
+public:
+    CounterRecorder(std::chrono::milliseconds interval = std::chrono::milliseconds(250)) : interval(interval) {}
+    CounterRecorder(const CounterRecorder&) = delete;
+    CounterRecorder& operator=(const CounterRecorder&) = delete;
+
+    ~CounterRecorder() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (worker.joinable()) worker.join();
+    }
+
+    bool start(const std::string& path) {
+        if (!writer.open(path)) {
+            error = path + ": " + strerror(errno);
+            return false;
+        }
+        worker = std::thread([this] { run(); });
+        return true;
+    }
+
+    std::string getError() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return error;
+    }
+};
+
+// Recording time as a function of real time, shared by the replay collectors so they stay in step. Set from the
+// GUI thread, read from the sampler threads.
+class ReplayClock {
+private:
+    mutable std::mutex mutex;
+    std::chrono::steady_clock::time_point base = std::chrono::steady_clock::now();
+    int64_t baseMs;
+    double speed;
+
+public:
+    ReplayClock(int64_t startMs, double speed = 1.0) : baseMs(startMs), speed(speed) {}
+
+    int64_t now() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - base).count();
+        return baseMs + int64_t(elapsedMs * speed);
+    }
+
+    void seek(int64_t ms) {
+        std::lock_guard<std::mutex> lock(mutex);
+        base = std::chrono::steady_clock::now();
+        baseMs = ms;
+    }
+
+    void setSpeed(double newSpeed) {
+        int64_t current = now();
+        std::lock_guard<std::mutex> lock(mutex);
+        base = std::chrono::steady_clock::now();
+        baseMs = current;
+        speed = newSpeed;
+    }
+
+    double getSpeed() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return speed;
+    }
+};
+
+// One replay collector's position in a recording. Each sample moves to the newest frame the clock has reached
+// and keeps the counters of the frame before, rates come from the two like from two live reads. The counters
+// are cumulative, so jumps of more than a keyframe interval seek instead of decoding every frame in between.
+class ReplayCursor {
+private:
+    RecordingCursor cursor;
+    const ReplayClock& clock;
+    std::vector<uint64_t> previous; // [offset] counters at previousTime, laid out like the cursor
+    std::vector<uint8_t> previousSeen;
+    std::vector<size_t> offsets;
+    int64_t previousTime = 0;
+    bool hasPrevious = false;
+    int64_t seekDistanceMs;
+
+public:
+    ReplayCursor(const Recording& recording, const ReplayClock& clock, int64_t seekDistanceMs = 60000) :
+        cursor(recording), clock(clock), seekDistanceMs(seekDistanceMs) {
+        size_t total = 0;
+        for (auto& s : recording.getSeries()) {
+            offsets.push_back(total);
+            total += s.fields;
+        }
+        previous.assign(total, 0);
+        previousSeen.assign(recording.getSeries().size(), 0);
+    }
+
+    // Recorded seconds between the previous and the current frame, 0 if the clock has not reached a new frame
+    // or there is no previous one.
+    double advance() {
+        int64_t target = clock.now();
+        int64_t before = cursor.getTime();
+        if (target < before || target - before > seekDistanceMs) {
+            cursor.seek(target);
+            if (target < before) hasPrevious = false; // went backwards, no interval to compute rates over
+        } else {
+            cursor.advanceTo(target);
+        }
+        return hasPrevious ? (cursor.getTime() - previousTime) / 1000.0 : 0.0;
+    }
+
+    // Keeps the current counters as the previous ones of the next advance().
+    void commit() {
+        const auto& series = cursor.getRecording().getSeries();
+        for (size_t i = 0; i < series.size(); i++) {
+            previousSeen[i] = cursor.isSeen(i);
+            std::copy(cursor.getValues(i), cursor.getValues(i) + series[i].fields, &previous[offsets[i]]);
+        }
+        previousTime = cursor.getTime();
+        hasPrevious = true;
+    }
+
+    bool hasBoth(size_t series) const { return hasPrevious && previousSeen[series] && cursor.isSeen(series); }
+    const uint64_t* current(size_t series) const { return cursor.getValues(series); }
+    const uint64_t* last(size_t series) const { return &previous[offsets[series]]; }
+    int64_t getTime() const { return cursor.getTime(); }
+};
+
+// Series ids of one family with their frame ids.
+std::vector<std::pair<size_t, uint32_t>> seriesOf(const Recording& recording, CounterFamily family, DeviceIds& ids) {
+    std::vector<std::pair<size_t, uint32_t>> result;
+    const auto& series = recording.getSeries();
+    for (size_t i = 0; i < series.size(); i++) {
+        if (series[i].family == family) result.push_back({i, ids.intern(series[i].name)});
+    }
+    return result;
+}
+
+// ProcDiskStats played back from a recording, the same frames and DiskMetrics at the clock's pace.
+class ReplayDiskStats {
+private:
+    ReplayCursor cursor;
+    DeviceIds ids;
+    std::vector<std::pair<size_t, uint32_t>> disks;
+    DeviceFrame<DiskMetrics> frame;
+
+public:
+    ReplayDiskStats(const Recording& recording, const ReplayClock& clock) : cursor(recording, clock) {
+        disks = seriesOf(recording, CounterFamily::Disk, ids);
+        frame.resize(ids);
+    }
+
+    const DeviceFrame<DiskMetrics>& getFrame() {
+        double seconds = cursor.advance();
+        if (seconds <= 0) {
+            cursor.commit();
+            return frame; // nothing new, the previous frame stays
+        }
+        for (auto& [series, id] : disks) {
+            bool both = cursor.hasBoth(series);
+            DiskCounters cur, last;
+            if (both) {
+                cur = diskCountersFromFields(cursor.current(series));
+                last = diskCountersFromFields(cursor.last(series));
+                both = diskCountersAdvanced(cur, last); // a reset the recording kept as a negative delta
+            }
+            frame.metrics[id] = both ? computeDiskMetrics(cur, last, seconds) : DiskMetrics{};
+            frame.read[id] = frame.metrics[id].readMBps;
+            frame.write[id] = frame.metrics[id].writeMBps;
+            frame.present[id] = both;
+        }
+        cursor.commit();
+        return frame;
+    }
+};
+
+// NetlinkNetworkStats played back from a recording.
+class ReplayNetworkStats {
+private:
+    ReplayCursor cursor;
+    DeviceIds ids;
+    std::vector<std::pair<size_t, uint32_t>> links;
+    DeviceFrame<NoMetrics> frame;
+
+public:
+    ReplayNetworkStats(const Recording& recording, const ReplayClock& clock) : cursor(recording, clock) {
+        links = seriesOf(recording, CounterFamily::Network, ids);
+        frame.resize(ids);
+    }
+
+    const DeviceFrame<NoMetrics>& getFrame() {
+        double seconds = cursor.advance();
+        if (seconds <= 0) {
+            cursor.commit();
+            return frame;
+        }
+        for (auto& [series, id] : links) {
+            const uint64_t* cur = cursor.current(series);
+            const uint64_t* last = cursor.last(series);
+            bool both = cursor.hasBoth(series) && cur[0] >= last[0] && cur[1] >= last[1]; // no rate across a reset
+            frame.read[id] = both ? (cur[0] - last[0]) / 1000000.0 / seconds : 0.0;
+            frame.write[id] = both ? (cur[1] - last[1]) / 1000000.0 / seconds : 0.0;
+            frame.present[id] = both;
+        }
+        cursor.commit();
+        return frame;
+    }
+};
+
+// SystemStats played back from a recording, as the SystemSample source of AsyncSystemStats.
+class ReplaySystemStats {
+private:
+    ReplayCursor cursor;
+    std::vector<size_t> cpuSeries; // [slot] series id, -1 for slots the recording does not have
+    size_t memSeries = size_t(-1);
+    std::vector<uint64_t> current; // [state * slots + slot]
+    std::vector<uint64_t> last;
+    std::vector<float> total;
+    SystemSample sample;
+
+public:
+    ReplaySystemStats(const Recording& recording, const ReplayClock& clock) : cursor(recording, clock) {
+        const auto& series = recording.getSeries();
+        for (size_t i = 0; i < series.size(); i++) {
+            if (series[i].family == CounterFamily::Memory) memSeries = i;
+            if (series[i].family != CounterFamily::Cpu) continue;
+            std::string_view name = series[i].name;
+            size_t slot = 0;
+            if (name.size() > 3 && parseNumber(name.substr(3), slot)) slot++;
+            if (slot >= cpuSeries.size()) cpuSeries.resize(slot + 1, size_t(-1));
+            cpuSeries[slot] = i;
+        }
+        size_t slots = cpuSeries.size();
+        current.assign(CpuStateCount * slots, 0);
+        last.assign(CpuStateCount * slots, 0);
+        sample.cores.slots = slots;
+        sample.cores.busy.assign(slots, 0);
+        sample.cores.statePercent.assign(CpuStateCount * slots, 0);
+    }
+
+    // The newest interval the clock has reached, the previous sample again if there is none yet.
+    SystemSample next() {
+        double seconds = cursor.advance();
+        if (seconds > 0) {
+            size_t slots = cpuSeries.size();
+            for (size_t slot = 0; slot < slots; slot++) {
+                size_t s = cpuSeries[slot];
+                bool both = s != size_t(-1) && cursor.hasBoth(s);
+                for (int state = 0; state < CpuStateCount; state++) {
+                    current[state * slots + slot] = both ? cursor.current(s)[state] : 0;
+                    last[state * slots + slot] = both ? cursor.last(s)[state] : 0;
+                }
+            }
+            computeCpuUsage(current.data(), last.data(), slots, total, sample.cores);
+            sample.cpu = slots > 0 ? int(std::lround(sample.cores.busy[0])) : -1;
+            if (memSeries != size_t(-1) && cursor.hasBoth(memSeries)) {
+                sample.memory = memoryUsagePercent(cursor.current(memSeries)[0], cursor.current(memSeries)[1]);
+            }
+        }
+        cursor.commit();
+        return sample;
+    }
+};
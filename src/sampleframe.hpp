@@ -0,0 +1,172 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "./diskmetrics.hpp"
+
+struct NoMetrics {};
+
+// Hands out dense ids for device names, so consumers can keep per device state in plain vectors indexed by them.
+// An id stays with its name across hotplug unless the collector releases it for a device that is gone for good
+// (a removed cgroup), the next new name then reuses it and the ids stay as many as the devices present at once.
+// Consumers that keep per id state check the names of a frame whose idVersion changed.
+class DeviceIds {
+private:
+    std::map<std::string, uint32_t, std::less<>> index;
+    std::vector<std::string> names; // [id], empty for released ids
+    std::vector<uint32_t> released;
+    uint64_t version = 0; // bumped whenever names changes
+
+public:
+    static constexpr uint32_t none = uint32_t(-1);
+
+    uint32_t intern(std::string_view name) {
+        auto it = index.find(name);
+        if (it != index.end()) return it->second;
+        uint32_t id = names.size();
+        if (!released.empty()) {
+            id = released.back();
+            released.pop_back();
+            names[id] = name;
+        } else {
+            names.emplace_back(name);
+        }
+        index.emplace(names[id], id);
+        version++;
+        return id;
+    }
+
+    // Frees the id of a device that will not come back, its name gets a new id if it does.
+    void release(uint32_t id) {
+        auto it = index.find(names[id]);
+        if (it == index.end() || it->second != id) return;
+        index.erase(it);
+        names[id].clear();
+        released.push_back(id);
+        version++;
+    }
+
+    uint32_t find(std::string_view name) const {
+        auto it = index.find(name);
+        return it == index.end() ? none : it->second;
+    }
+
+    size_t size() const { return names.size(); }
+    const std::vector<std::string>& getNames() const { return names; }
+    uint64_t getVersion() const { return version; }
+};
+
+// One tick of every device as parallel arrays indexed by DeviceIds id. Copy assigning a frame of the same size
+// reuses the storage, so passing frames around does not allocate once the device set is stable.
+template <class METRICS = NoMetrics>
+struct DeviceFrame {
+    using Metrics = METRICS;
+
+    std::vector<std::string> names; // [id]
+    std::vector<double> read;       // [id] MB/s, received for network links
+    std::vector<double> write;      // [id] MB/s, sent for network links
+    std::vector<uint8_t> present;   // [id] 1 if the device exists and has a rate this tick
+    std::vector<METRICS> metrics;   // [id]
+    uint64_t idVersion = 0;         // DeviceIds::getVersion() of names, changes when ids are added or reused
+
+    size_t size() const { return names.size(); }
+
+    // Takes the names of added and reused ids and grows the arrays, existing entries keep their values.
+    void resize(const DeviceIds& ids) {
+        if (idVersion == ids.getVersion()) return;
+        idVersion = ids.getVersion();
+        names = ids.getNames();
+        read.resize(ids.size());
+        write.resize(ids.size());
+        present.resize(ids.size());
+        metrics.resize(ids.size());
+    }
+
+    // Calls f(id) for every present device.
+    template <class F>
+    void forEachPresent(F f) const {
+        for (size_t id = 0; id < present.size(); id++) {
+            if (present[id]) f(uint32_t(id));
+        }
+    }
+};
+
+using RateMap = std::map<std::string, std::pair<double, double>>;
+
+// Collector interface, checked at compile time:
+//  - frame collectors have getFrame() returning const DeviceFrame<M>& (ProcDiskStats, NetlinkNetworkStats)
+//  - rate collectors have getRate() returning a RateMap (by value or const ref), optionally getMetrics()
+//    returning std::map<std::string, DiskMetrics>; FrameReader interns their names into a frame.
+template <class T, class = void>
+struct hasFrame : std::false_type {};
+template <class T>
+struct hasFrame<T, std::void_t<typename std::decay_t<decltype(std::declval<T&>().getFrame())>::Metrics>> :
+    std::true_type {};
+
+template <class T, class = void>
+struct isRateCollector : std::false_type {};
+template <class T>
+struct isRateCollector<T, std::void_t<decltype(std::declval<T&>().getRate())>> :
+    std::is_same<std::decay_t<decltype(std::declval<T&>().getRate())>, RateMap> {};
+
+template <class T>
+constexpr bool isCollector = hasFrame<T>::value || isRateCollector<T>::value;
+
+template <class T, class = void>
+struct FrameOf {
+    using type = DeviceFrame<std::conditional_t<hasDiskMetrics<T>::value, DiskMetrics, NoMetrics>>;
+};
+template <class T>
+struct FrameOf<T, std::enable_if_t<hasFrame<T>::value>> {
+    using type = std::decay_t<decltype(std::declval<T&>().getFrame())>;
+};
+
+// Samples any collector and returns its tick as a frame. Frame collectors are passed through, rate collectors
+// are looked up by name once per device and tick into ids that stay stable.
+template <class STAT_TYPE>
+class FrameReader {
+private:
+    static_assert(
+        isCollector<STAT_TYPE>,
+        "STAT_TYPE needs getFrame() returning const DeviceFrame<M>&, or getRate() returning "
+        "std::map<std::string, std::pair<double, double>>"
+    );
+    using Frame = typename FrameOf<STAT_TYPE>::type;
+
+    DeviceIds ids;
+    Frame frame;
+
+public:
+    const Frame& read(STAT_TYPE& stats) {
+        if constexpr (hasFrame<STAT_TYPE>::value) {
+            return stats.getFrame();
+        } else {
+            const auto& rates = stats.getRate();
+            std::fill(frame.present.begin(), frame.present.end(), 0);
+            for (auto& [name, rate] : rates) ids.intern(name);
+            frame.resize(ids);
+            for (auto& [name, rate] : rates) {
+                uint32_t id = ids.find(name);
+                frame.read[id] = rate.first;
+                frame.write[id] = rate.second;
+                frame.present[id] = 1;
+            }
+            if constexpr (hasDiskMetrics<STAT_TYPE>::value) {
+                for (auto& [name, m] : stats.getMetrics()) {
+                    uint32_t id = ids.find(name);
+                    if (id != DeviceIds::none) frame.metrics[id] = m;
+                }
+            }
+            return frame;
+        }
+    }
+
+    // Ids of rate collectors, empty for frame collectors which keep their own.
+    const DeviceIds& getIds() const { return ids; }
+};
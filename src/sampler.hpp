@@ -0,0 +1,216 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+#include "./metricsexporter.hpp"
+#include "./mmapstore.hpp"
+#include "./overhead.hpp"
+#include "./sampleframe.hpp"
+#include "./spscring.hpp"
+
+class ProcDiskStats;
+class NetlinkNetworkStats;
+
+template <class FRAME>
+struct SampleFrame {
+    std::chrono::steady_clock::time_point time;
+    FRAME data{};
+};
+
+struct SamplerCounters {
+    uint64_t produced = 0;  // frames pushed by the worker
+    uint64_t dropped = 0;   // frames lost because the ring was full
+    uint64_t late = 0;      // collections that overran their interval
+    uint64_t errors = 0;    // collections that threw
+    uint64_t coalesced = 0; // frames the consumer skipped because a newer one was queued
+    uint64_t starved = 0;   // polls that found no new frame
+};
+
+// Runs a collector on its own thread at a fixed interval and hands timestamped frames to one consumer.
+// The collector either returns a FRAME or fills one in place, the latter reuses the buffers of frames
+// the consumer already picked up.
+template <class FRAME, size_t CAPACITY = 16>
+class BackgroundSampler {
+private:
+    std::function<void(FRAME&)> collect;
+    std::chrono::nanoseconds interval;
+    SpscRing<SampleFrame<FRAME>, CAPACITY> ring;
+
+    std::thread worker;
+    std::mutex stopMutex;
+    std::condition_variable stopCv;
+    bool stopping = false;
+
+    std::atomic<uint64_t> produced{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> late{0};
+    std::atomic<uint64_t> errors{0};
+    uint64_t coalesced = 0;
+    uint64_t starved = 0;
+
+    void run() {
+        auto next = std::chrono::steady_clock::now();
+        SampleFrame<FRAME> frame;
+        while (true) {
+            frame.time = std::chrono::steady_clock::now();
+            try {
+                collect(frame.data);
+                if (ring.tryPush(std::move(frame))) produced++;
+                else
+                    dropped++;
+            } catch (...) { errors++; }
+
+            next += interval;
+            auto now = std::chrono::steady_clock::now();
+            if (now > next) {
+                // skip the ticks we missed instead of bursting to catch up
+                late++;
+                next = now;
+            }
+
+            std::unique_lock<std::mutex> lock(stopMutex);
+            if (stopCv.wait_until(lock, next, [&] { return stopping; })) return;
+        }
+    }
+
+public:
+    template <class F>
+    BackgroundSampler(F f, std::chrono::nanoseconds interval) : interval(interval) {
+        if constexpr (std::is_invocable_v<F, FRAME&>) collect = std::move(f);
+        else
+            collect = [f = std::move(f)](FRAME& frame) mutable { frame = f(); };
+    }
+    BackgroundSampler(const BackgroundSampler&) = delete;
+    BackgroundSampler& operator=(const BackgroundSampler&) = delete;
+    ~BackgroundSampler() { stop(); }
+
+    void start() {
+        if (worker.joinable()) return;
+        stopping = false;
+        worker = std::thread([this] { run(); });
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(stopMutex);
+            stopping = true;
+        }
+        stopCv.notify_all();
+        if (worker.joinable()) worker.join();
+    }
+
+    // Consumer side, drains everything queued and keeps only the newest frame. Returns false if nothing was queued.
+    bool poll(SampleFrame<FRAME>& out) {
+        if (!ring.tryPop(out)) {
+            starved++;
+            return false;
+        }
+        while (ring.tryPop(out)) coalesced++;
+        return true;
+    }
+
+    // Consumer side, hands every queued frame to f in order.
+    template <class F>
+    size_t drain(F f) {
+        SampleFrame<FRAME> frame;
+        size_t n = 0;
+        while (ring.tryPop(frame)) {
+            f(frame);
+            n++;
+        }
+        if (n == 0) starved++;
+        return n;
+    }
+
+    // Consumer side, the worker owned counters are read atomically.
+    SamplerCounters getCounters() const {
+        SamplerCounters c;
+        c.produced = produced.load();
+        c.dropped = dropped.load();
+        c.late = late.load();
+        c.errors = errors.load();
+        c.coalesced = coalesced;
+        c.starved = starved;
+        return c;
+    }
+
+    std::chrono::nanoseconds getInterval() const { return interval; }
+};
+
+// Wraps any collector so it is sampled on a worker thread, getFrame() on this object only picks up the newest
+// frame. Rate collectors are converted to frames on the worker. Plugs into DiskUsageWidget<AsyncStats<STAT_TYPE>>
+// the same way as the wrapped collector.
+template <class STAT_TYPE>
+class AsyncStats {
+private:
+    using Frame = typename FrameOf<STAT_TYPE>::type;
+
+    STAT_TYPE stats; // only touched by the sampler thread
+    FrameReader<STAT_TYPE> reader; // only touched by the sampler thread
+    MappedRing<MetricRecord>* history; // only appended to by the sampler thread
+    BackgroundSampler<Frame> sampler;
+    SampleFrame<Frame> latest;
+    OverheadStage& stage = monitorOverhead().stage("collect: " + typeName<STAT_TYPE>());
+    RateFamilies families;
+    std::atomic<ExpositionSection*> exposition{nullptr};
+
+    void collect(Frame& f) {
+        OverheadScope scope(stage);
+        f = reader.read(stats);
+        if (history) {
+            int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                              std::chrono::system_clock::now().time_since_epoch()
+            ).count();
+            f.forEachPresent([&](uint32_t id) {
+                history->append(MetricRecord::make(now, f.names[id], {f.read[id], f.write[id]}));
+            });
+        }
+        if (ExpositionSection* section = exposition.load(std::memory_order_acquire)) {
+            std::string& out = section->begin();
+            renderFrame(out, families, f);
+            if constexpr (std::is_same_v<STAT_TYPE, ProcDiskStats>) renderDiskCounters(out, stats);
+            else if constexpr (std::is_same_v<STAT_TYPE, NetlinkNetworkStats>)
+                renderNetworkCounters(out, stats);
+            section->publish();
+        }
+    }
+
+public:
+    // Every frame is also appended to history when it is given, as (read, write) records per device. Further
+    // arguments go to the STAT_TYPE constructor.
+    template <class... StatArgs>
+    AsyncStats(
+        std::chrono::milliseconds interval = std::chrono::milliseconds(250), MappedRing<MetricRecord>* history = nullptr,
+        StatArgs&&... args
+    ) :
+        stats(std::forward<StatArgs>(args)...), history(history && history->valid() ? history : nullptr),
+        sampler([this](Frame& f) { collect(f); }, interval) {
+        sampler.start();
+    }
+    // The worker reads families and exposition, which are destroyed before the sampler would join it.
+    ~AsyncStats() { sampler.stop(); }
+
+    // The newest frame, the previous one again if the worker had nothing new.
+    const Frame& getFrame() {
+        sampler.poll(latest);
+        return latest.data;
+    }
+
+    std::chrono::steady_clock::time_point getSampleTime() const { return latest.time; }
+    SamplerCounters getCounters() const { return sampler.getCounters(); }
+
+    // Renders every frame into section on the worker, for a MetricsExporter, with the raw counters of collectors
+    // that keep them. Call at most once.
+    void exportTo(ExpositionSection& section, const RateFamilies& names) {
+        families = names;
+        exposition.store(&section, std::memory_order_release);
+    }
+};
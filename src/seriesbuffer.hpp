@@ -0,0 +1,115 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <utility>
+#include <vector>
+
+// Sliding window maximum in amortized O(1): candidates are kept in decreasing order,
+// a value that is older and smaller than a newer one can never be the maximum again.
+class MonotonicMax {
+private:
+    std::deque<std::pair<uint64_t, double>> candidates; // (sequence number, value)
+
+public:
+    void push(uint64_t seq, double value) {
+        while (!candidates.empty() && candidates.back().second <= value) candidates.pop_back();
+        candidates.push_back({seq, value});
+    }
+
+    // Drops everything older than oldestSeq.
+    void evict(uint64_t oldestSeq) {
+        while (!candidates.empty() && candidates.front().first < oldestSeq) candidates.pop_front();
+    }
+
+    double max() const { return candidates.empty() ? -std::numeric_limits<double>::infinity() : candidates.front().second; }
+
+    void clear() { candidates.clear(); }
+};
+
+// Fixed capacity ring of samples with one shared timestamp column and one value column per metric,
+// appends and the window maximum are O(1). Storage grows with the samples up to the capacity, so long
+// retention buffers only cost memory once they are filled.
+class SeriesBuffer {
+private:
+    size_t capacity;
+    size_t columns;
+    std::vector<int64_t> times;
+    std::vector<double> values; // [slot * columns + column]
+    std::vector<MonotonicMax> maxima;
+    size_t head = 0; // slot of the oldest sample
+    uint64_t seq = 0; // sequence number of the next append
+
+    size_t slot(size_t i) const { return (head + i) % capacity; }
+
+public:
+    SeriesBuffer(size_t capacity, size_t columns) : capacity(std::max<size_t>(capacity, 1)), columns(columns), maxima(columns) {}
+
+    // values must hold one entry per column.
+    void append(int64_t time, const double* v) {
+        size_t s;
+        if (times.size() < capacity) {
+            s = times.size();
+            times.push_back(time);
+            values.insert(values.end(), v, v + columns);
+        } else {
+            s = head;
+            head = (head + 1) % capacity;
+            times[s] = time;
+            std::copy(v, v + columns, &values[s * columns]);
+        }
+        for (size_t c = 0; c < columns; c++) {
+            maxima[c].push(seq, v[c]);
+            maxima[c].evict(seq + 1 - times.size());
+        }
+        seq++;
+    }
+
+    void append(int64_t time, const std::vector<double>& v) { append(time, v.data()); }
+
+    void clear() {
+        head = 0;
+        times.clear();
+        values.clear();
+        for (auto& m : maxima) m.clear();
+    }
+
+    size_t size() const { return times.size(); }
+    size_t getCapacity() const { return capacity; }
+    size_t getColumns() const { return columns; }
+
+    // i counts from the oldest sample.
+    int64_t time(size_t i) const { return times[slot(i)]; }
+    double value(size_t column, size_t i) const { return values[slot(i) * columns + column]; }
+
+    double max(size_t column) const { return maxima[column].max(); }
+    double max() const {
+        double m = -std::numeric_limits<double>::infinity();
+        for (auto& mm : maxima) m = std::max(m, mm.max());
+        return m;
+    }
+
+    // Index of the first sample at or after time, samples have to be appended in time order.
+    size_t lowerBound(int64_t time) const {
+        size_t lo = 0, hi = size();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (this->time(mid) < time) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+
+    // Calls f(time, value) for the samples of a column from index first to the newest,
+    // without the modulo per sample.
+    template <class F>
+    void forEach(size_t column, F f, size_t first = 0) const {
+        size_t count = size();
+        for (size_t i = first; i < count;) {
+            size_t s = slot(i);
+            size_t end = std::min(count - i, capacity - s) + s; // contiguous run up to the end of the storage
+            for (; s < end; s++, i++) f(times[s], values[s * columns + column]);
+        }
+    }
+};
@@ -0,0 +1,40 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// Single producer single consumer ring, slots are allocated once and swapped in/out: whatever was in a slot goes
+// back to the caller, so frames that own buffers circulate between producer and consumer instead of being freed.
+template <class T, size_t CAPACITY>
+class SpscRing {
+private:
+    static_assert(CAPACITY >= 2 && (CAPACITY & (CAPACITY - 1)) == 0, "capacity must be a power of two");
+
+    std::array<T, CAPACITY> slots;
+    alignas(64) std::atomic<size_t> head{0}; // next slot to read, owned by the consumer
+    alignas(64) std::atomic<size_t> tail{0}; // next slot to write, owned by the producer
+
+public:
+    // Producer side, returns false if the ring is full and the value was not taken.
+    // On success value holds the previous contents of the slot.
+    bool tryPush(T&& value) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == CAPACITY) return false;
+        std::swap(slots[t & (CAPACITY - 1)], value);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, returns false if there is nothing to read. The slot keeps the previous contents of out.
+    bool tryPop(T& out) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        std::swap(out, slots[h & (CAPACITY - 1)]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t size() const { return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire); }
+    static constexpr size_t capacity() { return CAPACITY; }
+};
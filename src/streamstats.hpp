@@ -0,0 +1,187 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Quantile sketch with a relative error bound (DDSketch): value v counts in bin ceil(log_gamma(v)), every value
+// of a bin is within relativeAccuracy of its midpoint. Sketches with the same accuracy merge by adding bins.
+// The bins are dense over the range seen; past maxBins the lowest ones are folded together, so only quantiles
+// near the bottom lose accuracy. Values below minPositive count as 0.
+class DDSketch {
+private:
+    double gamma;
+    double logGamma;
+    size_t maxBins;
+    std::vector<uint32_t> bins; // [index - offset]
+    int offset = 0;
+    uint64_t zeros = 0;
+    uint64_t count = 0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+    double sum = 0;
+
+    static constexpr double minPositive = 1e-9;
+
+    void insert(int index, uint64_t n) {
+        if (bins.empty()) {
+            offset = index;
+            bins.assign(1, 0);
+        } else if (index < offset) {
+            index = std::max(index, offset + int(bins.size()) - int(maxBins)); // folded into the lowest bin
+            if (index < offset) {
+                bins.insert(bins.begin(), offset - index, 0);
+                offset = index;
+            }
+        } else if (index >= offset + int(bins.size())) {
+            bins.resize(index - offset + 1, 0);
+            if (bins.size() > maxBins) {
+                size_t extra = bins.size() - maxBins;
+                for (size_t i = 0; i < extra; i++) bins[extra] += bins[i];
+                bins.erase(bins.begin(), bins.begin() + extra);
+                offset += extra;
+            }
+        }
+        bins[index - offset] += n;
+    }
+
+public:
+    DDSketch(double relativeAccuracy = 0.02, size_t maxBins = 256) :
+        gamma((1 + relativeAccuracy) / (1 - relativeAccuracy)), logGamma(std::log(gamma)),
+        maxBins(std::max<size_t>(maxBins, 1)) {}
+
+    void add(double v) {
+        count++;
+        sum += v;
+        min = std::min(min, v);
+        max = std::max(max, v);
+        if (v < minPositive) zeros++;
+        else
+            insert(int(std::ceil(std::log(v) / logGamma)), 1);
+    }
+
+    // other needs the same relative accuracy.
+    void merge(const DDSketch& other) {
+        if (other.count == 0) return;
+        for (size_t i = 0; i < other.bins.size(); i++) {
+            if (other.bins[i]) insert(other.offset + int(i), other.bins[i]);
+        }
+        zeros += other.zeros;
+        count += other.count;
+        sum += other.sum;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+    }
+
+    // Keeps the bin storage for the next samples.
+    void clear() {
+        bins.clear();
+        zeros = count = 0;
+        sum = 0;
+        min = std::numeric_limits<double>::infinity();
+        max = -std::numeric_limits<double>::infinity();
+    }
+
+    // q from 0 to 1, NaN when empty.
+    double quantile(double q) const {
+        if (count == 0) return std::numeric_limits<double>::quiet_NaN();
+        uint64_t rank = uint64_t(q * (count - 1));
+        if (rank < zeros) return std::max(min, 0.0);
+        uint64_t seen = zeros;
+        for (size_t i = 0; i < bins.size(); i++) {
+            seen += bins[i];
+            if (seen > rank) {
+                double value = 2 * std::pow(gamma, offset + int(i)) / (gamma + 1);
+                return std::clamp(value, min, max);
+            }
+        }
+        return max;
+    }
+
+    uint64_t getCount() const { return count; }
+    double getMin() const { return min; }
+    double getMax() const { return max; }
+    double getMean() const { return count ? sum / count : std::numeric_limits<double>::quiet_NaN(); }
+};
+
+// A summary of one window, NaN where the window had no samples.
+struct WindowSummary {
+    uint64_t count = 0;
+    double mean = std::numeric_limits<double>::quiet_NaN();
+    double p50 = std::numeric_limits<double>::quiet_NaN();
+    double p99 = std::numeric_limits<double>::quiet_NaN();
+    double max = std::numeric_limits<double>::quiet_NaN();
+};
+
+// A sliding window as a ring of sketches, one per slice of windowMs / slices. Adding touches only the newest
+// slice; a summary merges the slices, so it never looks at the samples again. The window moves a slice at a
+// time, it covers between windowMs - sliceMs and windowMs.
+class SlidingSketch {
+private:
+    int64_t sliceMs;
+    std::vector<DDSketch> ring;
+    int64_t newest = std::numeric_limits<int64_t>::min(); // slice number of the newest sample
+    DDSketch merged;
+
+public:
+    SlidingSketch(int64_t windowMs, size_t slices) :
+        sliceMs(std::max<int64_t>(windowMs / std::max<size_t>(slices, 1), 1)), ring(std::max<size_t>(slices, 1)) {}
+
+    // times have to increase.
+    void add(int64_t time, double v) {
+        int64_t slice = time / sliceMs;
+        if (slice != newest) {
+            // clear the slices skipped since the newest sample, at most the whole ring
+            int64_t first = slice - int64_t(ring.size()) + 1;
+            if (newest != std::numeric_limits<int64_t>::min()) first = std::max(first, newest + 1);
+            for (int64_t s = first; s <= slice; s++) ring[s % ring.size()].clear();
+            newest = slice;
+        }
+        ring[slice % ring.size()].add(v);
+    }
+
+    // The slices that still overlap the window ending at now.
+    WindowSummary summarize(int64_t now) {
+        merged.clear();
+        int64_t current = now / sliceMs;
+        for (int64_t s = current - int64_t(ring.size()) + 1; s <= std::min(current, newest); s++) {
+            if (s > newest - int64_t(ring.size())) merged.merge(ring[s % ring.size()]);
+        }
+        WindowSummary summary;
+        summary.count = merged.getCount();
+        if (summary.count == 0) return summary;
+        summary.mean = merged.getMean();
+        summary.p50 = merged.quantile(0.5);
+        summary.p99 = merged.quantile(0.99);
+        summary.max = merged.getMax();
+        return summary;
+    }
+};
+
+// Streaming statistics of one metric: an EWMA and quantile sketches over the last 5 minutes, hour and day.
+// O(1) per sample.
+class MetricSummary {
+private:
+    double tauMs;
+    double ewma = std::numeric_limits<double>::quiet_NaN();
+    int64_t lastTime = 0;
+    SlidingSketch windows[3] = {{5 * 60 * 1000, 10}, {60 * 60 * 1000, 12}, {24 * 60 * 60 * 1000, 24}};
+
+public:
+    static constexpr const char* windowNames[3] = {"5 min", "1 h", "24 h"};
+
+    // tauMs is the EWMA time constant, samples tauMs old weigh 1/e of the newest.
+    MetricSummary(double tauMs = 60 * 1000) : tauMs(tauMs) {}
+
+    void add(int64_t time, double v) {
+        if (std::isnan(ewma)) ewma = v;
+        else
+            ewma += (1 - std::exp(-(time - lastTime) / tauMs)) * (v - ewma);
+        lastTime = time;
+        for (auto& w : windows) w.add(time, v);
+    }
+
+    double getEwma() const { return ewma; }
+    WindowSummary summarize(size_t window, int64_t now) { return windows[window].summarize(now); }
+};
@@ -0,0 +1,166 @@
+#pragma once
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include <unistd.h>
+
+enum class OutputFormat { Csv, JsonLines, Binary };
+
+// The fields every record of a family carries, in order.
+struct RecordSchema {
+    uint8_t id; // family id in the binary framing
+    const char* family;
+    std::vector<const char*> fields;
+};
+
+// Binary framing, little endian, one frame per record:
+//   uint32 magic "DIO1", uint8 family id, uint8 value count, uint16 name length, int64 time in ms,
+//   name bytes (not terminated), value count doubles.
+// A file starts with one schema frame per family (family id, value count 0, name "family:field,field,...").
+struct BinaryFrameHeader {
+    uint32_t magic;
+    uint8_t family;
+    uint8_t valueCount;
+    uint16_t nameLength;
+    int64_t timeMs;
+};
+static_assert(sizeof(BinaryFrameHeader) == 16);
+constexpr uint32_t binaryFrameMagic = 0x314f4944; // "DIO1"
+
+// Formats records straight into a fixed buffer and hands it to write() only when it fills up or flush()
+// is called, so a steady stream of samples does no allocations and few syscalls.
+class SampleWriter {
+private:
+    int fd;
+    OutputFormat format;
+    char buffer[1 << 16];
+    size_t used = 0;
+    bool failed = false;
+
+    static constexpr size_t maxRecordSize = 4096;
+
+    void put(std::string_view s) {
+        std::memcpy(buffer + used, s.data(), s.size());
+        used += s.size();
+    }
+    void put(char c) { buffer[used++] = c; }
+
+    void putNumber(int64_t v) { used = std::to_chars(buffer + used, buffer + sizeof(buffer), v).ptr - buffer; }
+
+    // At most 64 characters, which the maxRecordSize reserve of write() counts on.
+    void putNumber(double v) {
+        if (!std::isfinite(v)) v = 0; // NaN and inf are not valid JSON
+        char text[64];
+        auto result = std::to_chars(text, text + sizeof(text), v, std::chars_format::fixed, 3);
+        if (result.ec != std::errc()) result = std::to_chars(text, text + sizeof(text), v); // 1e+60 and up
+        put(std::string_view(text, result.ptr - text));
+    }
+
+    // Device names come from the kernel but may still contain characters that would break the line formats.
+    void putName(std::string_view name) {
+        for (char c : name) put(c == '"' || c == '\\' || c == ',' || c < ' ' ? '_' : c);
+    }
+
+    void putBinary(const void* data, size_t size) {
+        std::memcpy(buffer + used, data, size);
+        used += size;
+    }
+
+public:
+    SampleWriter(int fd, OutputFormat format) : fd(fd), format(format) {}
+    SampleWriter(const SampleWriter&) = delete;
+    SampleWriter& operator=(const SampleWriter&) = delete;
+    ~SampleWriter() { flush(); }
+
+    // Column names for CSV, schema frames for the binary format, nothing for JSON Lines.
+    void writeHeader(const std::vector<RecordSchema>& schemas) {
+        for (auto& schema : schemas) {
+            if (used + maxRecordSize > sizeof(buffer)) flush();
+            if (format == OutputFormat::Csv) {
+                put("# time_ms,");
+                put(schema.family);
+                put(",device");
+                for (const char* field : schema.fields) {
+                    put(',');
+                    put(field);
+                }
+                put('\n');
+            } else if (format == OutputFormat::Binary) {
+                size_t start = used + sizeof(BinaryFrameHeader);
+                used = start;
+                put(schema.family);
+                put(':');
+                for (size_t i = 0; i < schema.fields.size(); i++) {
+                    if (i) put(',');
+                    put(schema.fields[i]);
+                }
+                BinaryFrameHeader h{binaryFrameMagic, schema.id, 0, uint16_t(used - start), 0};
+                std::memcpy(buffer + start - sizeof(h), &h, sizeof(h));
+            }
+        }
+    }
+
+    // values holds one entry per field of the schema.
+    void write(const RecordSchema& schema, std::string_view name, int64_t timeMs, const double* values) {
+        if (used + maxRecordSize > sizeof(buffer)) flush();
+        if (name.size() > 255) name = name.substr(0, 255);
+        size_t count = schema.fields.size();
+        switch (format) {
+        case OutputFormat::Csv:
+            putNumber(timeMs);
+            put(',');
+            put(schema.family);
+            put(',');
+            putName(name);
+            for (size_t i = 0; i < count; i++) {
+                put(',');
+                putNumber(values[i]);
+            }
+            put('\n');
+            break;
+        case OutputFormat::JsonLines:
+            put("{\"time_ms\":");
+            putNumber(timeMs);
+            put(",\"family\":\"");
+            put(schema.family);
+            put("\",\"device\":\"");
+            putName(name);
+            put('"');
+            for (size_t i = 0; i < count; i++) {
+                put(",\"");
+                put(schema.fields[i]);
+                put("\":");
+                putNumber(values[i]);
+            }
+            put("}\n");
+            break;
+        case OutputFormat::Binary: {
+            BinaryFrameHeader h{binaryFrameMagic, schema.id, uint8_t(count), uint16_t(name.size()), timeMs};
+            putBinary(&h, sizeof(h));
+            putBinary(name.data(), name.size());
+            putBinary(values, count * sizeof(double));
+            break;
+        }
+        }
+    }
+
+    // Returns false once a write failed, e.g. the reader of a pipe went away.
+    bool flush() {
+        size_t done = 0;
+        while (done < used && !failed) {
+            ssize_t n = ::write(fd, buffer + done, used - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) failed = true;
+            else done += n;
+        }
+        used = 0;
+        return !failed;
+    }
+
+    bool ok() const { return !failed; }
+};
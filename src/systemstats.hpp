@@ -1,87 +1,152 @@
 #pragma once
 
-#include <QFile>
-#include <QIODevice>
-#include <QString>
-#include <QStringList>
-#include <QTextStream>
+#include <cmath>
+#include <cstdio>
+#include <string_view>
+
+#include "./cpustats.hpp"
+#include "./procsnapshot.hpp"
+#include "./sampler.hpp"
+
+// Used memory in percent, counting everything but MemAvailable. -1 without a total.
+int memoryUsagePercent(uint64_t totalKB, uint64_t availableKB) {
+    if (totalKB == 0) return -1;
+    return int((totalKB - std::min(availableKB, totalKB)) * 100 / totalKB);
+}
 
 class SystemStats {
 private:
-    int m_previousTotalTime = 0;
-    int m_previousIdle = 0;
+    CpuStats cpu;
+    ProcSnapshot::File meminfo;
+    uint64_t memTotal = 0; // kB, of the last getMemoryUsage()
+    uint64_t memAvailable = 0;
 
 public:
+    // root is prepended to /proc, for fixture trees in benchmarks.
+    SystemStats(ProcSnapshot& snapshot = sharedProcSnapshot(), std::string root = "") :
+        cpu(snapshot, root + "/proc/stat"), meminfo(snapshot.subscribe(root + "/proc/meminfo")) {}
+
     int getCpuUsage() {
-        QFile statFile("/proc/stat");
-        if (!statFile.open(QIODevice::ReadOnly | QIODevice::Text)) return -1;
-
-        QTextStream in(&statFile);
-        QString line;
-        do {
-            line = in.readLine();
-            if (line.startsWith("cpu ")) {
-                QStringList values = line.split(' ', QString::SkipEmptyParts);
-                if (values.size() >= 8) {
-                    int user = values[1].toInt();
-                    int nice = values[2].toInt();
-                    int system = values[3].toInt();
-                    int idle = values[4].toInt();
-
-                    int totalTime = user + nice + system + idle;
-
-                    int deltaTime = totalTime - m_previousTotalTime;
-                    int currentUsage = (deltaTime > 0) ? ((deltaTime - (idle - m_previousIdle)) * 100) / deltaTime : 0;
-
-                    m_previousTotalTime = totalTime;
-                    m_previousIdle = idle;
-
-                    if (currentUsage < 0) currentUsage = 0;
-                    else if (currentUsage > 100)
-                        currentUsage = 100;
-
-                    statFile.close();
-                    return currentUsage;
-                }
-            }
-        } while (!line.isNull());
+        if (!cpu.sample()) return -1;
+        return (int)std::lround(cpu.getUsage().busy[0]);
+    }
 
-        statFile.close();
+    // Per core breakdown of the interval measured by the last getCpuUsage() call.
+    const CpuUsage& getCpuCoreUsage() const { return cpu.getUsage(); }
 
-        return -1;
+    int getMemoryUsage() {
+        uint64_t totalMemory = 0;
+        uint64_t freeMemory = 0;
+
+        meminfo.with([&](std::string_view file) {
+            size_t lineStart = 0;
+            while (lineStart < file.size() && (totalMemory == 0 || freeMemory == 0)) {
+                size_t lineEnd = file.find('\n', lineStart);
+                if (lineEnd == std::string_view::npos) lineEnd = file.size();
+                std::string_view line = file.substr(lineStart, lineEnd - lineStart);
+                lineStart = lineEnd + 1;
+
+                size_t pos = 0;
+                std::string_view key = nextToken(line, pos);
+                if (key == "MemTotal:") parseNumber(nextToken(line, pos), totalMemory);
+                else if (key == "MemAvailable:")
+                    parseNumber(nextToken(line, pos), freeMemory);
+            }
+        });
+
+        memTotal = totalMemory;
+        memAvailable = freeMemory;
+        return memoryUsagePercent(totalMemory, freeMemory);
     }
 
-    int getMemoryUsage() {
-        QFile meminfoFile("/proc/meminfo");
-        if (!meminfoFile.open(QIODevice::ReadOnly | QIODevice::Text)) return -1;
-
-        QTextStream in(&meminfoFile);
-        QString line;
-        int totalMemory = 0;
-        int freeMemory = 0;
-
-        do {
-            line = in.readLine();
-            if (line.startsWith("MemTotal:")) {
-                totalMemory = line.split(" ", QString::SkipEmptyParts)[1].toInt();
-            } else if (line.startsWith("MemAvailable:")) {
-                freeMemory = line.split(" ", QString::SkipEmptyParts)[1].toInt();
+    // The collectors behind the last samples, for recordings of the raw counters.
+    const CpuStats& getCpuStats() const { return cpu; }
+    uint64_t getMemoryTotalKB() const { return memTotal; }
+    uint64_t getMemoryAvailableKB() const { return memAvailable; }
+};
+
+struct SystemSample {
+    int cpu = -1;
+    int memory = -1;
+    CpuUsage cores;
+};
+
+// CPU and memory in the exposition format, slot 0 of cores is labeled cpu="all". Skips what was not sampled
+// (no slots, memory < 0).
+void renderSystemExposition(std::string& out, const CpuUsage& cores, int memory) {
+    char cpuName[16];
+    auto cpuLabel = [&](size_t slot) -> std::string_view {
+        if (slot == 0) return "all";
+        return std::string_view(cpuName, snprintf(cpuName, sizeof(cpuName), "%zu", slot - 1));
+    };
+    if (cores.slots > 0) {
+        appendFamily(out, "diskio_cpu_busy_ratio", "Fraction of the time the CPU was neither idle nor waiting on I/O.");
+        for (size_t slot = 0; slot < cores.slots; slot++) {
+            appendSample(out, "diskio_cpu_busy_ratio", {{"cpu", cpuLabel(slot)}}, cores.busy[slot] / 100);
+        }
+        appendFamily(out, "diskio_cpu_mode_ratio", "Fraction of the time the CPU spent in each mode.");
+        for (size_t slot = 0; slot < cores.slots; slot++) {
+            for (int s = 0; s < CpuStateCount; s++) {
+                appendSample(
+                    out, "diskio_cpu_mode_ratio", {{"cpu", cpuLabel(slot)}, {"mode", cpuStateName(s)}},
+                    cores.getState(s, slot) / 100
+                );
             }
-        } while (!line.isNull());
+        }
+    }
+    if (memory >= 0) {
+        appendFamily(out, "diskio_memory_used_ratio", "Fraction of the memory that is not available.");
+        appendSample(out, "diskio_memory_used_ratio", {}, memory / 100.0);
+    }
+}
 
-        meminfoFile.close();
+// Samples SystemStats on a worker thread, poll() once per UI tick then read the getters.
+class AsyncSystemStats {
+private:
+    SystemStats stats; // only touched by the sampler thread
+    std::function<SystemSample()> source; // replaces stats when set, e.g. a replay
+    BackgroundSampler<SystemSample> sampler;
+    SampleFrame<SystemSample> latest;
+    OverheadStage& stage = monitorOverhead().stage("collect: SystemStats");
+    std::atomic<ExpositionSection*> exposition{nullptr};
 
-        if (totalMemory > 0) {
-            uint64_t usedMemory = totalMemory - freeMemory;
-            uint64_t currentUsage = (usedMemory * 100) / totalMemory;
+public:
+    AsyncSystemStats(
+        std::function<SystemSample()> source = {}, std::chrono::milliseconds interval = std::chrono::milliseconds(250)
+    ) :
+        source(std::move(source)),
+        sampler(
+            [this]() {
+                OverheadScope scope(stage);
+                SystemSample s;
+                if (this->source) {
+                    s = this->source();
+                } else {
+                    s.cpu = stats.getCpuUsage();
+                    s.memory = stats.getMemoryUsage();
+                    s.cores = stats.getCpuCoreUsage();
+                }
+                if (ExpositionSection* section = exposition.load(std::memory_order_acquire)) {
+                    renderSystemExposition(section->begin(), s.cores, s.memory);
+                    section->publish();
+                }
+                return s;
+            },
+            interval
+        ) {
+        sampler.start();
+    }
+    // The worker reads stage and exposition, which are destroyed before the sampler would join it.
+    ~AsyncSystemStats() { sampler.stop(); }
 
-            if (currentUsage < 0) currentUsage = 0;
-            else if (currentUsage > 100)
-                currentUsage = 100;
+    void poll() { sampler.poll(latest); }
 
-            return currentUsage;
-        }
+    int getCpuUsage() const { return latest.data.cpu; }
+    int getMemoryUsage() const { return latest.data.memory; }
+    const CpuUsage& getCpuCoreUsage() const { return latest.data.cores; }
 
-        return -1;
-    }
-};
\ No newline at end of file
+    SamplerCounters getCounters() const { return sampler.getCounters(); }
+
+    // Renders every sample into section on the worker, for a MetricsExporter.
+    void exportTo(ExpositionSection& section) { exposition.store(&section, std::memory_order_release); }
+};